@@ -15,21 +15,26 @@
  *                  +-----------:_:-----------+
  *       ICD_VPP -> :  1 MCLRn         PGD 28 : <> RB7         ICD_PGD
  *   SW_EN_a RA0 <> :  2 AN0           PGC 27 : <> RB6 LED_REC/ICD_PGC
- *   SW_EN_b RA1 <> :  3 AN1               26 : <> RB5 LED_IN6 (tape)
- *   SW_EN_c RA2 <> :  4 AN2               25 : <> RB4 LED_IN5 (tuner)
- *  SW7_RECn RA3 <> :  5 AN3           PGM 24 : <> RB3 LED_IN4 (a.v.)
- * IR_IN_RC5 RA4 <> :  6 T0CKI             23 : <> RB2 LED_IN3 (cd)
- *  DEBUG_IO RA5 <> :  7 AN4               22 : <> RB1 LED_IN2 (video)
- *           GND <> :  8 VSS          INT0 21 : <> RB0 LED_IN1 (disc)
+ *   SW_EN_b RA1 <> :  3 AN1               26 : <> RB5 RLY_IN6 (tape)
+ *   SW_EN_c RA2 <> :  4 AN2               25 : <> RB4 RLY_IN5 (tuner)
+ *  SW7_RECn RA3 <> :  5 AN3           PGM 24 : <> RB3 RLY_IN4 (a.v.)
+ * IR_IN_RC5 RA4 <> :  6 T0CKI             23 : <> RB2 RLY_IN3 (cd)
+ *  DEBUG_IO RA5 <> :  7 AN4               22 : <> RB1 RLY_IN2 (video)
+ *           GND <> :  8 VSS          INT0 21 : <> RB0 RLY_IN1 (disc)
  *     4MHz XTAL -> :  9 OSC1          VDD 20 : <- 5v0
  *     4MHz XTAL <- : 10 OSC2          VSS 19 : <- GND
- *  LED_REC1 RC0 <> : 11 T1OSO          RX 18 : <> RC7 MUTEn
- *  LED_REC2 RC1 <> : 12 T1OSI          TX 17 : <> RC6 MOTOR_A (VOL+)
- *  LED_REC3 RC2 <> : 13 CCP1              16 : <> RC5 MOTOR_B (VOL-)
- *  LED_REC4 RC3 <> : 14                   15 : <> RC4 LED_REC5
+ *  RLY_REC1 RC0 <> : 11 T1OSO          RX 18 : <> RC7 RLY_MUTEn
+ *  RLY_REC2 RC1 <> : 12 T1OSI          TX 17 : <> RC6 MOTOR_A (VOL+)
+ *  RLY_REC3 RC2 <> : 13 CCP1              16 : <> RC5 MOTOR_B (VOL-)
+ *  RLY_REC4 RC3 <> : 14                   15 : <> RC4 RLY_REC5
  *                  +-------------------------+
  *                            DIP-28 
  * 
+ *  A RLY_ line lights its indicator and drives a reed relay, the
+ *  input relays RL7-RL12, the record relays RL1-RL5 and the mute
+ *  relay RL6, through a transistor on the preamp board. LED_REC
+ *  only lights the (record) indicator. See RELAY_B_MASK.
+ * 
  *  This is how the user interactions are implemented:
  * 
  *      There are seven normally open push buttons that are
@@ -39,7 +44,10 @@
  *      for the tape recorder.
  * 
  *      At power start all inputs sources are off and the (mute) 
- *      is enabled. Pressing a source select button, (disc) (video) 
+ *      is enabled. After a reset from MCLRn the inputs, (mute) 
+ *      and (record) are restored as they were, see Retain.
+ * 
+ *      Pressing a source select button, (disc) (video) 
  *      (cd) (a.v.) (tuner) (tape) will select that source as the 
  *      amplifier input. Once an amplifier source is selected 
  *      another press of that source select button will toggle the 
@@ -55,29 +63,35 @@
  * 
  *  Notes:
  * 
- *      As of 2021-JULY-3 there is no decoder implementation for 
- *      any infrared (IR) remote control transmitter.
- * 
- *      When a suitable IR transmitter has been selected and 
- *      the transmitter codes assigned to amplifier functions 
- *      for input selection, (record) mode, (mute), (volume) up 
- *      and (volume) down then the volume motor drive logic 
- *      can be implemented.
+ *      Edges from the IR receiver are captured by the TIMER0
+ *      interrupt and decoded as Philips RC5 frames. Frames for 
+ *      the amplifier system address select the inputs, (record), 
+ *      (mute) and (volume), see IR_Map[].
  * 
  *      The volume motor drive circuit is vulnerable to damage 
  *      when the (VOL+) and (VOL-) drive signals are high 
  *      at the same time. Any implementation must avoid 
  *      this condition.
  * 
+ *      The volume motor is driven from the IR remote with an
+ *      estimate of its position, see Motor_Update(). Both drive
+ *      signals are set from one drive state so they cannot be
+ *      high together.
+ * 
+ *      The watchdog timer and brown-out reset are enabled. When 
+ *      the main loop stops or the supply dips the controller is 
+ *      reset and the inputs, (mute) and (record) are restored, 
+ *      see Retain.
+ * 
  *      There may be enough buttons on the IR transmitter to 
  *      implement a less complex method to select between the
  *      the tape output and audio source when in (record) mode.
  */
 
 #pragma config FOSC = XT        // Oscillator Selection bits (XT oscillator)
-#pragma config WDTE = OFF       // Watchdog Timer Enable bit (WDT disabled)
-#pragma config PWRTE = OFF      // Power-up Timer Enable bit (PWRT disabled)
-#pragma config BOREN = OFF      // Brown-out Reset Enable bit (BOR disabled)
+#pragma config WDTE = ON        // Watchdog Timer Enable bit (WDT enabled)
+#pragma config PWRTE = ON       // Power-up Timer Enable bit (PWRT enabled)
+#pragma config BOREN = ON       // Brown-out Reset Enable bit (BOR enabled)
 #pragma config LVP = OFF        // Low-Voltage (Single-Supply) In-Circuit Serial Programming Enable bit (RB3 is digital I/O, HV on MCLR must be used for programming)
 #pragma config CPD = OFF        // Data EEPROM Memory Code Protection bit (Data EEPROM code protection off)
 #pragma config CP = OFF         // Flash Program Memory Code Protection bit (Code protection off)
@@ -89,6 +103,66 @@
 /* Tell compiler the system oscillator frequency we will setup */
 #define _XTAL_FREQ (4000000ul)
 
+/*
+ * Build options, uncomment to enable
+ *
+ * DEBUG_TRACE: keep a journal of the most recent output changes
+ * DEBUG_TIMING: drive DEBUG_IO high while the main loop is busy,
+ *      tools/sim/cycles.c gives the host build the same timing
+ * DEBUG_CAPTURE: record raw switch input changes
+ * DEBUG_SERIAL: read and write the tunables over DEBUG_IO
+ */
+/* #define DEBUG_TRACE */
+/* #define DEBUG_TIMING */
+/* #define DEBUG_CAPTURE */
+/* #define DEBUG_SERIAL */
+
+#if defined(DEBUG_TIMING) && defined(DEBUG_SERIAL)
+#error "DEBUG_TIMING and DEBUG_SERIAL both use DEBUG_IO"
+#endif
+
+/*
+ * The PIC16F870 has 128 bytes of RAM and the application leaves
+ * too little of it for the buffers and counters of the debug
+ * options. Build them for the PIC16F876A, which has 368 bytes,
+ * and check the memory summary of the XC8 build for what is left.
+ * DEBUG_CAPTURE builds for either, see Capture_Sample().
+ */
+#if defined(_16F870) && (defined(DEBUG_TRACE) || defined(DEBUG_SERIAL))
+#error "DEBUG_TRACE and DEBUG_SERIAL need the RAM of a PIC16F876A"
+#endif
+
+/*
+ * Hot code placement
+ *
+ * The PIC16F870 has one 2K word page of program memory. The
+ * PIC16F876A has four, and every call or goto between pages must
+ * first load PCLATH, which costs extra instructions on each call.
+ *
+ * Functions that run on every tick are marked HOT_CODE. Building
+ * for the PIC16F876A with PAGE_HOT_CODE defined puts them in the
+ * hotcode psect, which must be linked into page 0 with the interrupt
+ * handler by adding this option to the linker:
+ *
+ *      -Wl,-Photcode=0100h
+ *
+ * The calls among them then need no page select. Each call or goto
+ * that still changes PCLATH first is a cross-page transfer and costs
+ * up to two extra instruction cycles for the page select plus two
+ * more to restore it after the return. tools/sim/pages.c lists them
+ * from the XC8 listing of this build with what each costs:
+ *
+ *      make -C tools/sim hot LISTING=<the .lst file of the build>
+ *
+ * The PIC16F876A configuration of the MPLAB X project defines
+ * PAGE_HOT_CODE and passes the linker option.
+ */
+#ifdef PAGE_HOT_CODE
+#define HOT_CODE __section("hotcode")
+#else
+#define HOT_CODE
+#endif
+
 /*
  * Application specific defines
  */
@@ -98,14 +172,312 @@
 #define SW_RECn_ASSERTED (0)
 #define SW_RECn_RELEASED (1)
 
-#define LED_REC_TOGGLE() PORTB^=(1<<6)
-#define LED_MUTEn_TOGGLE() PORTC^=(1<<7)
+#define DEBUG_IO PORTAbits.RA5
+#define DEBUG_IO_TRIS TRISAbits.TRISA5
+
+#define LED_REC_TOGGLE() App.Panel.PortB^=(1<<6)
+#define LED_MUTEn_TOGGLE() App.Panel.PortC^=(1<<7)
+/*
+ * Timebase
+ *
+ * TIMER1 counts instruction cycles, 1 microsecond with the 4MHz
+ * crystal, and is never stopped or reloaded. The interrupt handler
+ * extends it with a software overflow count to make a 24-bit
+ * microsecond timestamp that wraps about every 16.7 seconds.
+ *
+ * TIMER2 interrupts every 250 microseconds, a sub-tick. Every
+ * fourth sub-tick advances an 8-bit tick count, so the tick is one
+ * millisecond. The sub-ticks time the relay coil hold PWM.
+ *
+ * Intervals are found by unsigned subtraction so they are correct
+ * across wraparound as long as they are less than half the range
+ * of the counter, 127 ticks or 32767 microseconds. This keeps the
+ * hot paths in 8-bit and 16-bit math.
+ *
+ * Data shared with the interrupt handler
+ *
+ * The PIC16 reads and writes one byte at a time so an interrupt
+ * can land between the bytes of any wider access. These rules keep
+ * the main loop and the interrupt handler from tearing a read or
+ * losing an update:
+ *
+ *      Each shared variable has one writer, either the interrupt
+ *      handler or the main loop, never both.
+ *
+ *      Shared variables are volatile and one byte wide where
+ *      possible. A single byte read or write cannot be torn.
+ *
+ *      A value wider than a byte is read by repeating the read
+ *      until two passes agree, as Timebase_Now() does, or with
+ *      interrupts held off by di() and ei() around the read.
+ *
+ *      The main loop never does a read-modify-write of a byte
+ *      that the interrupt handler also writes.
+ *
+ * TMR1_Overflow, SubTick, Tick, IR_EdgeHead and IR_EdgeOverrun
+ * are written only by the interrupt handler. IR_EdgeTail, the
+ * Drive_ port images and Relay_Hold are written only by the main
+ * loop.
+ *
+ * These one byte variables are declared ISR_SHARED, which is
+ * volatile. The race test of the host simulator builds them as C11
+ * atomics, which is what a one byte access is on the PIC, so that
+ * ThreadSanitizer checks the ordering of everything else around
+ * them.
+ */
+#ifndef ISR_SHARED
+#define ISR_SHARED volatile
+#endif
+
+#define SUBTICKS (4)                /* must be a power of 2 */
+
+ISR_SHARED uint8_t TMR1_Overflow;
+ISR_SHARED uint8_t SubTick;
+ISR_SHARED uint8_t Tick;
+
+#define TICK_ELAPSED(now, then) ((uint8_t)((uint8_t)(now) - (uint8_t)(then)))
+#define TICK_BEFORE(a, b) ((int8_t)((uint8_t)(a) - (uint8_t)(b)) < 0)
+#define US16_ELAPSED(now, then) ((uint16_t)((uint16_t)(now) - (uint16_t)(then)))
+#define US16_BEFORE(a, b) ((int16_t)((uint16_t)(a) - (uint16_t)(b)) < 0)
+/*
+ * Infrared receiver edge queue
+ *
+ * TIMER0 counts edges on RA4/T0CKI. It is loaded with 0xFF so the
+ * next edge overflows it, and the interrupt handler flips the edge
+ * select so both edges of the receiver output are caught.
+ *
+ * Each edge is stored as the low 16 bits of the microsecond
+ * timestamp with bit 0 replaced by the new level of RA4. One
+ * microsecond is far finer than RC5 needs.
+ *
+ * The queue has a single producer, the interrupt handler, which
+ * only writes IR_EdgeHead, and a single consumer, the main loop,
+ * which only writes IR_EdgeTail. The producer stores the entry
+ * before it advances the head and the consumer reads the entry
+ * before it advances the tail, so neither side ever sees a slot
+ * the other is using. When the queue is full the edge is dropped
+ * and IR_EdgeOverrun is counted so the decoder can start over.
+ */
+#define IR_EDGE_QUEUE_SIZE (8)      /* must be a power of 2 */
+
+volatile uint16_t IR_EdgeQueue[IR_EDGE_QUEUE_SIZE];
+ISR_SHARED uint8_t IR_EdgeHead;
+ISR_SHARED uint8_t IR_EdgeTail;
+ISR_SHARED uint8_t IR_EdgeOverrun;
+/*
+ * Tunables
+ *
+ * Timing constants that may need adjusting for a unit in the field
+ * are kept in Tune[] rather than built in. They are loaded from a
+ * data EEPROM record at start up and can be changed from the IR
+ * remote, or over DEBUG_IO in a DEBUG_SERIAL build, without
+ * building new firmware. A change takes effect on the next tick.
+ * The limits of each are in Tune_Limit[].
+ *
+ * Tune[] is written only by the main loop. The interrupt handler
+ * reads TUNE_HOLD_DUTY, a single byte.
+ */
+typedef enum
+{
+    TUNE_DEBOUNCE_MIN,      /* ticks, shortest switch debounce */
+    TUNE_DEBOUNCE_MARGIN,   /* ticks added to the learned bounce */
+    TUNE_RC5_TOLERANCE,     /* 4 microsecond units, RC5 interval window */
+    TUNE_RELAY_MUTE,        /* ticks for the mute relay to operate */
+    TUNE_RELAY_SETTLE,      /* ticks for the source relays to settle */
+    TUNE_RELAY_PULLIN,      /* ticks of full coil drive after turn on */
+    TUNE_HOLD_DUTY,         /* sub-ticks of SUBTICKS the coil is held on */
+    TUNE_MOTOR_DEAD,        /* ticks the motor stops before it starts */
+    TUNE_COUNT
+} TuneId_t;
+
+__persistent uint8_t Tune[TUNE_COUNT];
+/*
+ * Statistics
+ *
+ * In a DEBUG_SERIAL build the main loop counts the events that
+ * show how well the tunables suit a unit. A PC can then step a
+ * tunable over its range with the 'W' command and read the counts
+ * for each setting with the 'C' command, see Serial_Command():
+ *
+ *      IR_Starts   RC5 frames started by a mark. Starts that do
+ *                  not end in a frame are noise or frames lost to
+ *                  a window that is too narrow.
+ *      IR_Frames   RC5 frames decoded.
+ *      SW_Events   switch states reported after debounce.
+ *      SW_Late     switch changes that came after the state was
+ *                  reported but while the switch still bounced, so
+ *                  the debounce time was too short.
+ *
+ * The counts are 8 bits and wrap, and are cleared when read.
+ */
+#ifdef DEBUG_SERIAL
+typedef struct
+{
+    uint8_t IR_Starts;
+    uint8_t IR_Frames;
+    uint8_t SW_Events;
+    uint8_t SW_Late;
+} Stats_t;
+
+Stats_t Stats;
+
+#define STAT_COUNT(Counter) (Stats.Counter++)
+#else
+#define STAT_COUNT(Counter)
+#endif
+/*
+ * Relay lines
+ *
+ * RELAY_B_MASK and RELAY_C_MASK are the lines that drive a relay
+ * coil, the RLY_ lines of the pin header. Each also lights an
+ * indicator. The staggered switching and the coil economiser below
+ * both use them.
+ *
+ * Relay coil economiser
+ *
+ * A reed relay needs its full coil current to pull in, but only
+ * a fraction of it to stay closed. Once a relay line has been on
+ * for TUNE_RELAY_PULLIN it is pulse width modulated, on for
+ * TUNE_HOLD_DUTY of each SUBTICKS sub-tick period of one
+ * millisecond, which dims its indicator too. The default duty is
+ * SUBTICKS, full drive, until the hold current of a unit has been
+ * measured and the duty lowered to suit. The coil current, slowed
+ * by the flyback diode, must not fall to the drop out current in
+ * the off part of the period.
+ *
+ * The ports are written only by the interrupt handler, at the
+ * start of each sub-tick, from the Drive_ images of the outputs
+ * with the relay lines turned off in the off part of the period
+ * while Relay_Hold is set.
+ * The main loop writes the images. A new output state reaches the
+ * pins at the next sub-tick, within 250 microseconds.
+ *
+ * When any relay line turns on, every relay line is driven fully
+ * until the new one has pulled in, so a relay is never modulated
+ * before it has closed. Relay_Hold is cleared before the Drive_
+ * image is written so the interrupt handler never sees a new line
+ * in the hold state.
+ */
+#define RELAY_B_MASK (0b00111111)   /* RB0-RB5 source relays */
+#define RELAY_C_MASK (0b10011111)   /* RC0-RC4 record relays, RC7 mute relay */
+#define RELAY_PULLIN_TICKS (20)
+#define RELAY_HOLD_DUTY (SUBTICKS)
+#define RELAY_MUTE_TICKS (5)        /* see Panel_Commit() */
+#define RELAY_SETTLE_TICKS (10)
+
+ISR_SHARED uint8_t Drive_PortB;
+ISR_SHARED uint8_t Drive_PortC;
+ISR_SHARED __bit Relay_Hold;
+__bit Relay_HoldPending;
+/*
+ * Staggered output switching
+ *
+ * Turning on several relay coils in the same instruction draws
+ * their inrush currents together and dips the supply, which the
+ * IR receiver and the oscillator both feel. Each output line is in
+ * one of two inrush classes:
+ *
+ *      heavy   a relay coil, set in RELAY_B_MASK or RELAY_C_MASK.
+ *              At most one heavy line is turned on in each sub-tick.
+ *
+ *      light   an LED or the volume motor drive. Switched at once.
+ *
+ * Lines are always turned off at once. Live_PortB and Live_PortC
+ * hold the heavy lines the interrupt handler has turned on, and are
+ * written only by the interrupt handler. When every heavy line is
+ * turned on together the last of them follows INRUSH_LINES sub-ticks
+ * later, 3 milliseconds, well inside the relay settle time that
+ * Panel_Commit() waits before (mute) is turned off. The relay pull
+ * in time is counted from the end of the stagger.
+ */
+#define INRUSH_LINES (12)           /* lines set in the two relay masks */
+#define INRUSH_TICKS ((INRUSH_LINES + SUBTICKS - 1) / SUBTICKS)
+
+volatile uint8_t Live_PortB;
+volatile uint8_t Live_PortC;
 /*
  * Interrupt vector handler
+ *
+ * The edge capture is done first so the IR edge timestamp is not
+ * delayed by the other work, which is the same on every sub-tick.
  */
 void __interrupt() ISR(void)
 {
-    
+    if (INTCONbits.TMR0IE && INTCONbits.TMR0IF)
+    {
+        uint8_t High;
+        uint8_t Low;
+        uint8_t Next;
+        
+        do
+        {
+            High = TMR1H;
+            Low = TMR1L;
+        } while (High != TMR1H);
+        
+        /* T0SE set means this was a falling edge */
+        Low &= 0xFE;
+        if (OPTION_REGbits.T0SE == 0)
+        {
+            Low |= 1;
+        }
+        OPTION_REGbits.T0SE ^= 1;
+        TMR0 = 0xFF;
+        INTCONbits.TMR0IF = 0;
+        
+        Next = (IR_EdgeHead + 1) & (IR_EDGE_QUEUE_SIZE - 1);
+        if (Next != IR_EdgeTail)
+        {
+            IR_EdgeQueue[IR_EdgeHead] = ((uint16_t)High << 8) | Low;
+            IR_EdgeHead = Next;
+        }
+        else
+        {
+            IR_EdgeOverrun++;
+        }
+    }
+    if (PIE1bits.TMR1IE && PIR1bits.TMR1IF)
+    {
+        PIR1bits.TMR1IF = 0;
+        TMR1_Overflow++;
+    }
+    if (PIE1bits.TMR2IE && PIR1bits.TMR2IF)
+    {
+        uint8_t Pending;
+        uint8_t PortB;
+        uint8_t PortC;
+        
+        PIR1bits.TMR2IF = 0;
+        SubTick = (SubTick + 1) & (SUBTICKS - 1);
+        if (SubTick == 0)
+        {
+            Tick++;
+        }
+        
+        /* turn on the next heavy line, lowest bit of PORTB first */
+        Live_PortB &= Drive_PortB;
+        Live_PortC &= Drive_PortC;
+        Pending = Drive_PortB & RELAY_B_MASK & ~Live_PortB;
+        if (Pending)
+        {
+            Live_PortB |= Pending & (uint8_t)-Pending;
+        }
+        else
+        {
+            Pending = Drive_PortC & RELAY_C_MASK & ~Live_PortC;
+            Live_PortC |= Pending & (uint8_t)-Pending;
+        }
+        PortB = (Drive_PortB & ~RELAY_B_MASK) | Live_PortB;
+        PortC = (Drive_PortC & ~RELAY_C_MASK) | Live_PortC;
+        
+        if (Relay_Hold && (SubTick >= Tune[TUNE_HOLD_DUTY]))
+        {
+            PortB &= ~RELAY_B_MASK;
+            PortC &= ~RELAY_C_MASK;
+        }
+        PORTB = PortB;
+        PORTC = PortC;
+    }
 }
 /*
  * Initialize this PIC
@@ -130,186 +502,2540 @@ void PIC_Init(void)
     PORTC = 0;
 }
 /*
- * Function: PollSwitches
- * 
- * Description:
- * There are seven push button switches. When one of six is pressed 
- * a code is asserted on bits 0-2 of PORTA. The seventh switch is 
- * connected to bit 3 of PORTA.
- * 
- * Sample the hardware switches and return which one is pressed.
- * 
- * The logic of this implementation causes the "lower numbered" 
- * switches to have a higher priority. This means that when more 
- * than one switch is pressed a lower number switch assertion is
- * returned. For example if SW_2 and SW_3 are both pressed then 
- * SW_1 will be the state returned.
- * 
- * This is less than ideal but this is the way the hardware works.
- * 
- * This amplifier was designed 20 years ago in the U.K. so I expect 
- * a few more of these "Richards" to float up.
+ * Data EEPROM
+ *
+ * Data EEPROM holds records. Each record is a tag byte, the data
+ * and a CRC-8 of the tag and the data:
+ *
+ *      +-----+------------------+-----+
+ *      | tag | data, n bytes    | CRC |
+ *      +-----+------------------+-----+
+ *
+ * The tag has the record number in bits 4-7 and the version of
+ * its layout in bits 0-3. A record whose tag or CRC does not match,
+ * as after a write torn by a power failure, is not used and the
+ * defaults are used in its place.
+ *
+ * Address map, layout version 1:
+ *
+ *      0x00-0x05   volume motor constants, 4 bytes
+ *      0x06-0x0E   learned switch debounce, 7 bytes, one per switch
+ *      0x0F-0x18   tunables, 8 bytes
+ *      0x19-0x1E   volume motor constants, copy made by migration
+ *      0x1F-0x27   learned switch debounce, copy made by migration
+ *
+ * Layout version 0 had no records:
+ *
+ *      0x00-0x03   volume motor constants
+ *      0x04-0x0A   learned switch debounce
+ *
+ * EEPROM that does not start with a version 1 motor tag is taken to
+ * be version 0 or erased, and is migrated. The version 1 records
+ * overlap the old values, so the old values are first written as
+ * copy records in free EEPROM, then as the version 1 records, with
+ * the motor record last and its tag, which marks the migration
+ * done, as its last byte. A migration cut short by a power failure
+ * is done again at the next start from the first of these that is
+ * valid: the version 1 record, the copy, or the old addresses,
+ * which are not written until the copy is valid.
+ *
+ * Checking every record at start up reads 25 bytes, which takes
+ * well under a millisecond.
+ *
+ * Wear
+ *
+ * Each data EEPROM byte is rated for at least 100,000 erase/write
+ * cycles. Only bytes that change are written, but the CRC of a
+ * record changes with any of its data, so the CRC is the most worn
+ * byte of each record:
+ *
+ *      motor constants, tunables: written only when saved from the
+ *      IR menu or the serial link.
+ *
+ *      learned debounce: written when a learned bounce moves
+ *      SW_SAVE_DELTA ticks from the saved value, which happens as
+ *      the switches wear, not on each press. Even one write a day
+ *      is under 4000 writes in ten years.
+ *
+ *      The source, (mute), (record) and volume state change on
+ *      every use and are never written to data EEPROM. They are
+ *      kept across a reset in retained RAM, see Retain.
+ *
+ * Version 1 of the tunables record is read as version 2 with
+ * TUNE_HOLD_DUTY put back to its default, because the hold duty
+ * had no effect when it was saved and its old default would turn
+ * on the coil economiser untested.
+ *
+ * Writes at start up only happen after the EEPROM is erased, has
+ * an old layout or holds a record that is not valid.
+ *
+ * Saving
+ *
+ * Each byte written takes about 4 milliseconds, so writing a whole
+ * record at once would stop the main loop for up to 40 milliseconds
+ * and the IR edge queue would overflow. A record is only marked to
+ * be saved by EE_Save(). EE_Service() runs once each pass of the
+ * main loop and writes at most one byte of the marked records,
+ * returning at once while a write is in progress. A record is
+ * written from RAM as each byte is reached, with the CRC of the
+ * bytes as written, and a record marked again while it is written
+ * is written again after. The data and the CRC are written before
+ * the tag. A save not finished before a power failure leaves the
+ * old record, or one that is not valid. One cut short by a reset
+ * that keeps the constants in RAM is done again, see EE_Resume().
  */
-typedef enum {SW_none, SW_1, SW_2, SW_3, SW_4, SW_5, SW_6, SW_REC} SelectSwitch_t;
+#define EE_MOTOR_CONST (0x00)
+#define EE_DEBOUNCE (0x06)
+#define EE_TUNABLES (0x0F)
+#define EE_V0_MOTOR_CONST (0x00)
+#define EE_V0_DEBOUNCE (0x04)
+#define EE_COPY_MOTOR_CONST (0x19)
+#define EE_COPY_DEBOUNCE (0x1F)
+#define EE_TAG_MOTOR (0x41)
+#define EE_TAG_DEBOUNCE (0x51)
+#define EE_TAG_TUNABLES (0x62)
+#define EE_TAG_TUNABLES_V1 (0x61)
+
+#define EE_RECORD_COPY_DEBOUNCE (0)
+#define EE_RECORD_COPY_MOTOR (1)
+#define EE_RECORD_DEBOUNCE (2)
+#define EE_RECORD_TUNABLES (3)
+#define EE_RECORD_MOTOR (4)
+#define EE_RECORDS (5)
+#define EE_RECORD_NONE (0xFF)
+
+#define EE_BUSY() (EECON1bits.WR)
 
-SelectSwitch_t PollSwitches(void)
+__bit EE_Legacy;
+__persistent uint8_t EE_Pending;
+__persistent uint8_t EE_Current;
+uint8_t EE_Position;
+uint8_t EE_Crc;
+/*
+ * Function: EEPROM_Read
+ *
+ * Description:
+ * Return one byte from data EEPROM. Data EEPROM must not be read
+ * while a write is in progress, so this first waits for the write
+ * to finish. The main loop checks EE_BUSY() first where a wait
+ * would matter.
+ */
+uint8_t EEPROM_Read(uint8_t Address)
+{
+    while (EE_BUSY())
+    {
+        CLRWDT();
+    }
+    EEADR = Address;
+    EECON1bits.EEPGD = 0;
+    EECON1bits.RD = 1;
+    return EEDATA;
+}
+/*
+ * Function: EEPROM_Write
+ *
+ * Description:
+ * Start a write of one byte to data EEPROM.
+ *
+ * The byte is not written when it already holds the value, which
+ * saves wear. A write takes a few milliseconds to complete in the
+ * background. The read of the old value waits when the previous
+ * write has not yet finished, which EE_Service() never lets happen.
+ */
+void EEPROM_Write(uint8_t Address, uint8_t Data)
 {
-    SelectSwitch_t Result = SW_none;
+    if (EEPROM_Read(Address) == Data)
+    {
+        return;
+    }
+    EEADR = Address;
+    EEDATA = Data;
+    EECON1bits.EEPGD = 0;
+    EECON1bits.WREN = 1;
     
-    switch (SW_EN_PORT & SW_EN_MASK)
+    /* the unlock sequence must not be interrupted */
+    INTCONbits.GIE = 0;
+    while (INTCONbits.GIE)
     {
-        case 0:
-            Result = SW_1;      /* disc */
-            break;
-        case 1:
-            Result = SW_2;      /* video */
-            break;
-        case 2:
-            Result = SW_3;      /* cd */
-            break;
-        case 3:
-            Result = SW_4;      /* a.v. */
-            break;
-        case 4:
-            Result = SW_5;      /* tuner */
-            break;
-        case 5:
-            Result = SW_6;      /* tape */
-            break;
-        default:
-            break;
+        INTCONbits.GIE = 0;
     }
+    EECON2 = 0x55;
+    EECON2 = 0xAA;
+    EECON1bits.WR = 1;
+    INTCONbits.GIE = 1;
     
-    if(Result == SW_none)
+    EECON1bits.WREN = 0;
+}
+/*
+ * Function: CRC8
+ *
+ * Description:
+ * Add one byte to a CRC-8 with the polynomial x^8+x^2+x+1. The
+ * byte is done a nibble at a time from a 16 entry table in
+ * program memory.
+ */
+const uint8_t CRC8_Table[16] =
+{
+    0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15,
+    0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D,
+};
+
+uint8_t CRC8(uint8_t Crc, uint8_t Data)
+{
+    Crc ^= Data;
+    Crc = (uint8_t)(Crc << 4) ^ CRC8_Table[Crc >> 4];
+    Crc = (uint8_t)(Crc << 4) ^ CRC8_Table[Crc >> 4];
+    return Crc;
+}
+/*
+ * Function: EE_Init
+ *
+ * Description:
+ * Find the layout version of data EEPROM.
+ */
+void EE_Init(void)
+{
+    EE_Legacy = (EEPROM_Read(EE_MOTOR_CONST) != EE_TAG_MOTOR);
+}
+/*
+ * Function: EE_Resume
+ *
+ * Description:
+ * Called at start up before the constants are loaded, with Kept
+ * set after a reset that kept the constants in RAM. The records
+ * marked to be saved, and the one being written, are then marked
+ * again, so the save is finished and a byte torn by the reset is
+ * written again. Otherwise no record is marked.
+ */
+void EE_Resume(uint8_t Kept)
+{
+    if (Kept)
     {
-        if(SW_RECn() == SW_RECn_ASSERTED)
+        if (EE_Current < EE_RECORDS)
         {
-            Result = SW_REC;    /* record */
+            EE_Pending |= (uint8_t)(1 << EE_Current);
         }
+        EE_Pending &= (uint8_t)((1 << EE_RECORDS) - 1);
+    }
+    else
+    {
+        EE_Pending = 0;
     }
+    EE_Current = EE_RECORD_NONE;
+}
+/*
+ * Function: EE_RecordCheck
+ *
+ * Description:
+ * Return zero when the tag or the CRC of a record does not match.
+ */
+uint8_t EE_RecordCheck(uint8_t Address, uint8_t Tag, uint8_t Length)
+{
+    uint8_t Crc;
     
-    return Result;
+    if (EEPROM_Read(Address) != Tag)
+    {
+        return 0;
+    }
+    Crc = CRC8(0, Tag);
+    while (Length--)
+    {
+        Crc = CRC8(Crc, EEPROM_Read(++Address));
+    }
+    return (EEPROM_Read(++Address) == Crc);
 }
 /*
- * Main application
+ * Function: EE_RecordRead
+ *
+ * Description:
+ * Read the data of a record. Returns zero when the tag or the CRC
+ * does not match, and the data is then left as it was.
+ */
+uint8_t EE_RecordRead(uint8_t Address, uint8_t Tag, uint8_t *Data, uint8_t Length)
+{
+    if (!EE_RecordCheck(Address, Tag, Length))
+    {
+        return 0;
+    }
+    while (Length--)
+    {
+        *Data++ = EEPROM_Read(++Address);
+    }
+    return 1;
+}
+/*
+ * Function: EE_Save
+ *
+ * Description:
+ * Mark a record to be written by EE_Service().
+ */
+void EE_Save(uint8_t Record)
+{
+    EE_Pending |= (uint8_t)(1 << Record);
+}
+/*
+ * Function: Timebase_Init
+ *
+ * Description:
+ * Start TIMER1 free running from the instruction clock and
+ * TIMER2 with a 250 microsecond period, the sub-tick, then
+ * enable interrupts. The interrupt handler counts SUBTICKS
+ * sub-ticks to each 1 millisecond Tick.
+ */
+void Timebase_Init(void)
+{
+    TMR1_Overflow = 0;
+    SubTick = 0;
+    Tick = 0;
+
+    /* TIMER1: internal clock, 1:1 prescale, on */
+    T1CON = 0b00000001;
+
+    /* TIMER2: 1:1 prescale, 1:1 postscale, 250 counts, on */
+    PR2 = 250-1;
+    T2CON = 0b00000100;
+
+    PIR1bits.TMR1IF = 0;
+    PIR1bits.TMR2IF = 0;
+    PIE1bits.TMR1IE = 1;
+    PIE1bits.TMR2IE = 1;
+    INTCONbits.PEIE = 1;
+    INTCONbits.GIE = 1;
+}
+/*
+ * Function: Timebase_Now
+ *
+ * Description:
+ * Return the 24-bit microsecond timestamp.
+ *
+ * This can be called from the main loop or from the interrupt
+ * handler. The overflow count and TIMER1 are read until two
+ * passes agree, so a carry from TMR1L into TMR1H or an update
+ * of the overflow count by the interrupt handler between the
+ * reads cannot tear the result. When TIMER1 has rolled over but
+ * the interrupt has not yet been serviced the pending overflow
+ * is added here.
  */
-void main(void) 
+HOT_CODE uint24_t Timebase_Now(void)
 {
-    uint8_t LED_RecToggleCount;
-    SelectSwitch_t SW_Sample = SW_none;
-    SelectSwitch_t SW_Stable = SW_none;
-    uint8_t SW_Changed = 0;
-    uint8_t SW_BounceCount = 0;
+    uint8_t Overflow;
+    uint8_t High;
+    uint8_t Low;
+    uint8_t Pending;
+
+    do
+    {
+        Overflow = TMR1_Overflow;
+        High = TMR1H;
+        Low = TMR1L;
+        Pending = PIR1bits.TMR1IF;
+    } while ((High != TMR1H) || (Overflow != TMR1_Overflow));
+
+    if (Pending && (High < 0x80))
+    {
+        Overflow++;
+    }
+
+    return ((uint24_t)Overflow << 16) | ((uint16_t)High << 8) | Low;
+}
+/*
+ * Function: IR_Init
+ *
+ * Description:
+ * Set TIMER0 to count the next falling edge of the idle high
+ * receiver output on RA4/T0CKI and enable its interrupt.
+ */
+void IR_Init(void)
+{
+    IR_EdgeHead = 0;
+    IR_EdgeTail = 0;
     
     /*
-     * Initialize main application
+     * TIMER0: T0CKI input, falling edge, prescaler 1:16 to the WDT.
+     * The watchdog timeout is now about 288 milliseconds nominal,
+     * 112 at the least. The watchdog is cleared first, as the data
+     * sheet asks before the prescaler is changed, so the change
+     * cannot cause a reset.
      */
-    PIC_Init();
+    CLRWDT();
+    OPTION_REG = 0b11111100;
+    TMR0 = 0xFF;
+    INTCONbits.TMR0IF = 0;
+#if !(defined(DEBUG_CAPTURE) && defined(_16F870))
+    INTCONbits.TMR0IE = 1;
+#endif
+}
+/*
+ * Function: IR_GetEdge
+ *
+ * Description:
+ * Take the oldest edge from the infrared receiver edge queue.
+ * Returns zero when the queue is empty.
+ */
+HOT_CODE uint8_t IR_GetEdge(uint16_t *Edge)
+{
+    uint8_t Tail = IR_EdgeTail;
     
-    /* Set GPIO directions for S21 */
-    TRISB = 0b10000000;
-    TRISC = 0b01100000;
-    /*
-     * Application process loop
-     */
-    while(1)
+    if (Tail == IR_EdgeHead)
     {
-        /* sample switch inputs */
-        SW_Sample = PollSwitches();
-        /* did switch state change */
-        if(SW_Sample != SW_Stable)
-        {
-            SW_Stable = SW_Sample;
-            SW_BounceCount = 20;
-        }
-        /* has the switch been pressed for 20 milliseconds */
-        if(SW_BounceCount)
-        {
-            SW_BounceCount--;
-            if(SW_BounceCount == 0)
-            {
-                SW_Changed = 1;
-            }            
-        }
-        /* process a switch state change */
-        if(SW_Changed) 
-        {
-            switch (SW_Stable)
-            {
-                case SW_1:      /* disc */
-                    if(PORTB & (1<<0)) LED_MUTEn_TOGGLE();
-                    PORTB &= (1<<0)|(1<<6);
-                    PORTB |= (1<<0);
-                    break;
-                case SW_2:      /* video */
-                    if(PORTB & (1<<1)) LED_MUTEn_TOGGLE();
-                    PORTB &= (1<<1)|(1<<6);
-                    PORTB |= (1<<1);
-                    break;
-                case SW_3:      /* cd */
-                    if(PORTB & (1<<2)) LED_MUTEn_TOGGLE();
-                    PORTB &= (1<<2)|(1<<6);
-                    PORTB |= (1<<2);
+        return 0;
+    }
+    *Edge = IR_EdgeQueue[Tail];
+    IR_EdgeTail = (Tail + 1) & (IR_EDGE_QUEUE_SIZE - 1);
+    return 1;
+}
+/*
+ * Function: IR_Decode
+ *
+ * Description:
+ * Philips RC5 decoder. Called with each edge from the queue.
+ *
+ * RC5 sends 14 Manchester coded bits of 1778 microseconds each,
+ * two start bits, a toggle bit, 5 address bits and 6 command
+ * bits. A one is a space then a mark, a zero is a mark then a
+ * space. The receiver output is low during a mark.
+ *
+ * The decoder follows the middle of each bit from the length
+ * of every mark and space. A short interval is half a bit and
+ * a long interval is a whole bit, each within TUNE_RC5_TOLERANCE.
+ * Anything else abandons the frame, and when the interval ended
+ * with the start of a mark a new frame is started there. A frame
+ * with no edge for RC5_GAP_TICKS is dropped by IR_Dispatch().
+ *
+ * The automatic gain control of a demodulating receiver makes
+ * its marks longer with a strong signal and shorter with a weak
+ * one, and the spaces change by the same amount the other way.
+ * The first mark of a frame is half a bit, or a whole bit when
+ * the second start bit is a zero, so its error from that length
+ * is taken as the bias for the rest of the frame. The bias is
+ * taken off each mark and added to each space before it is
+ * measured, which keeps the short and long windows centred at
+ * any distance from the transmitter. Jitter on the first mark is
+ * carried into the bias, so the edge jitter the decoder accepts
+ * is about half the tolerance rather than all of it.
+ *
+ * A complete frame is left in IR_Frame with IR_FrameReady set.
+ */
+#define RC5_HALF_BIT (889)
+#define RC5_BIAS_MAX (300)
+#define RC5_TOLERANCE (111)     /* 444 microseconds */
+#define RC5_FRAME_BITS (14)
+#define RC5_GAP_TICKS (4)       /* longer than a whole bit, with a tick of decode delay */
+
+typedef enum {RC5_IDLE, RC5_START1, RC5_MID1, RC5_MID0, RC5_START0} RC5State_t;
+
+RC5State_t RC5_State;
+uint8_t RC5_BitCount;
+uint16_t RC5_Bits;
+uint16_t RC5_LastEdge;
+uint8_t RC5_GapDeadline;
+int16_t RC5_Bias;
+uint8_t RC5_LastOverrun;
+uint16_t IR_Frame;
+__bit IR_FrameReady;
+
+HOT_CODE void IR_Decode(uint16_t Edge)
+{
+    uint16_t Width;
+    uint16_t ShortMax;
+    uint8_t Long;
+    uint8_t Mark;
+    uint8_t Bit = 2;
+    
+    Width = US16_ELAPSED(Edge, RC5_LastEdge);
+    RC5_LastEdge = Edge;
+    RC5_GapDeadline = Tick + RC5_GAP_TICKS;
+    
+    if (RC5_LastOverrun != IR_EdgeOverrun)
+    {
+        RC5_LastOverrun = IR_EdgeOverrun;
+        RC5_State = RC5_IDLE;
+    }
+    
+    if (RC5_State != RC5_IDLE)
+    {
+        /* a rising edge ends a mark */
+        Mark = (Edge & 1);
+        ShortMax = RC5_HALF_BIT + ((uint16_t)Tune[TUNE_RC5_TOLERANCE] << 2);
+        
+        if ((RC5_BitCount == 1) && Mark)
+        {
+            /* the first mark sets the receiver bias for this frame */
+            RC5_Bias = (int16_t)Width - RC5_HALF_BIT;
+            if (Width > ShortMax)
+            {
+                RC5_Bias -= RC5_HALF_BIT;
+            }
+            if (RC5_Bias > RC5_BIAS_MAX)
+            {
+                RC5_Bias = RC5_BIAS_MAX;
+            }
+            else if (RC5_Bias < -RC5_BIAS_MAX)
+            {
+                RC5_Bias = -RC5_BIAS_MAX;
+            }
+        }
+        if (Mark)
+        {
+            Width -= RC5_Bias;
+        }
+        else
+        {
+            Width += RC5_Bias;
+        }
+        
+        if ((Width < (2 * RC5_HALF_BIT) - ShortMax) || (Width > ShortMax + RC5_HALF_BIT))
+        {
+            RC5_State = RC5_IDLE;
+        }
+        else
+        {
+            Long = (Width > ShortMax);
+            
+            switch (RC5_State)
+            {
+                case RC5_MID1:      /* a mark from the middle of a one */
+                    if (Mark && Long)
+                    {
+                        Bit = 0;
+                        RC5_State = RC5_MID0;
+                    }
+                    else if (Mark)
+                    {
+                        RC5_State = RC5_START1;
+                    }
+                    else
+                    {
+                        RC5_State = RC5_IDLE;
+                    }
                     break;
-                case SW_4:      /* a.v. */
-                    if(PORTB & (1<<3)) LED_MUTEn_TOGGLE();
-                    PORTB &= (1<<3)|(1<<6);
-                    PORTB |= (1<<3);
+                case RC5_MID0:      /* a space from the middle of a zero */
+                    if (!Mark && Long)
+                    {
+                        Bit = 1;
+                        RC5_State = RC5_MID1;
+                    }
+                    else if (!Mark)
+                    {
+                        RC5_State = RC5_START0;
+                    }
+                    else
+                    {
+                        RC5_State = RC5_IDLE;
+                    }
                     break;
-                case SW_5:      /* tuner */
-                    if(PORTB & (1<<4)) LED_MUTEn_TOGGLE();
-                    PORTB &= (1<<4)|(1<<6);
-                    PORTB |= (1<<4);
+                case RC5_START1:    /* the space at the start of a one */
+                    if (!Mark && !Long)
+                    {
+                        Bit = 1;
+                        RC5_State = RC5_MID1;
+                    }
+                    else
+                    {
+                        RC5_State = RC5_IDLE;
+                    }
                     break;
-                case SW_6:      /* tape */
-                    if(PORTBbits.RB6) /* if the record mode is active toggle between tape output and recode source as the input */
+                case RC5_START0:    /* the mark at the start of a zero */
+                    if (Mark && !Long)
                     {
-                        PORTB = (PORTB ^ (1<<5)) ^ (PORTC & 0b00011111); 
+                        Bit = 0;
+                        RC5_State = RC5_MID0;
                     }
-                    else /* else treat the tape selection like the other inputs */
+                    else
                     {
-                        if(PORTB & (1<<5)) LED_MUTEn_TOGGLE();
-                        PORTB &= (1<<5)|(1<<6);
-                        PORTB |= (1<<5);
+                        RC5_State = RC5_IDLE;
                     }
                     break;
                 default:
+                    RC5_State = RC5_IDLE;
                     break;
             }
-            if (SW_Stable == SW_REC)
+        }
+        
+        if (Bit <= 1)
+        {
+            RC5_Bits = (RC5_Bits << 1) | Bit;
+            if (++RC5_BitCount >= RC5_FRAME_BITS)
             {
-                LED_REC_TOGGLE();
+                IR_Frame = RC5_Bits;
+                IR_FrameReady = 1;
+                RC5_State = RC5_IDLE;
+                STAT_COUNT(IR_Frames);
+                return;
             }
-            
-            /* 
-             * On any switch press:
-             *  if the button pressed is (SW1 to SW5 or SW_REC) then 
-             *    if the record mode is on then
-             *      if the input selected is not (tape) then
-             *        select that input as the tape recorder input.
-             *    else
-             *      then turn off record mode.
-             */
-            if ((SW_Stable != SW_6) && (SW_Stable != SW_none))
-            {
-                if(PORTBbits.RB6)
-                {
-                    if ((PORTB & 0b00011111) != 0)
-                    {
-                        PORTC ^= ((PORTC ^ PORTB) & 0b00011111);
-                    }
-                }
-                else 
-                {
-                    PORTC &= 0b11100000;
-                }
+        }
+        if (RC5_State != RC5_IDLE)
+        {
+            return;
+        }
+    }
+    
+    /*
+     * The first mark starts in the middle of the first start bit.
+     * A falling edge that ends a bad interval is tried as one too,
+     * so a frame that follows a glitch closely is not lost.
+     */
+    if ((Edge & 1) == 0)
+    {
+        RC5_Bits = 1;
+        RC5_BitCount = 1;
+        RC5_State = RC5_MID1;
+        STAT_COUNT(IR_Starts);
+    }
+}
+/*
+ * Function: PollSwitches
+ * 
+ * Description:
+ * There are seven push button switches. When one of six is pressed 
+ * a code is asserted on bits 0-2 of PORTA. The seventh switch is 
+ * connected to bit 3 of PORTA.
+ * 
+ * Sample the hardware switches and return which one is pressed.
+ * 
+ * The logic of this implementation causes the "lower numbered" 
+ * switches to have a higher priority. This means that when more 
+ * than one switch is pressed a lower number switch assertion is
+ * returned. For example if SW_2 and SW_3 are both pressed then 
+ * SW_1 will be the state returned.
+ * 
+ * This is less than ideal but this is the way the hardware works.
+ * 
+ * This amplifier was designed 20 years ago in the U.K. so I expect 
+ * a few more of these "Richards" to float up.
+ */
+typedef enum {SW_none, SW_1, SW_2, SW_3, SW_4, SW_5, SW_6, SW_REC, SW_MUTE, SW_VOL_UP, SW_VOL_DOWN} SelectSwitch_t;
+
+const SelectSwitch_t SW_EN_Map[SW_EN_MASK+1] =
+{
+    SW_1,       /* disc */
+    SW_2,       /* video */
+    SW_3,       /* cd */
+    SW_4,       /* a.v. */
+    SW_5,       /* tuner */
+    SW_6,       /* tape */
+    SW_none,
+    SW_none,
+};
+
+HOT_CODE SelectSwitch_t PollSwitches(void)
+{
+    SelectSwitch_t Result;
+    
+    Result = SW_EN_Map[SW_EN_PORT & SW_EN_MASK];
+    
+    if(Result == SW_none)
+    {
+        if(SW_RECn() == SW_RECn_ASSERTED)
+        {
+            Result = SW_REC;    /* record */
+        }
+    }
+    
+    return Result;
+}
+/*
+ * Front panel state
+ *
+ * The amplifier state is held in RAM images of the PORTB and PORTC
+ * output latches:
+ *
+ *      PortB bits 0-5: amplifier source (disc) to (tape)
+ *      PortB bit 6:    (record) mode
+ *      PortC bits 0-4: tape recorder source (disc) to (tuner)
+ *      PortC bit 7:    MUTEn, 0 is (mute) on
+ *
+ * The front panel logic only changes these images and does not
+ * touch any special function register. This keeps it free of the
+ * PIC16 read-modify-write hazard on PORT registers and lets the
+ * same code be compiled on a host to check the state machine.
+ */
+typedef struct
+{
+    uint8_t PortB;
+    uint8_t PortC;
+} PanelState_t;
+/*
+ * Controller state
+ *
+ * Everything the main loop carries from one tick to the next is
+ * kept in this one structure. The only other state is the timebase
+ * owned by the interrupt handler, so a copy of this structure is a
+ * complete snapshot of the controller that can be saved and later
+ * restored as a unit.
+ */
+typedef enum {OUT_IDLE, OUT_MUTING, OUT_SETTLING} OutputState_t;
+typedef enum {MOTOR_STOP, MOTOR_UP, MOTOR_DOWN} MotorDrive_t;
+
+typedef struct
+{
+    PanelState_t Panel;
+    PanelState_t Out;
+    OutputState_t OutState;
+    uint8_t OutDeadline;
+    SelectSwitch_t SW_Stable;
+    SelectSwitch_t SW_Key;
+    SelectSwitch_t SW_Taken;
+    uint8_t SW_Pending;
+    uint8_t SW_Deadline;
+    uint8_t SW_Quiet;
+    uint8_t SW_BounceStart;
+    uint8_t SW_BounceLast;
+    MotorDrive_t MotorRequest;
+    MotorDrive_t MotorDrive;
+    uint8_t MotorDeadline;
+    uint8_t MotorFraction;
+    uint16_t Volume;
+    uint8_t HoldDeadline;
+    uint8_t LastTick;
+} Controller_t;
+
+Controller_t App;
+/*
+ * Retained state
+ *
+ * The C runtime start up clears RAM, so a reset from MCLRn would
+ * turn every source off and lose the volume position estimate.
+ * Retain holds the front panel state, the volume estimate and the
+ * switch state last taken in RAM that is not cleared, so a key held
+ * over a reset is not taken twice. The switch debounce learned, the motor
+ * constants and the tunables are kept in RAM that is not cleared
+ * as well, with one checksum for the three in Retain.ConstCheck.
+ * The checksum is worked out again at start up, and changed by the
+ * difference when one of them is changed later.
+ *
+ * At power on the PCON nPOR bit reads zero and RAM holds garbage,
+ * so the panel starts with all sources off and (mute) on and the
+ * constants are loaded from data EEPROM. After any other reset,
+ * from MCLRn, a watchdog timeout or a brown-out, nPOR still reads
+ * one. The ports are inputs during the reset so every relay drops
+ * out, which is the safe state. When the magic value and checksum
+ * match, the outputs are restored from Retain as soon as the
+ * timebase starts, staggered over the first few sub-ticks, and when
+ * the constants checksum matches too, Retain_Const, the constants
+ * are not read from data EEPROM again. The restored outputs go through the same (mute) and relay
+ * settle sequence as a source change, see Panel_Commit().
+ *
+ * Retain is updated once each tick. A reset part way through the
+ * update leaves a checksum that does not match and the start up
+ * is done as for power on.
+ */
+#define RETAIN_MAGIC (0xA5)
+
+typedef struct
+{
+    uint8_t Magic;
+    PanelState_t Panel;
+    uint16_t Volume;
+    uint8_t Switch;             /* the switch state last taken */
+    uint8_t Check;
+    uint8_t ConstCheck;
+} Retain_t;
+
+__persistent Retain_t Retain;
+__bit Retain_Warm;
+__bit Retain_Const;
+/*
+ * Function: Retain_Sum
+ *
+ * Description:
+ * Return the checksum of a block of retained RAM.
+ */
+uint8_t Retain_Sum(const uint8_t *Data, uint8_t Length)
+{
+    uint8_t Sum;
+    
+    Sum = RETAIN_MAGIC;
+    while (Length--)
+    {
+        Sum += *Data++;
+    }
+    return Sum;
+}
+/*
+ * Function: Retain_PanelSum
+ *
+ * Description:
+ * Return the checksum of the front panel state and the volume
+ * estimate in Retain.
+ */
+HOT_CODE uint8_t Retain_PanelSum(void)
+{
+    return RETAIN_MAGIC + Retain.Panel.PortB + Retain.Panel.PortC
+         + (uint8_t)Retain.Volume + (uint8_t)(Retain.Volume >> 8) + Retain.Switch;
+}
+/*
+ * Function: Retain_Save
+ *
+ * Description:
+ * Called once each tick to copy the front panel state, the volume
+ * estimate and the switch state last taken to Retain.
+ */
+HOT_CODE void Retain_Save(void)
+{
+    Retain.Magic = RETAIN_MAGIC;
+    Retain.Panel = App.Panel;
+    Retain.Volume = App.Volume;
+    Retain.Switch = App.SW_Taken;
+    Retain.Check = Retain_PanelSum();
+}
+/*
+ * Function: Retain_Restore
+ *
+ * Description:
+ * Called at start up before the timebase starts. After a reset
+ * other than power on with a valid Retain the front panel state,
+ * the output images and the volume estimate are restored. The
+ * outputs are restored with (mute) on and Panel_Commit() settling
+ * the relays, and Retain_Resume() sets the deadlines. A key that
+ * was taken before the reset and is still held is not taken again.
+ * Returns one when the state was restored.
+ */
+uint8_t Retain_Restore(void)
+{
+    Retain_Warm = 0;
+    if (!PCONbits.nPOR)
+    {
+        PCONbits.nPOR = 1;
+        PCONbits.nBOR = 1;
+        return 0;
+    }
+    PCONbits.nBOR = 1;
+    if ((Retain.Magic != RETAIN_MAGIC) || (Retain.Check != Retain_PanelSum()))
+    {
+        return 0;
+    }
+    App.Panel = Retain.Panel;
+    App.Out = Retain.Panel;
+    App.Out.PortC &= ~(1<<7);   /* (mute) on */
+    App.OutState = OUT_SETTLING;
+    Relay_HoldPending = 1;
+    App.Volume = Retain.Volume;
+    Drive_PortB = App.Out.PortB;
+    Drive_PortC = App.Out.PortC;
+    if ((Retain.Switch != SW_none) && (PollSwitches() == Retain.Switch))
+    {
+        App.SW_Stable = Retain.Switch;
+        App.SW_Key = Retain.Switch;
+        App.SW_Taken = Retain.Switch;
+    }
+    Retain_Warm = 1;
+    return 1;
+}
+/*
+ * Function: Retain_Resume
+ *
+ * Description:
+ * Called at start up after Tune_Init() and before the timebase
+ * starts. After Retain_Restore() the relays dropped out while the
+ * ports were inputs, so they pull in again once the tick count
+ * starts from zero. The settle time and the pull in time are
+ * counted from the end of the stagger.
+ */
+void Retain_Resume(void)
+{
+    if (Retain_Warm)
+    {
+        App.OutDeadline = INRUSH_TICKS + Tune[TUNE_RELAY_SETTLE];
+        App.HoldDeadline = INRUSH_TICKS + Tune[TUNE_RELAY_PULLIN];
+    }
+}
+/*
+ * Switch debounce learning
+ *
+ * The front panel switches are old and some bounce for much longer
+ * than others. Rather than make every switch wait as long as the
+ * worst one, the bounce of each switch is measured on every press
+ * and release and each switch gets its own debounce time.
+ *
+ * A bounce starts with the first change after the switch inputs
+ * have been quiet for SW_DEBOUNCE_MAX ticks and lasts until the
+ * last change before a state is accepted. A change that comes
+ * within SW_DEBOUNCE_MAX ticks of an accepted state is counted as
+ * part of the same bounce, so a debounce time that is too short
+ * shows up as a longer bounce and is corrected.
+ *
+ * SW_Learn[] holds, for each switch, the longest recent bounce in
+ * bits 0-4 and a count of shorter bounces in bits 5-7. A longer
+ * bounce is taken at once. After 8 shorter ones in a row the
+ * longest is reduced by one tick. The debounce time is the longest
+ * bounce plus TUNE_DEBOUNCE_MARGIN, kept between TUNE_DEBOUNCE_MIN
+ * and SW_DEBOUNCE_MAX. The learned values are kept in data EEPROM.
+ *
+ * A bounce that varies from press to press would move the learned
+ * value up and down by a tick and rewrite the record, and its CRC,
+ * on a large share of the presses. The record is only written when
+ * a learned bounce is SW_SAVE_DELTA or more from the value saved.
+ * The value in RAM still follows every bounce, and after power on
+ * a saved value up to one tick short is corrected at the first
+ * longer bounce.
+ */
+#define SW_DEBOUNCE_MIN (5)
+#define SW_DEBOUNCE_MAX (20)
+#define SW_DEBOUNCE_MARGIN (4)
+#define SW_LEARN_BOUNCE (0x1F)
+#define SW_LEARN_COUNT (0xE0)
+#define SW_LEARN_COUNT_ONE (0x20)
+#define SW_KEYS (SW_REC)
+#define SW_SAVE_DELTA (2)
+
+__persistent uint8_t SW_Learn[SW_KEYS];
+__bit SW_SaveCheck;
+/*
+ * Function: Switch_Init
+ *
+ * Description:
+ * Load the learned switch bounce from data EEPROM. A missing or
+ * out of range value starts at the longest debounce time. After a
+ * reset that kept a valid copy in RAM the copy is used.
+ */
+void Switch_Init(void)
+{
+    uint8_t Key;
+    uint8_t Save;
+    
+    if (Retain_Const)
+    {
+        return;
+    }
+    
+    Save = 0;
+    if (EE_Legacy)
+    {
+        if (!EE_RecordRead(EE_DEBOUNCE, EE_TAG_DEBOUNCE, SW_Learn, SW_KEYS) &&
+            !EE_RecordRead(EE_COPY_DEBOUNCE, EE_TAG_DEBOUNCE, SW_Learn, SW_KEYS))
+        {
+            for (Key = 0; Key < SW_KEYS; Key++)
+            {
+                SW_Learn[Key] = EEPROM_Read(EE_V0_DEBOUNCE + Key);
             }
-            SW_Changed = 0;
         }
-        /*
-         * This delay sets the minimum time
-         * for one iteration of the process loop
-         */
-        __delay_ms(1);
+        Save = 1;
+    }
+    else if (!EE_RecordRead(EE_DEBOUNCE, EE_TAG_DEBOUNCE, SW_Learn, SW_KEYS))
+    {
+        for (Key = 0; Key < SW_KEYS; Key++)
+        {
+            SW_Learn[Key] = SW_DEBOUNCE_MAX;
+        }
+        Save = 1;
+    }
+    
+    for (Key = 0; Key < SW_KEYS; Key++)
+    {
+        if (SW_Learn[Key] > SW_DEBOUNCE_MAX)
+        {
+            SW_Learn[Key] = SW_DEBOUNCE_MAX;
+            Save = 1;
+        }
+    }
+    
+    if (Save)
+    {
+        if (EE_Legacy)
+        {
+            EE_Save(EE_RECORD_COPY_DEBOUNCE);
+        }
+        EE_Save(EE_RECORD_DEBOUNCE);
+    }
+}
+/*
+ * Function: Switch_DebounceTicks
+ *
+ * Description:
+ * Return the debounce time for a switch.
+ */
+HOT_CODE uint8_t Switch_DebounceTicks(SelectSwitch_t Key)
+{
+    uint8_t Ticks;
+    
+    if (Key == SW_none)
+    {
+        return SW_DEBOUNCE_MAX;
+    }
+    Ticks = (SW_Learn[Key - 1] & SW_LEARN_BOUNCE) + Tune[TUNE_DEBOUNCE_MARGIN];
+    if (Ticks < Tune[TUNE_DEBOUNCE_MIN])
+    {
+        Ticks = Tune[TUNE_DEBOUNCE_MIN];
+    }
+    if (Ticks > SW_DEBOUNCE_MAX)
+    {
+        Ticks = SW_DEBOUNCE_MAX;
+    }
+    return Ticks;
+}
+/*
+ * Function: Switch_Learn
+ *
+ * Description:
+ * Update the longest bounce of a switch with a new measurement.
+ * When it changes Switch_SaveCheck() compares it with the saved
+ * value.
+ */
+void Switch_Learn(SelectSwitch_t Key, uint8_t Bounce)
+{
+    uint8_t Learn;
+    uint8_t Longest;
+    
+    if (Key == SW_none)
+    {
+        return;
+    }
+    if (Bounce > SW_DEBOUNCE_MAX)
+    {
+        Bounce = SW_DEBOUNCE_MAX;
+    }
+    Learn = SW_Learn[Key - 1];
+    Longest = Learn & SW_LEARN_BOUNCE;
+    
+    if (Bounce >= Longest)
+    {
+        Learn = Bounce;
+    }
+    else if ((Learn & SW_LEARN_COUNT) == SW_LEARN_COUNT)
+    {
+        Learn = Longest - 1;
+    }
+    else
+    {
+        Learn += SW_LEARN_COUNT_ONE;
+    }
+    Retain.ConstCheck += (uint8_t)(Learn - SW_Learn[Key - 1]);
+    SW_Learn[Key - 1] = Learn;
+    
+    if ((Learn & SW_LEARN_BOUNCE) != Longest)
+    {
+        SW_SaveCheck = 1;
+    }
+}
+/*
+ * Function: Switch_SaveCheck
+ *
+ * Description:
+ * Called on each tick. After a learned bounce changed, compare
+ * each with its saved value and save the record when one has
+ * moved SW_SAVE_DELTA ticks. Data EEPROM cannot be read while a
+ * write is in progress, so the comparison waits for the write to
+ * finish rather than the main loop.
+ */
+HOT_CODE void Switch_SaveCheck(void)
+{
+    uint8_t Key;
+    uint8_t Learn;
+    uint8_t Saved;
+    
+    if (!SW_SaveCheck || EE_BUSY())
+    {
+        return;
+    }
+    SW_SaveCheck = 0;
+    for (Key = 0; Key < SW_KEYS; Key++)
+    {
+        Learn = SW_Learn[Key] & SW_LEARN_BOUNCE;
+        Saved = EEPROM_Read(EE_DEBOUNCE + 1 + Key);
+        if ((Learn >= Saved + SW_SAVE_DELTA) || (Saved >= Learn + SW_SAVE_DELTA))
+        {
+            EE_Save(EE_RECORD_DEBOUNCE);
+        }
+    }
+}
+/*
+ * Function: Switch_Debounce
+ *
+ * Description:
+ * Called on each new tick with the present tick count. A switch
+ * state must stay unchanged for the debounce time of the switch
+ * before it is accepted. Returns the newly accepted switch state
+ * or SW_none when there is no change to process. A state accepted
+ * again after a break shorter than its debounce time, as when a
+ * worn contact opens for a moment while held, is not returned
+ * again.
+ *
+ * The debounce interval is kept as a deadline tick rather than a
+ * count that is decremented each tick, so the result does not
+ * depend on how many ticks pass between calls.
+ */
+HOT_CODE SelectSwitch_t Switch_Debounce(uint8_t Now)
+{
+    SelectSwitch_t SW_Sample;
+    
+    Switch_SaveCheck();
+    
+    /* sample switch inputs */
+    SW_Sample = PollSwitches();
+    /* did switch state change */
+    if(SW_Sample != App.SW_Stable)
+    {
+        if(App.SW_Quiet)
+        {
+            App.SW_Quiet = 0;
+            App.SW_BounceStart = Now;
+        }
+        else if(!App.SW_Pending)
+        {
+            STAT_COUNT(SW_Late);
+        }
+        App.SW_BounceLast = Now;
+        App.SW_Stable = SW_Sample;
+        if(SW_Sample != SW_none)
+        {
+            App.SW_Key = SW_Sample;
+        }
+        App.SW_Deadline = Now + Switch_DebounceTicks(App.SW_Key);
+        App.SW_Pending = 1;
+    }
+    /* has the switch been stable for its debounce time */
+    if(App.SW_Pending)
+    {
+        if(!TICK_BEFORE(Now, App.SW_Deadline))
+        {
+            App.SW_Pending = 0;
+            STAT_COUNT(SW_Events);
+            Switch_Learn(App.SW_Key, TICK_ELAPSED(App.SW_BounceLast, App.SW_BounceStart));
+            if(App.SW_Stable != App.SW_Taken)
+            {
+                App.SW_Taken = App.SW_Stable;
+                return App.SW_Stable;
+            }
+        }
+    }
+    else if(!App.SW_Quiet && (TICK_ELAPSED(Now, App.SW_BounceLast) >= SW_DEBOUNCE_MAX))
+    {
+        App.SW_Quiet = 1;
+    }
+    return SW_none;
+}
+#ifdef DEBUG_CAPTURE
+/*
+ * Switch capture
+ *
+ * Records the raw switch inputs RA0-RA3 so the bounce of real
+ * presses can be studied off line. The inputs are sampled each
+ * time round the wait for the next tick, every few tens of
+ * microseconds, and an entry is made when they change:
+ *
+ *      bits 12-15: RA3-RA0 after the change
+ *      bits 0-11:  microseconds since the previous entry, 4095
+ *                  when it is longer
+ *
+ * Capture stops when the buffer is full. It is read with the
+ * debugger and started again by clearing CaptureCount. The
+ * entries are replayed by tools/sim/bounce_bench.
+ *
+ * The PIC16F870 has no RAM for a buffer of its own. There the
+ * infrared receiver is left off and its edge queue holds the
+ * capture, 8 entries, with the time of the last in RC5_LastEdge.
+ */
+#define CAPTURE_IDLE (0x0F)     /* no switch pressed */
+
+#ifdef _16F870
+#define CAPTURE_SIZE (IR_EDGE_QUEUE_SIZE)
+#define Capture IR_EdgeQueue
+#define CaptureTime RC5_LastEdge
+#else
+#define CAPTURE_SIZE (16)
+
+uint16_t Capture[CAPTURE_SIZE];
+uint16_t CaptureTime;
+#endif
+uint8_t CaptureCount;
+/*
+ * Function: Capture_Sample
+ *
+ * Description:
+ * Sample the switch inputs and record a change.
+ */
+void Capture_Sample(void)
+{
+    uint8_t Sample;
+    uint8_t Last;
+    uint16_t Now;
+    uint16_t Delta;
+    
+    if (CaptureCount >= CAPTURE_SIZE)
+    {
+        return;
+    }
+    Last = CAPTURE_IDLE;
+    if (CaptureCount)
+    {
+        Last = (uint8_t)(Capture[CaptureCount - 1] >> 12);
+    }
+    Sample = PORTA & 0x0F;
+    if (Sample == Last)
+    {
+        return;
+    }
+    Now = (uint16_t)Timebase_Now();
+    Delta = US16_ELAPSED(Now, CaptureTime);
+    if ((Delta > 0x0FFF) || (CaptureCount == 0))
+    {
+        Delta = 0x0FFF;
+    }
+    Capture[CaptureCount++] = ((uint16_t)Sample << 12) | Delta;
+    CaptureTime = Now;
+}
+#endif
+/*
+ * Function: Panel_Process
+ *
+ * Description:
+ * Apply one debounced switch event, or the same event from the
+ * infrared remote, to the front panel state.
+ *
+ * The event is looked up in SW_SourceMask[] rather than tested
+ * case by case, so the time taken does not grow with the number
+ * of events.
+ *
+ * For every reachable state and every event these hold after
+ * the call:
+ *
+ *      At most one of PortB bits 0-5 is set.
+ *      At most one of PortC bits 0-4 is set.
+ *      When (record) mode is off PortC bits 0-4 are clear.
+ *      PortC bits 5 and 6, the volume motor drive, do not change.
+ */
+const uint8_t SW_SourceMask[SW_VOL_DOWN+1] =
+{
+    0,          /* SW_none */
+    (1<<0),     /* SW_1 disc */
+    (1<<1),     /* SW_2 video */
+    (1<<2),     /* SW_3 cd */
+    (1<<3),     /* SW_4 a.v. */
+    (1<<4),     /* SW_5 tuner */
+    (1<<5),     /* SW_6 tape */
+    0,          /* SW_REC */
+    0,          /* SW_MUTE */
+    0,          /* SW_VOL_UP */
+    0,          /* SW_VOL_DOWN */
+};
+
+HOT_CODE void Panel_Process(SelectSwitch_t Switch)
+{
+    uint8_t Source;
+    
+    if(Switch > SW_VOL_DOWN)
+    {
+        return;
+    }
+    Source = SW_SourceMask[Switch];
+    
+    if((Switch == SW_6) && (App.Panel.PortB & (1<<6)))
+    {
+        /* in record mode toggle the input between tape output and record source */
+        App.Panel.PortB = (App.Panel.PortB ^ (1<<5)) ^ (App.Panel.PortC & 0b00011111); 
+    }
+    else if(Source)
+    {
+        /* select the input, a second press toggles (mute) */
+        if(App.Panel.PortB & Source) LED_MUTEn_TOGGLE();
+        App.Panel.PortB &= Source|(1<<6);
+        App.Panel.PortB |= Source;
+    }
+    else if(Switch == SW_REC)
+    {
+        LED_REC_TOGGLE();
+    }
+    else if(Switch == SW_MUTE)
+    {
+        /* (mute) only toggles once an input is selected */
+        if(App.Panel.PortB & 0b00111111) LED_MUTEn_TOGGLE();
+    }
+    
+    /* 
+     * On any switch press:
+     *  if the button pressed is (SW1 to SW5 or SW_REC) then 
+     *    if the record mode is on then
+     *      if the input selected is not (tape) then
+     *        select that input as the tape recorder input.
+     *    else
+     *      then turn off record mode.
+     */
+    if ((Source & 0b00011111) || (Switch == SW_REC))
+    {
+        if(App.Panel.PortB & (1<<6))
+        {
+            if ((App.Panel.PortB & 0b00011111) != 0)
+            {
+                App.Panel.PortC ^= ((App.Panel.PortC ^ App.Panel.PortB) & 0b00011111);
+            }
+        }
+        else 
+        {
+            App.Panel.PortC &= 0b11100000;
+        }
+    }
+}
+/*
+ * Volume motor
+ *
+ * The volume control is a motorised Alps potentiometer with 300
+ * degrees of travel at about 12 degrees per second, so full travel
+ * takes about 25 seconds. There is no position feedback, so the
+ * position is estimated from how long the motor has been driven.
+ *
+ * App.Volume is the estimate in ticks of travel at the nominal
+ * speed. The minimum is at VOLUME_MIN and the maximum is at
+ * VOLUME_MAX, with VOLUME_OVERRUN of room beyond each end. The
+ * estimate uses these motor constants:
+ *
+ *      UpRate, DownRate: speed in sixteenths of the nominal
+ *      speed for each direction.
+ *
+ *      SpinUp: ticks after the drive starts before the shaft
+ *      moves.
+ *
+ *      Coast: ticks of travel at full speed that the shaft
+ *      coasts after the drive stops.
+ *
+ * The motor constants differ from one unit to the next. They are
+ * kept in a data EEPROM record so constants fitted from measurements
+ * of a unit can be programmed without building new firmware. A value
+ * outside its limits, or a record that is not valid, is replaced by
+ * the default.
+ *
+ * At power start the position is not known and is taken to be
+ * the middle of the travel. The drive is only stopped at an end
+ * once the estimate is VOLUME_OVERRUN past it, which lets the
+ * slip clutch hold the shaft at the end stop while the estimate
+ * catches up. When the drive stops the estimate is limited to
+ * the real travel, so after reaching an end stop it is exact.
+ *
+ * The (VOL+) and (VOL-) drive must never be on at the same time.
+ * The drive always stops for TUNE_MOTOR_DEAD, which is longer than
+ * the coast, before it starts again in either direction, and
+ * Output_Write() sets the two drive lines from the one drive state
+ * so they cannot both be on.
+ */
+#define MOTOR_A_MASK (1<<6)     /* VOL+ */
+#define MOTOR_B_MASK (1<<5)     /* VOL- */
+#define VOLUME_TRAVEL (25000u)
+#define VOLUME_OVERRUN (VOLUME_TRAVEL/10)
+#define VOLUME_MIN (VOLUME_OVERRUN)
+#define VOLUME_MAX (VOLUME_OVERRUN+VOLUME_TRAVEL)
+#define MOTOR_DEAD_TICKS (50)
+
+#define MOTOR_RATE_DEFAULT (16)
+#define MOTOR_RATE_MIN (8)
+#define MOTOR_RATE_MAX (32)
+#define MOTOR_SPINUP_DEFAULT (20)
+#define MOTOR_COAST_DEFAULT (30)
+#define MOTOR_DELAY_MAX (50)
+
+typedef struct
+{
+    uint8_t UpRate;
+    uint8_t DownRate;
+    uint8_t SpinUp;
+    uint8_t Coast;
+} MotorConst_t;
+
+__persistent MotorConst_t MotorConst;
+/*
+ * Function: Motor_Init
+ *
+ * Description:
+ * Load the motor constants from data EEPROM. When the record is
+ * missing or holds a value out of limits it is written again.
+ * After a reset that kept valid constants in RAM they are used,
+ * and the volume estimate is kept when Retain was restored.
+ */
+void Motor_Init(void)
+{
+    uint8_t Save;
+    
+    if (!Retain_Warm)
+    {
+        App.Volume = (VOLUME_MIN + VOLUME_MAX) / 2;
+    }
+    else if (Retain_Const)
+    {
+        return;
+    }
+    
+    Save = 0;
+    if (EE_Legacy)
+    {
+        if (!EE_RecordRead(EE_COPY_MOTOR_CONST, EE_TAG_MOTOR, (uint8_t *)&MotorConst, sizeof(MotorConst)))
+        {
+            MotorConst.UpRate = EEPROM_Read(EE_V0_MOTOR_CONST + 0);
+            MotorConst.DownRate = EEPROM_Read(EE_V0_MOTOR_CONST + 1);
+            MotorConst.SpinUp = EEPROM_Read(EE_V0_MOTOR_CONST + 2);
+            MotorConst.Coast = EEPROM_Read(EE_V0_MOTOR_CONST + 3);
+        }
+        Save = 1;
+    }
+    else if (!EE_RecordRead(EE_MOTOR_CONST, EE_TAG_MOTOR, (uint8_t *)&MotorConst, sizeof(MotorConst)))
+    {
+        MotorConst.UpRate = MOTOR_RATE_DEFAULT;
+        MotorConst.DownRate = MOTOR_RATE_DEFAULT;
+        MotorConst.SpinUp = MOTOR_SPINUP_DEFAULT;
+        MotorConst.Coast = MOTOR_COAST_DEFAULT;
+        Save = 1;
+    }
+    
+    if ((MotorConst.UpRate < MOTOR_RATE_MIN) || (MotorConst.UpRate > MOTOR_RATE_MAX))
+    {
+        MotorConst.UpRate = MOTOR_RATE_DEFAULT;
+        Save = 1;
+    }
+    if ((MotorConst.DownRate < MOTOR_RATE_MIN) || (MotorConst.DownRate > MOTOR_RATE_MAX))
+    {
+        MotorConst.DownRate = MOTOR_RATE_DEFAULT;
+        Save = 1;
+    }
+    if (MotorConst.SpinUp > MOTOR_DELAY_MAX)
+    {
+        MotorConst.SpinUp = MOTOR_SPINUP_DEFAULT;
+        Save = 1;
+    }
+    if (MotorConst.Coast > MOTOR_DELAY_MAX)
+    {
+        MotorConst.Coast = MOTOR_COAST_DEFAULT;
+        Save = 1;
+    }
+    
+    if (Save)
+    {
+        if (EE_Legacy)
+        {
+            EE_Save(EE_RECORD_COPY_MOTOR);
+        }
+        EE_Save(EE_RECORD_MOTOR);
+        EE_Legacy = 0;
+    }
+}
+/*
+ * Function: Motor_Request
+ *
+ * Description:
+ * Ask for the volume motor to be driven up, down or stopped.
+ */
+void Motor_Request(MotorDrive_t Drive)
+{
+    App.MotorRequest = Drive;
+}
+/*
+ * Function: Motor_Update
+ *
+ * Description:
+ * Called on each new tick with the present tick count and the
+ * number of ticks since the last call. Starts and stops the
+ * drive to follow the request and advances the position estimate.
+ */
+HOT_CODE void Motor_Update(uint8_t Now, uint8_t Elapsed)
+{
+    uint16_t Travel;
+    
+    if (App.MotorDrive != MOTOR_STOP)
+    {
+        /* the shaft is turning once the spin-up time is over */
+        if (!TICK_BEFORE(Now, App.MotorDeadline))
+        {
+            /* keep the deadline in range of the tick count */
+            App.MotorDeadline = Now;
+            if (App.MotorDrive == MOTOR_UP)
+            {
+                Travel = App.MotorFraction + (uint16_t)Elapsed * MotorConst.UpRate;
+            }
+            else
+            {
+                Travel = App.MotorFraction + (uint16_t)Elapsed * MotorConst.DownRate;
+            }
+            App.MotorFraction = Travel & 0x0F;
+            Travel >>= 4;
+            
+            if (App.MotorDrive == MOTOR_UP)
+            {
+                App.Volume += Travel;
+                if (App.Volume >= VOLUME_MAX + VOLUME_OVERRUN)
+                {
+                    App.MotorRequest = MOTOR_STOP;
+                }
+            }
+            else
+            {
+                if (App.Volume > Travel)
+                {
+                    App.Volume -= Travel;
+                }
+                else
+                {
+                    App.Volume = 0;
+                    App.MotorRequest = MOTOR_STOP;
+                }
+            }
+        }
+        
+        if (App.MotorRequest != App.MotorDrive)
+        {
+            /* stop, count the coast and wait out the dead time */
+            if (App.MotorDrive == MOTOR_UP)
+            {
+                App.Volume += MotorConst.Coast;
+            }
+            else if (App.Volume > MotorConst.Coast)
+            {
+                App.Volume -= MotorConst.Coast;
+            }
+            else
+            {
+                App.Volume = 0;
+            }
+            if (App.Volume > VOLUME_MAX)
+            {
+                App.Volume = VOLUME_MAX;
+            }
+            else if (App.Volume < VOLUME_MIN)
+            {
+                App.Volume = VOLUME_MIN;
+            }
+            App.MotorDrive = MOTOR_STOP;
+            App.MotorDeadline = Now + Tune[TUNE_MOTOR_DEAD];
+        }
+    }
+    else if (!TICK_BEFORE(Now, App.MotorDeadline))
+    {
+        /* the dead time is over, keep the deadline in range */
+        App.MotorDeadline = Now;
+        if (App.MotorRequest != MOTOR_STOP)
+        {
+            App.MotorDrive = App.MotorRequest;
+            App.MotorFraction = 0;
+            App.MotorDeadline = Now + MotorConst.SpinUp;
+        }
+    }
+}
+/*
+ * Function: EE_Service
+ *
+ * Description:
+ * Called once each pass of the main loop. Writes the next byte of
+ * a record marked by EE_Save(), or returns at once while a data
+ * EEPROM write is in progress. The records are written in the
+ * order of EE_Record[], which puts the copies made by a migration
+ * from layout version 0 first and the motor record last, and each
+ * record is written data first, then the CRC, then the tag. See
+ * Data EEPROM for why a migration needs that order.
+ *
+ * EE_Record[] is kept here, after the data it points to, rather
+ * than with the rest of the data EEPROM code.
+ */
+typedef struct
+{
+    uint8_t Address;
+    uint8_t Tag;
+    uint8_t *Data;
+    uint8_t Length;
+    uint8_t Mask;
+} EE_Record_t;
+
+const EE_Record_t EE_Record[EE_RECORDS] =
+{
+    {EE_COPY_DEBOUNCE,  EE_TAG_DEBOUNCE,    SW_Learn,                   SW_KEYS,            SW_LEARN_BOUNCE},
+    {EE_COPY_MOTOR_CONST, EE_TAG_MOTOR,     (uint8_t *)&MotorConst,     sizeof(MotorConst), 0xFF},
+    {EE_DEBOUNCE,       EE_TAG_DEBOUNCE,    SW_Learn,                   SW_KEYS,            SW_LEARN_BOUNCE},
+    {EE_TUNABLES,       EE_TAG_TUNABLES,    Tune,                       TUNE_COUNT,         0xFF},
+    {EE_MOTOR_CONST,    EE_TAG_MOTOR,       (uint8_t *)&MotorConst,     sizeof(MotorConst), 0xFF},
+};
+
+HOT_CODE void EE_Service(void)
+{
+    const EE_Record_t *Record;
+    uint8_t Byte;
+    
+    if (EE_BUSY())
+    {
+        return;
+    }
+    if (EE_Current == EE_RECORD_NONE)
+    {
+        if (!EE_Pending)
+        {
+            return;
+        }
+        for (EE_Current = 0; !(EE_Pending & (1 << EE_Current)); EE_Current++)
+        {
+        }
+        EE_Pending &= (uint8_t)~(1 << EE_Current);
+        EE_Position = 1;
+        EE_Crc = CRC8(0, EE_Record[EE_Current].Tag);
+    }
+    
+    Record = &EE_Record[EE_Current];
+    if (EE_Position <= Record->Length)
+    {
+        Byte = Record->Data[EE_Position - 1] & Record->Mask;
+        EE_Crc = CRC8(EE_Crc, Byte);
+    }
+    else if (EE_Position == Record->Length + 1)
+    {
+        Byte = EE_Crc;
+    }
+    else
+    {
+        Byte = Record->Tag;
+        EE_Position = 0;
+        EE_Current = EE_RECORD_NONE;
+    }
+    EEPROM_Write(Record->Address + EE_Position, Byte);
+    EE_Position++;
+}
+/*
+ * Tunables editing
+ *
+ * Each tunable has a default and safe limits in Tune_Limit[]. The
+ * four motor constants follow the tunables as ids TUNE_COUNT to
+ * TUNE_IDS - 1 so they can be changed the same way. A value out of
+ * its limits is refused.
+ *
+ * The tunables are kept in a data EEPROM record. As with the other
+ * constants, a record that is not valid or a value out of limits is
+ * replaced by the default, and Tune[] is kept in RAM that is not
+ * cleared so a warm restart need not read the record again.
+ *
+ * Changes are made in RAM and take effect on the next tick. They
+ * are only written to data EEPROM by Tune_Save().
+ */
+#define TUNE_MOTOR_CONST (TUNE_COUNT)
+#define TUNE_IDS (TUNE_COUNT + 4)
+
+typedef struct
+{
+    uint8_t Default;
+    uint8_t Min;
+    uint8_t Max;
+} TuneLimit_t;
+
+const TuneLimit_t Tune_Limit[TUNE_IDS] =
+{
+    {SW_DEBOUNCE_MIN,       1,                  SW_DEBOUNCE_MAX},   /* TUNE_DEBOUNCE_MIN */
+    {SW_DEBOUNCE_MARGIN,    0,                  10},                /* TUNE_DEBOUNCE_MARGIN */
+    {RC5_TOLERANCE,         50,                 RC5_TOLERANCE},     /* TUNE_RC5_TOLERANCE */
+    {RELAY_MUTE_TICKS,      1,                  50},                /* TUNE_RELAY_MUTE */
+    {RELAY_SETTLE_TICKS,    INRUSH_TICKS + 1,   100},               /* TUNE_RELAY_SETTLE */
+    {RELAY_PULLIN_TICKS,    5,                  100},               /* TUNE_RELAY_PULLIN */
+    {RELAY_HOLD_DUTY,       1,                  SUBTICKS},          /* TUNE_HOLD_DUTY */
+    {MOTOR_DEAD_TICKS,      MOTOR_DELAY_MAX,    120},               /* TUNE_MOTOR_DEAD */
+    {MOTOR_RATE_DEFAULT,    MOTOR_RATE_MIN,     MOTOR_RATE_MAX},    /* motor UpRate */
+    {MOTOR_RATE_DEFAULT,    MOTOR_RATE_MIN,     MOTOR_RATE_MAX},    /* motor DownRate */
+    {MOTOR_SPINUP_DEFAULT,  0,                  MOTOR_DELAY_MAX},   /* motor SpinUp */
+    {MOTOR_COAST_DEFAULT,   0,                  MOTOR_DELAY_MAX},   /* motor Coast */
+};
+
+#define TUNE_MENU_OFF (0xFF)
+#define TUNE_MENU_TICKS (100)       /* at most 127, see TICK_BEFORE() */
+#define TUNE_MENU_PERIODS (100)     /* 10 seconds without a key */
+
+#define TUNE_SHOW_GAP (3)           /* periods dark between groups */
+#define TUNE_SHOW_PAUSE (10)        /* periods dark before it repeats */
+
+uint8_t Tune_MenuId = TUNE_MENU_OFF;
+uint8_t Tune_MenuDeadline;
+uint8_t Tune_MenuPeriods;
+__bit Tune_Show;
+/*
+ * Function: Tune_Init
+ *
+ * Description:
+ * Load the tunables from data EEPROM.
+ */
+void Tune_Init(void)
+{
+    uint8_t Id;
+    uint8_t Valid;
+    uint8_t Save;
+    
+    if (Retain_Const)
+    {
+        return;
+    }
+    
+    Valid = EE_RecordRead(EE_TUNABLES, EE_TAG_TUNABLES, Tune, TUNE_COUNT);
+    Save = !Valid;
+    if (!Valid && EE_RecordRead(EE_TUNABLES, EE_TAG_TUNABLES_V1, Tune, TUNE_COUNT))
+    {
+        Tune[TUNE_HOLD_DUTY] = Tune_Limit[TUNE_HOLD_DUTY].Default;
+        Valid = 1;
+    }
+    for (Id = 0; Id < TUNE_COUNT; Id++)
+    {
+        if (!Valid || (Tune[Id] < Tune_Limit[Id].Min) || (Tune[Id] > Tune_Limit[Id].Max))
+        {
+            Tune[Id] = Tune_Limit[Id].Default;
+            Save = 1;
+        }
+    }
+    
+    if (Save)
+    {
+        EE_Save(EE_RECORD_TUNABLES);
+    }
+}
+/*
+ * Function: Tune_Ref
+ *
+ * Description:
+ * Return where the value of a tunable or motor constant is kept.
+ */
+uint8_t *Tune_Ref(uint8_t Id)
+{
+    if (Id < TUNE_COUNT)
+    {
+        return &Tune[Id];
+    }
+    return (uint8_t *)&MotorConst + (Id - TUNE_MOTOR_CONST);
+}
+/*
+ * Function: Tune_Set
+ *
+ * Description:
+ * Change a tunable or motor constant. Returns zero when the id or
+ * the value is out of limits and nothing was changed.
+ */
+uint8_t Tune_Set(uint8_t Id, uint8_t Value)
+{
+    if ((Id >= TUNE_IDS) || (Value < Tune_Limit[Id].Min) || (Value > Tune_Limit[Id].Max))
+    {
+        return 0;
+    }
+    Retain.ConstCheck += (uint8_t)(Value - *Tune_Ref(Id));
+    *Tune_Ref(Id) = Value;
+    return 1;
+}
+/*
+ * Function: Tune_Save
+ *
+ * Description:
+ * Save the tunables and the motor constants to data EEPROM.
+ * Bytes that did not change are not written.
+ */
+void Tune_Save(void)
+{
+    EE_Save(EE_RECORD_TUNABLES);
+    EE_Save(EE_RECORD_MOTOR);
+}
+/*
+ * Function: Tune_Revert
+ *
+ * Description:
+ * Put back the tunables and the motor constants saved in data
+ * EEPROM. A record that is not valid leaves its values as they
+ * are. Must not be called while a record is being saved.
+ */
+void Tune_Revert(void)
+{
+    uint8_t Id;
+    uint8_t Tunables;
+    uint8_t Motor;
+    
+    Tunables = EE_RecordCheck(EE_TUNABLES, EE_TAG_TUNABLES, TUNE_COUNT);
+    Motor = EE_RecordCheck(EE_MOTOR_CONST, EE_TAG_MOTOR, sizeof(MotorConst));
+    for (Id = 0; Id < TUNE_IDS; Id++)
+    {
+        if ((Id < TUNE_MOTOR_CONST) && Tunables)
+        {
+            Tune_Set(Id, EEPROM_Read(EE_TUNABLES + 1 + Id));
+        }
+        else if ((Id >= TUNE_MOTOR_CONST) && Motor)
+        {
+            Tune_Set(Id, EEPROM_Read(EE_MOTOR_CONST + 1 + (Id - TUNE_MOTOR_CONST)));
+        }
+    }
+}
+/*
+ * Function: Tune_ShowFlash
+ *
+ * Description:
+ * Return whether the (record) indicator is lit in a period of the
+ * tunables menu, counted in periods of TUNE_MENU_TICKS from the
+ * last key. The indicator is the only front panel light that does
+ * not also drive a relay.
+ *
+ * It flashes the id of the tunable plus one, then the value a
+ * decimal digit at a time, without leading zeros, then repeats
+ * after a pause. A flash is one period lit and one dark, and a
+ * digit of zero is one long flash, three periods lit. The groups
+ * are TUNE_SHOW_GAP periods apart. A value of 25 in tunable 1 is
+ * 2 flashes, 2 flashes, then 5 flashes.
+ */
+uint8_t Tune_ShowFlash(uint8_t Period)
+{
+    uint8_t Value;
+    uint8_t Place;
+    uint8_t Count;
+    uint8_t Length;
+    
+    for (;;)
+    {
+        Value = *Tune_Ref(Tune_MenuId);
+        Place = 100;
+        while ((Place > 1) && (Value < Place))
+        {
+            Place /= 10;
+        }
+        Count = Tune_MenuId + 1;
+        for (;;)
+        {
+            Length = Count ? (uint8_t)(Count * 2) : 4;
+            if (Period < Length)
+            {
+                return Count ? !(Period & 1) : (Period < 3);
+            }
+            Period -= Length;
+            if (Place == 0)
+            {
+                break;
+            }
+            if (Period < TUNE_SHOW_GAP)
+            {
+                return 0;
+            }
+            Period -= TUNE_SHOW_GAP;
+            for (Count = 0; Value >= Place; Count++)
+            {
+                Value -= Place;
+            }
+            Place /= 10;
+        }
+        if (Period < TUNE_SHOW_PAUSE)
+        {
+            return 0;
+        }
+        Period -= TUNE_SHOW_PAUSE;
+    }
+}
+/*
+ * Function: Tune_Menu
+ *
+ * Description:
+ * The tunables menu of the IR remote. The (menu) key opens the
+ * menu at the first tunable and steps to the next one on each
+ * press, closing it after the last. While it is open (volume) up
+ * and down step the value by one and (mute) saves the values to
+ * data EEPROM and closes the menu. A menu closed with the (menu)
+ * key keeps the changes until the next power on. Other keys are
+ * ignored while the menu is open.
+ *
+ * While the menu is open the (record) indicator shows the tunable,
+ * see Tune_ShowFlash(), and starts again from the beginning on each
+ * key. When no key is pressed for TUNE_MENU_PERIODS periods of
+ * TUNE_MENU_TICKS the menu is closed by Tune_MenuUpdate() and the
+ * changes are undone.
+ */
+void Tune_Menu(uint8_t Now, uint8_t MenuKey, SelectSwitch_t Event, uint8_t Repeat)
+{
+    uint8_t Value;
+    
+    Tune_MenuDeadline = Now + TUNE_MENU_TICKS;
+    Tune_MenuPeriods = TUNE_MENU_PERIODS;
+    if (MenuKey)
+    {
+        if (!Repeat)
+        {
+            Tune_MenuId++;
+            if (Tune_MenuId >= TUNE_IDS)
+            {
+                Tune_MenuId = TUNE_MENU_OFF;
+            }
+        }
+    }
+    else
+    {
+        Value = *Tune_Ref(Tune_MenuId);
+        if (Event == SW_VOL_UP)
+        {
+            Tune_Set(Tune_MenuId, Value + 1);
+        }
+        else if (Event == SW_VOL_DOWN)
+        {
+            Tune_Set(Tune_MenuId, Value - 1);
+        }
+        else if ((Event == SW_MUTE) && !Repeat)
+        {
+            Tune_Save();
+            Tune_MenuId = TUNE_MENU_OFF;
+        }
+    }
+    if (Tune_MenuId != TUNE_MENU_OFF)
+    {
+        Tune_Show = Tune_ShowFlash(0);
+    }
+}
+/*
+ * Function: Tune_MenuUpdate
+ *
+ * Description:
+ * Called on each new tick with the present tick count. Closes the
+ * tunables menu and undoes the changes when no key has been
+ * pressed for a while. This waits for a save of the records
+ * in progress to finish, to its last byte, so the values read
+ * back are whole and the reads do not wait for a write.
+ */
+HOT_CODE void Tune_MenuUpdate(uint8_t Now)
+{
+    if ((Tune_MenuId == TUNE_MENU_OFF) || TICK_BEFORE(Now, Tune_MenuDeadline))
+    {
+        return;
+    }
+    Tune_MenuDeadline = Now + TUNE_MENU_TICKS;
+    if (Tune_MenuPeriods)
+    {
+        Tune_MenuPeriods--;
+    }
+    Tune_Show = Tune_ShowFlash(TUNE_MENU_PERIODS - Tune_MenuPeriods);
+    if (Tune_MenuPeriods || EE_Pending || (EE_Current != EE_RECORD_NONE) || EE_BUSY())
+    {
+        return;
+    }
+    Tune_Revert();
+    Tune_MenuId = TUNE_MENU_OFF;
+}
+/*
+ * Infrared remote commands
+ *
+ * RC5 frames for system RC5_SYSTEM, the Philips audio amplifier
+ * address, are looked up in IR_Map[] and acted on like the front
+ * panel buttons:
+ *
+ *      1-6:    select (disc) (video) (cd) (a.v.) (tuner) (tape)
+ *      7:      (record)
+ *      13:     (mute)
+ *      15:     (menu), the tunables menu, see Tune_Menu()
+ *      16, 17: (volume) up and down
+ *
+ * The lookup takes the same time however many commands are mapped.
+ *
+ * A remote repeats the frame about every 114 milliseconds while a
+ * key is held, with the toggle bit unchanged, and flips the toggle
+ * bit for each new press. So a frame equal to the last one, toggle
+ * bit and all, while the key is held is a repeat, and the same key
+ * pressed again is not. A repeated frame is ignored except for the
+ * volume keys, which keep the motor running while the key is held.
+ *
+ * A key is held until no frame has been seen for IR_HOLD_TICKS,
+ * a little over one repeat. A repeat lost to noise is allowed for
+ * IR_HOLD_MISSES times in a row, each adding IR_HOLD_TICKS, so a
+ * held volume key does not stop and start the motor. The motor
+ * then runs on for up to that much longer after the key is let go.
+ * IR_Held counts down the periods left until the key is let go.
+ */
+#define RC5_SYSTEM (16)
+#define RC5_FIELD (0x1000)
+#define IR_COMMANDS (18)
+#define IR_HOLD_TICKS (125)     /* at most 127, see TICK_BEFORE() */
+#define IR_HOLD_MISSES (1)
+#define IR_MENU (15)
+
+const SelectSwitch_t IR_Map[IR_COMMANDS] =
+{
+    SW_none,        /* 0 */
+    SW_1,           /* 1 disc */
+    SW_2,           /* 2 video */
+    SW_3,           /* 3 cd */
+    SW_4,           /* 4 a.v. */
+    SW_5,           /* 5 tuner */
+    SW_6,           /* 6 tape */
+    SW_REC,         /* 7 record */
+    SW_none,        /* 8 */
+    SW_none,        /* 9 */
+    SW_none,        /* 10 */
+    SW_none,        /* 11 */
+    SW_none,        /* 12 */
+    SW_MUTE,        /* 13 mute */
+    SW_none,        /* 14 */
+    SW_none,        /* 15 menu */
+    SW_VOL_UP,      /* 16 volume up */
+    SW_VOL_DOWN,    /* 17 volume down */
+};
+
+uint16_t IR_LastFrame;
+uint8_t IR_Held;
+uint8_t IR_HoldDeadline;
+/*
+ * Function: IR_Dispatch
+ *
+ * Description:
+ * Called on each new tick with the present tick count. Acts on a
+ * newly decoded infrared frame and ends a held key. A partly
+ * decoded frame is dropped when its edges stop, so it cannot be
+ * finished by edges that come long after.
+ */
+HOT_CODE void IR_Dispatch(uint8_t Now)
+{
+    SelectSwitch_t Event = SW_none;
+    uint8_t Command;
+    uint8_t MenuKey = 0;
+    uint8_t Repeat;
+    
+    if ((RC5_State != RC5_IDLE) && !TICK_BEFORE(Now, RC5_GapDeadline))
+    {
+        RC5_State = RC5_IDLE;
+    }
+    if (IR_FrameReady)
+    {
+        IR_FrameReady = 0;
+        Command = IR_Frame & 0x3F;
+        if ((((IR_Frame >> 6) & 0x1F) == RC5_SYSTEM) && (IR_Frame & RC5_FIELD) && (Command < IR_COMMANDS))
+        {
+            Event = IR_Map[Command];
+            MenuKey = (Command == IR_MENU);
+        }
+        Repeat = IR_Held && (IR_Frame == IR_LastFrame);
+        IR_LastFrame = IR_Frame;
+        IR_Held = IR_HOLD_MISSES + 1;
+        IR_HoldDeadline = Now + IR_HOLD_TICKS;
+        
+        if (MenuKey || (Tune_MenuId != TUNE_MENU_OFF))
+        {
+            Motor_Request(MOTOR_STOP);
+            Tune_Menu(Now, MenuKey, Event, Repeat);
+        }
+        else if (Event == SW_VOL_UP)
+        {
+            Motor_Request(MOTOR_UP);
+        }
+        else if (Event == SW_VOL_DOWN)
+        {
+            Motor_Request(MOTOR_DOWN);
+        }
+        else
+        {
+            Motor_Request(MOTOR_STOP);
+            if (!Repeat)
+            {
+                Panel_Process(Event);
+            }
+        }
+    }
+    else if (IR_Held && !TICK_BEFORE(Now, IR_HoldDeadline))
+    {
+        if (--IR_Held)
+        {
+            IR_HoldDeadline = Now + IR_HOLD_TICKS;
+        }
+        else
+        {
+            Motor_Request(MOTOR_STOP);
+        }
+    }
+}
+#ifdef DEBUG_SERIAL
+/*
+ * Serial tunables link
+ *
+ * A half duplex serial link on DEBUG_IO to read and write the
+ * tunables and motor constants from a PC. The PC transmit line
+ * drives DEBUG_IO through a 1K resistor and the PC receive line
+ * reads it, so the PC sees its own bytes echoed before each reply.
+ * DEBUG_IO is an input except while a reply is sent.
+ *
+ * The link runs at 250 baud, 8 data bits, no parity and one stop
+ * bit, so a bit is SERIAL_BIT_TICKS ticks and the main loop can
+ * sample and drive it on each tick. A start bit is seen up to one
+ * tick late so bits are sampled one tick before their middle.
+ *
+ * Commands are binary bytes:
+ *
+ *      'R' id          reply id and value
+ *      'W' id value    change the value when it is in limits,
+ *                      reply id and the value now in use
+ *      'S'             save to data EEPROM, reply 'S'
+ *      'C'             reply the four statistics counts and
+ *                      clear them
+ *
+ * Any other command byte replies '?'. A command not complete
+ * within SERIAL_TIMEOUT_TICKS of its last byte is dropped. The
+ * 'S' reply does not wait for the save, which EE_Service() does
+ * over the next few tens of milliseconds.
+ */
+#define SERIAL_BIT_TICKS (4)
+#define SERIAL_TIMEOUT_TICKS (100)
+
+typedef enum {SERIAL_IDLE, SERIAL_RX, SERIAL_TX} SerialState_t;
+
+SerialState_t Serial_State;
+uint8_t Serial_Deadline;
+uint8_t Serial_Timeout;
+uint8_t Serial_Bit;
+uint8_t Serial_Shift;
+uint8_t Serial_Count;
+uint8_t Serial_Length;
+uint8_t Serial_Buffer[sizeof(Stats_t)];
+/*
+ * Function: Serial_Init
+ *
+ * Description:
+ * Set DEBUG_IO as an input that drives high when made an output.
+ */
+void Serial_Init(void)
+{
+    DEBUG_IO = 1;
+    DEBUG_IO_TRIS = 1;
+}
+/*
+ * Function: Serial_Command
+ *
+ * Description:
+ * Called with each byte received. When the command in the buffer
+ * is complete it is carried out and the reply is left in the
+ * buffer. Returns the length of the reply, or zero while the
+ * command is not complete.
+ */
+uint8_t Serial_Command(void)
+{
+    uint8_t Id = Serial_Buffer[1];
+    
+    switch (Serial_Buffer[0])
+    {
+        case 'R':
+            if (Serial_Count < 2)
+            {
+                return 0;
+            }
+            break;
+        case 'W':
+            if (Serial_Count < 3)
+            {
+                return 0;
+            }
+            Tune_Set(Id, Serial_Buffer[2]);
+            break;
+        case 'S':
+            Tune_Save();
+            return 1;
+        case 'C':
+            Serial_Buffer[0] = Stats.IR_Starts;
+            Serial_Buffer[1] = Stats.IR_Frames;
+            Serial_Buffer[2] = Stats.SW_Events;
+            Serial_Buffer[3] = Stats.SW_Late;
+            Stats.IR_Starts = 0;
+            Stats.IR_Frames = 0;
+            Stats.SW_Events = 0;
+            Stats.SW_Late = 0;
+            return sizeof(Stats_t);
+        default:
+            Serial_Buffer[0] = '?';
+            return 1;
+    }
+    
+    if (Id >= TUNE_IDS)
+    {
+        Serial_Buffer[0] = '?';
+        return 1;
+    }
+    Serial_Buffer[0] = Id;
+    Serial_Buffer[1] = *Tune_Ref(Id);
+    return 2;
+}
+/*
+ * Function: Serial_Update
+ *
+ * Description:
+ * Called on each new tick with the present tick count. Receives
+ * and sends one bit when its time has come.
+ */
+HOT_CODE void Serial_Update(uint8_t Now)
+{
+    switch (Serial_State)
+    {
+        case SERIAL_IDLE:
+            if (Serial_Count && !TICK_BEFORE(Now, Serial_Timeout))
+            {
+                Serial_Count = 0;
+            }
+            if (DEBUG_IO == 0)
+            {
+                Serial_Bit = 0;
+                Serial_Deadline = Now + SERIAL_BIT_TICKS + (SERIAL_BIT_TICKS / 2) - 1;
+                Serial_State = SERIAL_RX;
+            }
+            break;
+        case SERIAL_RX:
+            if (TICK_BEFORE(Now, Serial_Deadline))
+            {
+                break;
+            }
+            Serial_Deadline += SERIAL_BIT_TICKS;
+            if (Serial_Bit < 8)
+            {
+                Serial_Shift >>= 1;
+                if (DEBUG_IO)
+                {
+                    Serial_Shift |= 0x80;
+                }
+                Serial_Bit++;
+                break;
+            }
+            
+            /* the stop bit */
+            Serial_State = SERIAL_IDLE;
+            if (DEBUG_IO == 0)
+            {
+                Serial_Count = 0;
+                break;
+            }
+            Serial_Buffer[Serial_Count++] = Serial_Shift;
+            Serial_Timeout = Now + SERIAL_TIMEOUT_TICKS;
+            Serial_Length = Serial_Command();
+            if (Serial_Length)
+            {
+                Serial_Count = 0;
+                Serial_Bit = 0;
+                Serial_Deadline = Now + SERIAL_BIT_TICKS;
+                Serial_State = SERIAL_TX;
+            }
+            break;
+        case SERIAL_TX:
+            if (TICK_BEFORE(Now, Serial_Deadline))
+            {
+                break;
+            }
+            Serial_Deadline += SERIAL_BIT_TICKS;
+            if (Serial_Bit == 10)
+            {
+                Serial_Bit = 0;
+                if (++Serial_Count == Serial_Length)
+                {
+                    DEBUG_IO_TRIS = 1;
+                    Serial_Count = 0;
+                    Serial_State = SERIAL_IDLE;
+                    break;
+                }
+            }
+            if (Serial_Bit == 0)
+            {
+                Serial_Shift = Serial_Buffer[Serial_Count];
+                DEBUG_IO = 0;
+                DEBUG_IO_TRIS = 0;
+            }
+            else if (Serial_Bit < 9)
+            {
+                DEBUG_IO = Serial_Shift & 1;
+                Serial_Shift >>= 1;
+            }
+            else
+            {
+                DEBUG_IO = 1;
+            }
+            Serial_Bit++;
+            break;
+        default:
+            Serial_State = SERIAL_IDLE;
+            break;
+    }
+}
+#endif
+#ifdef DEBUG_TRACE
+/*
+ * Output trace
+ *
+ * A circular journal of the last TRACE_SIZE changes written to the
+ * output ports. Each entry holds the tick of the write, the port
+ * ('B' or 'C') and the exclusive-or of the old and new values.
+ *
+ * An entry is only made when an output changes so the journal
+ * covers changes, not time. Starting from the present port values
+ * and applying the deltas newest first steps the outputs backward
+ * one write at a time, and the first entry found with a given bit
+ * set in its delta is the last write of that pin.
+ *
+ * The journal is read with the debugger after a halt. TraceHead
+ * is the index of the next entry to be written. It needs the RAM of
+ * a PIC16F876A; tools/sim/journal.h keeps a longer journal of all of
+ * the state on the host.
+ */
+#define TRACE_SIZE (8)      /* must be a power of 2 */
+
+typedef struct
+{
+    uint8_t Tick;
+    uint8_t Port;
+    uint8_t Delta;
+} TraceEntry_t;
+
+TraceEntry_t Trace[TRACE_SIZE];
+uint8_t TraceHead;
+uint8_t TracePortB;
+uint8_t TracePortC;
+/*
+ * Function: Trace_Write
+ *
+ * Description:
+ * Add an entry to the output trace when the delta is not zero.
+ */
+void Trace_Write(uint8_t Port, uint8_t Delta)
+{
+    TraceEntry_t *Entry;
+    
+    if(Delta == 0)
+    {
+        return;
+    }
+    Entry = &Trace[TraceHead];
+    Entry->Tick = Tick;
+    Entry->Port = Port;
+    Entry->Delta = Delta;
+    TraceHead = (TraceHead + 1) & (TRACE_SIZE - 1);
+}
+#endif
+/*
+ * Function: Output_Write
+ *
+ * Description:
+ * Copy the output state and the volume motor drive to the
+ * port images written by the interrupt handler, and start the
+ * relay coil hold PWM once the relays have pulled in.
+ *
+ * While the tunables menu is open the (record) indicator on RB6
+ * shows the tunable, see Tune_ShowFlash(), in place of the
+ * (record) state.
+ */
+#define SOURCE_MASK (0b00111111)
+#define MUTEn_MASK (1<<7)
+#define TUNE_SHOW_MASK (1<<6)
+
+HOT_CODE void Output_Write(uint8_t Now)
+{
+    uint8_t PortB;
+    uint8_t PortC;
+    
+    App.Out.PortC &= ~(MOTOR_A_MASK | MOTOR_B_MASK);
+    if (App.MotorDrive == MOTOR_UP)
+    {
+        App.Out.PortC |= MOTOR_A_MASK;
+    }
+    else if (App.MotorDrive == MOTOR_DOWN)
+    {
+        App.Out.PortC |= MOTOR_B_MASK;
+    }
+    
+    PortB = App.Out.PortB;
+    PortC = App.Out.PortC;
+    if (Tune_MenuId != TUNE_MENU_OFF)
+    {
+        PortB &= ~TUNE_SHOW_MASK;
+        if (Tune_Show)
+        {
+            PortB |= TUNE_SHOW_MASK;
+        }
+    }
+    
+#ifdef DEBUG_TRACE
+    Trace_Write('B', TracePortB ^ PortB);
+    Trace_Write('C', TracePortC ^ PortC);
+    TracePortB = PortB;
+    TracePortC = PortC;
+#endif
+    if ((PortB & ~Drive_PortB & RELAY_B_MASK)
+            || (PortC & ~Drive_PortC & RELAY_C_MASK))
+    {
+        Relay_Hold = 0;
+        App.HoldDeadline = Now + INRUSH_TICKS + Tune[TUNE_RELAY_PULLIN];
+        Relay_HoldPending = 1;
+    }
+    else if (Relay_HoldPending && !TICK_BEFORE(Now, App.HoldDeadline))
+    {
+        Relay_Hold = 1;
+        Relay_HoldPending = 0;
+    }
+    Drive_PortB = PortB;
+    Drive_PortC = PortC;
+}
+/*
+ * Function: Panel_Commit
+ *
+ * Description:
+ * Called on each new tick to move the outputs to the front
+ * panel state.
+ *
+ * The source select reed relays take time to pull in and their
+ * contacts bounce before they settle. Switching the amplifier
+ * source while (mute) is off would pass the bounce through as a
+ * thump, so a source change is sequenced:
+ *
+ *      (mute) is turned on and the mute relay is given
+ *      TUNE_RELAY_MUTE ticks to operate.
+ *
+ *      The source relays are switched and given
+ *      TUNE_RELAY_SETTLE ticks to pull in and stop bouncing.
+ *
+ *      (mute) is restored from the front panel state.
+ *
+ * When (mute) is already on, or only the (record) indicators or 
+ * the tape recorder source change, the outputs are written at once.
+ * A further source change while the relays settle restarts the
+ * settling time with (mute) still on.
+ */
+HOT_CODE void Panel_Commit(uint8_t Now)
+{
+    uint8_t SourceChange;
+    
+    SourceChange = (App.Panel.PortB ^ App.Out.PortB) & SOURCE_MASK;
+    
+    switch (App.OutState)
+    {
+        case OUT_IDLE:
+            if (SourceChange && (App.Out.PortC & MUTEn_MASK))
+            {
+                App.Out.PortC &= ~MUTEn_MASK;
+                App.OutDeadline = Now + Tune[TUNE_RELAY_MUTE];
+                App.OutState = OUT_MUTING;
+            }
+            else
+            {
+                App.Out = App.Panel;
+            }
+            break;
+        case OUT_MUTING:
+            if (!TICK_BEFORE(Now, App.OutDeadline))
+            {
+                App.Out.PortB = App.Panel.PortB;
+                App.Out.PortC = App.Panel.PortC & ~MUTEn_MASK;
+                App.OutDeadline = Now + Tune[TUNE_RELAY_SETTLE];
+                App.OutState = OUT_SETTLING;
+            }
+            break;
+        case OUT_SETTLING:
+            if (SourceChange)
+            {
+                App.Out.PortB = App.Panel.PortB;
+                App.Out.PortC = App.Panel.PortC & ~MUTEn_MASK;
+                App.OutDeadline = Now + Tune[TUNE_RELAY_SETTLE];
+            }
+            else if (!TICK_BEFORE(Now, App.OutDeadline))
+            {
+                App.Out = App.Panel;
+                App.OutState = OUT_IDLE;
+            }
+            break;
+        default:
+            App.OutState = OUT_IDLE;
+            break;
+    }
+    Output_Write(Now);
+}
+/*
+ * Function: Retain_ConstSum
+ *
+ * Description:
+ * Return the checksum of the switch debounce learned, the motor
+ * constants and the tunables, kept in Retain.ConstCheck.
+ */
+uint8_t Retain_ConstSum(void)
+{
+    return Retain_Sum(SW_Learn, SW_KEYS)
+         + Retain_Sum((uint8_t *)&MotorConst, sizeof(MotorConst))
+         + Retain_Sum(Tune, TUNE_COUNT);
+}
+/*
+ * Function: App_Init
+ *
+ * Description:
+ * Set up the controller after a reset, up to the application loop.
+ */
+void App_Init(void)
+{
+    PIC_Init();
+    Retain_Restore();
+    Retain_Const = Retain_Warm && (Retain.ConstCheck == Retain_ConstSum());
+    
+    /* Set GPIO directions for S21 */
+    TRISB = 0b10000000;
+    TRISC = 0b00000000;
+    
+    EE_Resume(Retain_Const);
+    EE_Init();
+    Switch_Init();
+    Motor_Init();
+    Tune_Init();
+    Retain.ConstCheck = Retain_ConstSum();
+    Retain_Resume();
+    
+#ifdef DEBUG_TIMING
+    DEBUG_IO = 0;
+    DEBUG_IO_TRIS = 0;
+#endif
+#ifdef DEBUG_SERIAL
+    Serial_Init();
+#endif
+    Timebase_Init();
+    IR_Init();
+    App.LastTick = Tick;
+}
+/*
+ * Function: App_Pass
+ *
+ * Description:
+ * One pass of the application loop, called when the tick count has
+ * moved on from App.LastTick. All timing in the loop is done with
+ * deadlines so when a pass takes longer than one tick the next pass
+ * catches up at once.
+ *
+ * The watchdog is cleared once each pass, and not while waiting, so
+ * the controller is reset if the tick stops. The timeout is about
+ * 288 milliseconds nominal, and at least 112, with the 1:16
+ * prescaler. Data EEPROM writes are done a byte a pass by
+ * EE_Service() and do not stall the loop.
+ *
+ * The host simulator in tools/sim runs the firmware through
+ * App_Init() and App_Pass(), so this is the loop it checks.
+ */
+HOT_CODE void App_Pass(void)
+{
+    SelectSwitch_t SW_Event;
+    uint8_t Elapsed;
+    uint16_t IR_Edge;
+    
+    Elapsed = TICK_ELAPSED(Tick, App.LastTick);
+    App.LastTick += Elapsed;
+    CLRWDT();
+#ifdef DEBUG_TIMING
+    DEBUG_IO = 1;
+#endif
+    
+    /* decode infrared receiver edges */
+    while (IR_GetEdge(&IR_Edge))
+    {
+        IR_Decode(IR_Edge);
+    }
+    IR_Dispatch(App.LastTick);
+    Tune_MenuUpdate(App.LastTick);
+    
+    /* process a switch state change */
+    SW_Event = Switch_Debounce(App.LastTick);
+    if(SW_Event != SW_none)
+    {
+        Panel_Process(SW_Event);
+    }
+    Motor_Update(App.LastTick, Elapsed);
+    Panel_Commit(App.LastTick);
+    Retain_Save();
+    EE_Service();
+#ifdef DEBUG_SERIAL
+    Serial_Update(App.LastTick);
+#endif
+#ifdef DEBUG_TIMING
+    DEBUG_IO = 0;
+#endif
+}
+/*
+ * Main application
+ */
+HOT_CODE void main(void) 
+{
+    App_Init();
+    /*
+     * Application process loop, one pass for each 1 millisecond tick
+     */
+    while(1)
+    {
+        while (Tick == App.LastTick)
+        {
+#ifdef DEBUG_CAPTURE
+            Capture_Sample();
+#endif
+        }
+        App_Pass();
     }
 }
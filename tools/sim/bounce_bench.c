@@ -0,0 +1,799 @@
+/*
+ * File:   bounce_bench.c
+ *
+ * Description:
+ *      Replays captures of the front panel switch inputs RA0-RA3
+ *      through PollSwitches() and a set of debouncers, the firmware's
+ *      own Switch_Debounce() among them, and reports for each the
+ *      accept latency, the false triggers, the missed presses and the
+ *      host time a sample takes.
+ *
+ *      Usage: bounce_bench file.cap ...
+ *             bounce_bench -m new|worn|noisy <seed> <presses>
+ *
+ *      The second form writes a modelled capture to stdout, see
+ *      Modelled captures below.
+ *
+ * Captures:
+ *      One entry a line, a '#' starts a comment. An entry is either a
+ *      word of Capture[] as read with the debugger, in hex:
+ *
+ *          0xE2F4          RA3-RA0 in bits 12-15, the microseconds
+ *                          since the previous entry in bits 0-11
+ *
+ *      or the two as decimal microseconds and a hex digit, as a logic
+ *      analyser export is written:
+ *
+ *          756 E
+ *
+ *      A word with 4095 microseconds was longer, and is replayed as
+ *      GAP_US, so captures read one buffer at a time can be put one
+ *      after the other in a file. The inputs are high, 0xF, before
+ *      the first entry.
+ *
+ * Presses:
+ *      The inputs are decoded with PollSwitches(), and the capture is
+ *      cut at each stretch of no switch of QUIET_US or more. What is
+ *      between two of them is a press when one switch reads for
+ *      HOLD_US or more without a break, and noise when none does. A
+ *      press is of the switch read longest, from its first edge to
+ *      the start of the next quiet stretch.
+ *
+ * Scoring:
+ *      Each debouncer is called once a tick, as Switch_Debounce() is
+ *      from App_Pass(), and returns a switch when it accepts one,
+ *      which Panel_Process() would act on. The ticks are taken at
+ *      PHASES offsets through the millisecond, and each replay starts
+ *      from power on with erased data EEPROM, so the firmware learns
+ *      its debounce from the first presses of the file.
+ *
+ *      A switch accepted during a press, or within SW_DEBOUNCE_MAX
+ *      ticks of its end, is the press when it is the switch pressed
+ *      and the press has not been accepted yet, and its latency is
+ *      from the first edge of the press. Any other is a false
+ *      trigger: noise, the wrong switch, or a press taken twice. A
+ *      press not accepted is missed.
+ *
+ *      The time a sample takes is measured on the host, with the
+ *      samples of the capture set out beforehand. It compares the
+ *      debouncers with each other, not with the PIC.
+ *
+ *      The firmware must miss no press and make no false trigger on
+ *      the captures of new and worn switches, the files with "new"
+ *      or "worn" in their name. Exit status is 0 when it does, 1
+ *      when it does not and 2 when a file cannot be read.
+ *
+ * Modelled captures:
+ *      Until the corpus holds captures of the real panel, bounce/ has
+ *      captures made by -m from a model of the contacts, sampled as
+ *      Capture_Sample() samples, every CAPTURE_PERIOD_US:
+ *
+ *          new     make bounce of 0.2 to 1.5 ms, break bounce of 0.1
+ *                  to 0.8 ms
+ *          worn    make bounce of 2 to 10 ms, break bounce of 1 to
+ *                  5 ms, and the contact opening for 50 to 600 us
+ *                  about 5 times a second while held
+ *          noisy   worn, and a line of the panel pulled low for 30 to
+ *                  300 us about 3 times a second, pressed or not
+ *
+ *      The lines of a switch's code follow its contact through the
+ *      diodes up to 40 us apart, so a code between two can be read.
+ */
+#define _DEFAULT_SOURCE
+#include "sim.h"
+
+#include <time.h>
+
+#define CAPTURE_PERIOD_US (30)
+#define CAPTURE_ENTRIES (100000)
+#define SAMPLE_TICKS (1000000)
+#define GAP_US (200000)
+#define QUIET_US (20000)
+#define HOLD_US (20000)
+#define PHASES (4)
+#define TIMING_REPEAT (20)
+#define DEBOUNCERS (6)
+#define LEARN_PASSES (40)
+#define STABLE_SHORT (5)
+#define STABLE_LONG (SW_DEBOUNCE_MAX)
+#define INTEGRATOR_MAX (8)
+#define LOCKOUT_TICKS (SW_DEBOUNCE_MAX)
+
+typedef struct
+{
+    uint32_t Time;                      /* microseconds from the start */
+    uint8_t Inputs;                     /* RA3-RA0 */
+} Entry_t;
+
+typedef struct
+{
+    uint32_t Start;
+    uint32_t End;
+    SelectSwitch_t Key;                 /* SW_none for noise */
+    uint8_t Taken;
+} Press_t;
+
+typedef struct
+{
+    const char *Name;
+    void (*Reset)(void);
+    SelectSwitch_t (*Step)(uint8_t Now);
+} Debouncer_t;
+
+typedef struct
+{
+    uint32_t Presses;
+    uint32_t Missed;
+    uint32_t False;
+    uint32_t Taken;
+    double Latency;                     /* microseconds, the sum */
+    uint32_t Longest;
+    double Nanoseconds;                 /* a sample */
+} Score_t;
+
+static Entry_t Capture_Entries[CAPTURE_ENTRIES];
+static uint32_t Capture_Count;
+static Press_t Presses[CAPTURE_ENTRIES];
+static uint32_t Press_Count;
+static uint8_t Samples[SAMPLE_TICKS];
+static uint32_t Sample_Count;
+
+/* the switch PollSwitches() reads from the inputs */
+static SelectSwitch_t Decode(uint8_t Inputs)
+{
+    Sim_PortAIn = (Sim_PortAIn & ~0x0F) | Inputs;
+    return PollSwitches();
+}
+
+/*
+ * Debouncers
+ *
+ * Each is called with the tick count and reads the inputs with
+ * PollSwitches(), as Switch_Debounce() does.
+ */
+static SelectSwitch_t Accepted;
+static SelectSwitch_t Candidate;
+static uint8_t Count;
+static uint8_t Since;
+
+/* the firmware, from power on with erased data EEPROM */
+static void Firmware_Reset(void)
+{
+    memset(Sim_EE, 0xFF, sizeof(Sim_EE));
+    Sim_PortAIn = SW_EN_MASK | 0x08;
+    Sim_PowerOn(1);
+}
+
+/* the firmware after the capture was replayed LEARN_PASSES times */
+static void Firmware_Learned(void)
+{
+    uint32_t Pass;
+    uint32_t Index;
+
+    Firmware_Reset();
+    for (Pass = 0; Pass < LEARN_PASSES; Pass++)
+    {
+        for (Index = 0; Index < Sample_Count; Index++)
+        {
+            Sim_PortAIn = (Sim_PortAIn & ~0x0F) | Samples[Index];
+            Switch_Debounce((uint8_t)Index);
+        }
+    }
+}
+
+static void Reset(void)
+{
+    Accepted = Candidate = SW_none;
+    Count = Since = 0;
+}
+
+/* a state is accepted when it reads the same for Ticks ticks */
+static SelectSwitch_t Stable(uint8_t Ticks)
+{
+    SelectSwitch_t Sample;
+
+    Sample = PollSwitches();
+    if (Sample != Candidate)
+    {
+        Candidate = Sample;
+        Count = 0;
+    }
+    else if ((Count < Ticks) && (++Count == Ticks) && (Candidate != Accepted))
+    {
+        Accepted = Candidate;
+        return Accepted;
+    }
+    return SW_none;
+}
+
+static SelectSwitch_t Stable_Short(uint8_t Now)
+{
+    (void)Now;
+    return Stable(STABLE_SHORT);
+}
+
+static SelectSwitch_t Stable_Long(uint8_t Now)
+{
+    (void)Now;
+    return Stable(STABLE_LONG);
+}
+
+/*
+ * A count up while a switch reads and down while none does, pressed
+ * at INTEGRATOR_MAX and released at 0. The switch is the last read.
+ */
+static SelectSwitch_t Integrator(uint8_t Now)
+{
+    SelectSwitch_t Sample;
+
+    (void)Now;
+    Sample = PollSwitches();
+    if (Sample != SW_none)
+    {
+        Candidate = Sample;
+        if ((Count < INTEGRATOR_MAX) && (++Count == INTEGRATOR_MAX) && (Accepted == SW_none))
+        {
+            Accepted = Candidate;
+            return Accepted;
+        }
+    }
+    else if (Count && (--Count == 0))
+    {
+        Accepted = SW_none;
+    }
+    return SW_none;
+}
+
+/* a change is accepted at once, and the inputs ignored for LOCKOUT_TICKS */
+static SelectSwitch_t Lockout(uint8_t Now)
+{
+    SelectSwitch_t Sample;
+
+    (void)Now;
+    Sample = PollSwitches();
+    if (Since)
+    {
+        Since--;
+    }
+    else if (Sample != Accepted)
+    {
+        Accepted = Sample;
+        Since = LOCKOUT_TICKS;
+        return Accepted;
+    }
+    return SW_none;
+}
+
+static const Debouncer_t Debouncers[DEBOUNCERS] =
+{
+    {"firmware",        Firmware_Reset, Switch_Debounce},
+    {"firmware learned", Firmware_Learned, Switch_Debounce},
+    {"stable 5 ms",     Reset,          Stable_Short},
+    {"stable 20 ms",    Reset,          Stable_Long},
+    {"integrator 8",    Reset,          Integrator},
+    {"lock-out 20 ms",  Reset,          Lockout},
+};
+
+/* read a capture, returns zero when it cannot be read */
+static int Capture_Read(const char *Name)
+{
+    FILE *File;
+    char Line[256];
+    uint32_t Time;
+    unsigned long Delta;
+    unsigned Inputs;
+    unsigned Word;
+    char *Text;
+
+    File = fopen(Name, "r");
+    if (File == NULL)
+    {
+        return 0;
+    }
+    Capture_Count = 0;
+    Time = 0;
+    while (fgets(Line, sizeof(Line), File))
+    {
+        if ((Text = strchr(Line, '#')) != NULL)
+        {
+            *Text = 0;
+        }
+        if (sscanf(Line, " 0x%x", &Word) == 1)
+        {
+            Delta = Word & 0x0FFF;
+            Inputs = Word >> 12;
+            if (Delta == 0x0FFF)
+            {
+                Delta = GAP_US;
+            }
+        }
+        else if (sscanf(Line, " %lu %x", &Delta, &Inputs) != 2)
+        {
+            continue;
+        }
+        if ((Inputs > 0x0F) || (Capture_Count == CAPTURE_ENTRIES))
+        {
+            fclose(File);
+            return 0;
+        }
+        Time += (uint32_t)Delta;
+        Capture_Entries[Capture_Count].Time = Time;
+        Capture_Entries[Capture_Count].Inputs = (uint8_t)Inputs;
+        Capture_Count++;
+    }
+    fclose(File);
+    return Capture_Count != 0;
+}
+
+/* end a press, or noise, from Start to End */
+static void Press_Add(uint32_t Start, uint32_t End, const uint32_t *Longest)
+{
+    Press_t *Press = &Presses[Press_Count++];
+    SelectSwitch_t Key;
+
+    Press->Start = Start;
+    Press->End = End;
+    Press->Key = SW_none;
+    Press->Taken = 0;
+    for (Key = SW_1; Key <= SW_VOL_DOWN; Key++)
+    {
+        if ((Longest[Key] >= HOLD_US) && (Longest[Key] > Longest[Press->Key]))
+        {
+            Press->Key = Key;
+        }
+    }
+}
+
+/* the presses and the noise of the capture, see Presses */
+static void Presses_Find(void)
+{
+    uint32_t Index;
+    uint32_t Now;
+    uint32_t Start;                     /* of what reads as it does now */
+    uint32_t Active;                    /* the first edge after a quiet stretch */
+    uint32_t Longest[SW_VOL_DOWN + 1];
+    SelectSwitch_t Key;
+    SelectSwitch_t Reads;
+    uint8_t Busy;
+
+    Press_Count = 0;
+    Busy = 0;
+    Active = 0;
+    Start = 0;
+    Reads = SW_none;
+    memset(Longest, 0, sizeof(Longest));
+    for (Index = 0; Index < Capture_Count; Index++)
+    {
+        Now = Capture_Entries[Index].Time;
+        Key = Decode(Capture_Entries[Index].Inputs);
+        if (Key == Reads)
+        {
+            continue;
+        }
+        if (Reads != SW_none)
+        {
+            if (Now - Start > Longest[Reads])
+            {
+                Longest[Reads] = Now - Start;
+            }
+        }
+        else if (Busy && (Now - Start >= QUIET_US))
+        {
+            Press_Add(Active, Start, Longest);
+            Busy = 0;
+            memset(Longest, 0, sizeof(Longest));
+        }
+        if (!Busy)
+        {
+            Busy = 1;
+            Active = Now;
+        }
+        Reads = Key;
+        Start = Now;
+    }
+    if (Busy)
+    {
+        Press_Add(Active, Start, Longest);
+    }
+}
+
+/* the inputs at each tick from Phase microseconds */
+static void Samples_Take(uint32_t Phase)
+{
+    uint32_t Ticks;
+    uint32_t Index;
+    uint32_t Time;
+    uint8_t Inputs;
+
+    Inputs = 0x0F;
+    Index = 0;
+    for (Ticks = 0; Ticks < SAMPLE_TICKS; Ticks++)
+    {
+        Time = Phase + Ticks * 1000;
+        while ((Index < Capture_Count) && (Capture_Entries[Index].Time <= Time))
+        {
+            Inputs = Capture_Entries[Index++].Inputs;
+        }
+        if ((Index == Capture_Count) && (Time > Capture_Entries[Capture_Count - 1].Time + 2 * QUIET_US))
+        {
+            break;
+        }
+        Samples[Ticks] = Inputs;
+    }
+    Sample_Count = Ticks;
+}
+
+/* a switch accepted at Time, see Scoring */
+static void Score_Accept(Score_t *Score, SelectSwitch_t Key, uint32_t Time)
+{
+    uint32_t Index;
+
+    for (Index = 0; Index < Press_Count; Index++)
+    {
+        Press_t *Press = &Presses[Index];
+
+        if ((Time >= Press->Start) && (Time <= Press->End + SW_DEBOUNCE_MAX * 1000))
+        {
+            if ((Press->Key == Key) && !Press->Taken)
+            {
+                Press->Taken = 1;
+                Score->Taken++;
+                Score->Latency += Time - Press->Start;
+                if (Time - Press->Start > Score->Longest)
+                {
+                    Score->Longest = Time - Press->Start;
+                }
+                return;
+            }
+        }
+    }
+    Score->False++;
+}
+
+/* replay the capture through a debouncer at each phase */
+static void Replay(const Debouncer_t *Debouncer, Score_t *Score)
+{
+    uint32_t Phase;
+    uint32_t Index;
+    uint32_t Repeat;
+    SelectSwitch_t Key;
+    struct timespec Begin;
+    struct timespec End;
+
+    memset(Score, 0, sizeof(*Score));
+    for (Phase = 0; Phase < PHASES; Phase++)
+    {
+        Samples_Take(Phase * 1000 / PHASES);
+        for (Index = 0; Index < Press_Count; Index++)
+        {
+            Presses[Index].Taken = 0;
+            Score->Presses += (Presses[Index].Key != SW_none);
+        }
+        Debouncer->Reset();
+        for (Index = 0; Index < Sample_Count; Index++)
+        {
+            Sim_PortAIn = (Sim_PortAIn & ~0x0F) | Samples[Index];
+            Key = Debouncer->Step((uint8_t)Index);
+            if (Key != SW_none)
+            {
+                Score_Accept(Score, Key, Phase * 1000 / PHASES + Index * 1000);
+            }
+        }
+        for (Index = 0; Index < Press_Count; Index++)
+        {
+            Score->Missed += (Presses[Index].Key != SW_none) && !Presses[Index].Taken;
+        }
+    }
+
+    Debouncer->Reset();
+    clock_gettime(CLOCK_MONOTONIC, &Begin);
+    for (Repeat = 0; Repeat < TIMING_REPEAT; Repeat++)
+    {
+        for (Index = 0; Index < Sample_Count; Index++)
+        {
+            Sim_PortAIn = (Sim_PortAIn & ~0x0F) | Samples[Index];
+            Debouncer->Step((uint8_t)Index);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &End);
+    Score->Nanoseconds = ((End.tv_sec - Begin.tv_sec) * 1e9 + (End.tv_nsec - Begin.tv_nsec)) / ((double)Sample_Count * TIMING_REPEAT);
+}
+
+static void Score_Print(const char *Name, const Score_t *Score)
+{
+    printf("  %-16s %5lu %6lu %6lu %8.2f %8.2f %8.1f\n", Name, (unsigned long)Score->Presses,
+           (unsigned long)Score->Missed, (unsigned long)Score->False,
+           Score->Taken ? Score->Latency / Score->Taken / 1000 : 0.0, Score->Longest / 1000.0, Score->Nanoseconds);
+}
+
+/*
+ * Modelled captures
+ */
+typedef struct
+{
+    uint32_t Make[2];                   /* microseconds, the shortest and longest */
+    uint32_t Break[2];
+    uint32_t Chatter;                   /* openings a second while held */
+    uint32_t Glitch;                    /* line glitches a second */
+} Profile_t;
+
+#define PROFILES (3)
+
+static const char *const Profile_Name[PROFILES] = {"new", "worn", "noisy"};
+static const Profile_t Profiles[PROFILES] =
+{
+    {{200, 1500},   {100, 800},     0, 0},
+    {{2000, 10000}, {1000, 5000},   5, 0},
+    {{2000, 10000}, {1000, 5000},   5, 3},
+};
+
+#define MODEL_EVENTS (200000)
+
+typedef struct
+{
+    uint32_t Time;
+    uint8_t Lines;                      /* pulled low from this time, or let go with MODEL_OPEN */
+} Model_Event_t;
+
+static Model_Event_t Model_Events[MODEL_EVENTS];
+static uint32_t Model_Count;
+static uint32_t Model_Skew[4];          /* of each line, for this press */
+
+#define MODEL_OPEN (0x80)
+#define MODEL_GLITCH (0x40)
+
+static uint32_t Random(uint32_t Low, uint32_t High)
+{
+    return Low + (uint32_t)rand() % (High - Low + 1);
+}
+
+/* the lines a switch pulls low */
+static uint8_t Model_Lines(SelectSwitch_t Key)
+{
+    uint8_t Code;
+
+    if (Key == SW_REC)
+    {
+        return 0x08;
+    }
+    for (Code = 0; SW_EN_Map[Code] != Key; Code++)
+    {
+    }
+    return ~Code & SW_EN_MASK;
+}
+
+/* the contact closes, Low set, or opens at Time, each line Model_Skew[] later */
+static void Model_Contact(uint32_t Time, uint8_t Lines, uint8_t Low)
+{
+    uint8_t Line;
+
+    for (Line = 0; Line < 4; Line++)
+    {
+        if ((Lines & (1 << Line)) && (Model_Count < MODEL_EVENTS - 1))
+        {
+            Model_Events[Model_Count].Time = Time + Model_Skew[Line];
+            Model_Events[Model_Count].Lines = (uint8_t)((1 << Line) | (Low ? 0 : MODEL_OPEN));
+            Model_Count++;
+        }
+    }
+}
+
+/* a bounce of Length microseconds from Time, ending closed or open */
+static uint32_t Model_Bounce(uint32_t Time, uint32_t Length, uint8_t Lines, uint8_t Closed)
+{
+    uint32_t End;
+    uint8_t State;
+
+    End = Time + Length;
+    State = Closed;
+    while (Time < End)
+    {
+        uint32_t Part;
+
+        /* the contact spends longer in the state it settles to as it goes */
+        Part = (Time - (End - Length)) * 4 / Length + 1;
+        Model_Contact(Time, Lines, State);
+        Time += (State == Closed) ? Random(20, 100 * Part) : Random(20, 400 / Part);
+        State = !State;
+    }
+    Model_Contact(End, Lines, Closed);
+    return End;
+}
+
+static int Model_Order(const void *Left, const void *Right)
+{
+    uint32_t A = ((const Model_Event_t *)Left)->Time;
+    uint32_t B = ((const Model_Event_t *)Right)->Time;
+
+    return (A > B) - (A < B);
+}
+
+static int Model(const char *Name, unsigned Seed, int Count)
+{
+    const Profile_t *Profile;
+    uint32_t Time;
+    uint32_t End;
+    uint32_t Sample;
+    uint32_t Last;
+    uint32_t Index;
+    uint8_t Closed[4];
+    uint8_t Glitch[4];
+    uint8_t Inputs;
+    uint8_t Was;
+    int Press;
+    int Which;
+
+    for (Which = 0; (Which < PROFILES) && (strcmp(Name, Profile_Name[Which]) != 0); Which++)
+    {
+    }
+    if (Which == PROFILES)
+    {
+        return 0;
+    }
+    Profile = &Profiles[Which];
+    srand(Seed);
+    Model_Count = 0;
+    Time = 100000;
+    for (Press = 0; Press < Count; Press++)
+    {
+        uint8_t Lines;
+        uint8_t Line;
+        uint32_t Release;
+
+        Lines = Model_Lines((SelectSwitch_t)Random(SW_1, SW_REC));
+        for (Line = 0; Line < 4; Line++)
+        {
+            Model_Skew[Line] = Random(0, 40);
+        }
+        Time = Model_Bounce(Time, Random(Profile->Make[0], Profile->Make[1]), Lines, 1);
+        Release = Time + Random(80000, 400000);
+        while (Profile->Chatter)
+        {
+            Time += Random(0, 2000000 / Profile->Chatter);
+            if (Time + 1000 >= Release)
+            {
+                break;
+            }
+            Model_Contact(Time, Lines, 0);
+            Time += Random(50, 600);
+            Model_Contact(Time, Lines, 1);
+        }
+        Time = Model_Bounce(Release, Random(Profile->Break[0], Profile->Break[1]), Lines, 0);
+        Time += Random(200000, 1000000);
+    }
+    End = Time;
+    for (Time = 0; Profile->Glitch && (Time < End); )
+    {
+        uint8_t Line;
+
+        Time += Random(0, 2000000 / Profile->Glitch);
+        Line = (uint8_t)(1 << Random(0, 3));
+        Model_Events[Model_Count].Time = Time;
+        Model_Events[Model_Count++].Lines = Line | MODEL_GLITCH;
+        Model_Events[Model_Count].Time = Time + Random(30, 300);
+        Model_Events[Model_Count++].Lines = Line | MODEL_GLITCH | MODEL_OPEN;
+        if (Model_Count >= MODEL_EVENTS - 2)
+        {
+            break;
+        }
+    }
+    qsort(Model_Events, Model_Count, sizeof(Model_Events[0]), Model_Order);
+
+    printf("# Modelled capture of %s switches, %d presses, seed %u\n", Name, Count, Seed);
+    printf("# made by bounce_bench -m %s %u %d, microseconds and RA3-RA0\n", Name, Seed, Count);
+    /* a line reads low while its contact or a glitch pulls it low, sampled as Capture_Sample() samples */
+    memset(Closed, 0, sizeof(Closed));
+    memset(Glitch, 0, sizeof(Glitch));
+    Index = 0;
+    Last = 0;
+    Was = 0x0F;
+    for (Sample = 0; Sample <= End; Sample += CAPTURE_PERIOD_US)
+    {
+        uint8_t Line;
+
+        while ((Index < Model_Count) && (Model_Events[Index].Time <= Sample))
+        {
+            for (Line = 0; Line < 4; Line++)
+            {
+                if (!(Model_Events[Index].Lines & (1 << Line)))
+                {
+                }
+                else if (Model_Events[Index].Lines & MODEL_GLITCH)
+                {
+                    Glitch[Line] = !(Model_Events[Index].Lines & MODEL_OPEN);
+                }
+                else
+                {
+                    Closed[Line] = !(Model_Events[Index].Lines & MODEL_OPEN);
+                }
+            }
+            Index++;
+        }
+        for (Inputs = 0x0F, Line = 0; Line < 4; Line++)
+        {
+            Inputs &= (Closed[Line] || Glitch[Line]) ? (uint8_t)~(1 << Line) : 0x0F;
+        }
+        if (Inputs != Was)
+        {
+            printf("%lu %X\n", (unsigned long)(Sample - Last), Inputs);
+            Last = Sample;
+            Was = Inputs;
+        }
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    Score_t Score;
+    Score_t Total[DEBOUNCERS];
+    int File;
+    int Which;
+    int Failed;
+
+    if ((argc == 5) && (strcmp(argv[1], "-m") == 0))
+    {
+        return Model(argv[2], (unsigned)atoi(argv[3]), atoi(argv[4])) ? 0 : 2;
+    }
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: bounce_bench file.cap ...\n"
+                        "       bounce_bench -m new|worn|noisy <seed> <presses>\n");
+        return 2;
+    }
+
+    /* the registers, for PollSwitches() */
+    Sim_PowerOn(1);
+    Failed = 0;
+    memset(Total, 0, sizeof(Total));
+    for (File = 1; File < argc; File++)
+    {
+        uint32_t Index;
+        uint32_t Noise;
+
+        if (!Capture_Read(argv[File]))
+        {
+            fprintf(stderr, "bounce_bench: cannot read %s\n", argv[File]);
+            return 2;
+        }
+        Presses_Find();
+        for (Noise = 0, Index = 0; Index < Press_Count; Index++)
+        {
+            Noise += (Presses[Index].Key == SW_none);
+        }
+        printf("bounce_bench: %s, %lu presses and %lu bursts of noise, %d phases\n", argv[File],
+               (unsigned long)(Press_Count - Noise), (unsigned long)Noise, PHASES);
+        printf("  %-16s %5s %6s %6s %8s %8s %8s\n", "debouncer", "press", "missed", "false", "mean ms", "max ms",
+               "ns");
+        for (Which = 0; Which < DEBOUNCERS; Which++)
+        {
+            Replay(&Debouncers[Which], &Score);
+            Score_Print(Debouncers[Which].Name, &Score);
+            Total[Which].Presses += Score.Presses;
+            Total[Which].Missed += Score.Missed;
+            Total[Which].False += Score.False;
+            Total[Which].Taken += Score.Taken;
+            Total[Which].Latency += Score.Latency;
+            Total[Which].Nanoseconds += Score.Nanoseconds / (argc - 1);
+            if (Score.Longest > Total[Which].Longest)
+            {
+                Total[Which].Longest = Score.Longest;
+            }
+            if ((Which == 0) && (Score.Missed || Score.False) &&
+                (strstr(argv[File], "new") || strstr(argv[File], "worn")))
+            {
+                printf("bounce_bench: FAIL the firmware on %s\n", argv[File]);
+                Failed = 1;
+            }
+        }
+    }
+    if (argc > 2)
+    {
+        printf("bounce_bench: all files\n");
+        for (Which = 0; Which < DEBOUNCERS; Which++)
+        {
+            Score_Print(Debouncers[Which].Name, &Total[Which]);
+        }
+    }
+    return Failed;
+}
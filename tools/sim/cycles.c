@@ -0,0 +1,492 @@
+/*
+ * File:   cycles.c
+ *
+ * Description:
+ *      Takes the instruction cycles of each line of main.c from the
+ *      XC8 listing and writes main.c with them put into the code, so
+ *      a host build of it advances simulated time by the PIC's cost
+ *      of the code it runs. See Sim_Cycle() in sim.h.
+ *
+ *      Usage: cycles listing.lst main.c > main_cycles.c
+ *             cycles -u <cycles> main.c > main_cycles.c
+ *
+ *      The listing is the one XC8 writes for the whole program with
+ *      --asmlist, in MPLAB X the .lst file in dist/<configuration>,
+ *      built with the same options as the host build. The second
+ *      form gives each line of code the same cost without a listing,
+ *      which make test uses to check the rewriting and the timing.
+ *
+ * Listing:
+ *      Each line of C that made code is shown as a comment, and the
+ *      instructions made from it follow:
+ *
+ *          ;main.c: 1122:     Result = SW_EN_Map[SW_EN_PORT & SW_EN_MASK];
+ *            852  07A3  0805          movf    5,w
+ *
+ *      An instruction is a listing line with a listing line number,
+ *      a four digit hex address and a four digit hex opcode. Each is
+ *      decoded from its opcode: CALL, GOTO, RETURN, RETLW and RETFIE
+ *      take two cycles and the rest one. A skip is counted as not
+ *      taken, one cycle short when it is. Instructions after a
+ *      comment of another file, or of main.c with text that is not
+ *      on that line of main.c, are not counted; the latter is an
+ *      error, as the listing is of another main.c.
+ *
+ * Blocks:
+ *      The host build follows main.c a line at a time, so the code
+ *      XC8 made for a line is one block, charged each time the line
+ *      runs. The charge goes into the line as SIM_CYCLES(n):
+ *
+ *      - before a statement;
+ *      - into the condition of if, else if, while, switch and the
+ *        while of a do, so it is charged each time it is tested;
+ *      - into the condition of a for, so the increment is charged
+ *        with it each time round;
+ *      - after the opening brace of a function, with the cost of
+ *        the function's closing brace and its header, so the entry
+ *        and the return are charged once a call whichever return
+ *        the code takes.
+ *
+ *      The cost of a line that continues a statement goes to the line
+ *      that starts it. The cost of a label, else or do goes to the
+ *      next line that takes one. Code outside functions, the tables
+ *      of const data, is not charged.
+ */
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINES (4000)
+#define LINE_SIZE (512)
+#define OPERATORS "+-*/%&|^?:<>=!"
+
+typedef struct
+{
+    char Text[LINE_SIZE];
+    uint32_t Cost;
+    int Depth;                          /* braces open at the start */
+    int Paren;                          /* parentheses open at the start */
+    int Comment;                        /* in a comment at the start */
+    int Open;                           /* a statement goes on from the line before */
+    int Preprocessor;
+    int Function;                       /* in the body of a function, its braces too */
+    int Switch;                         /* follows a switch */
+} Line_t;
+
+static Line_t Source[LINES];
+static int Lines;
+
+/* the line's C with comments, strings and characters blanked, and its first non-blank */
+static const char *Line_Code(const Line_t *L, char *Code, int *Comment)
+{
+    const char *Text = L->Text;
+    char Quote = 0;
+    int Index;
+
+    for (Index = 0; Text[Index] && (Text[Index] != '\n'); Index++)
+    {
+        char C = Text[Index];
+
+        Code[Index] = ' ';
+        if (*Comment)
+        {
+            if ((C == '*') && (Text[Index + 1] == '/'))
+            {
+                *Comment = 0;
+                Code[++Index] = ' ';
+            }
+        }
+        else if (Quote)
+        {
+            if (C == '\\')
+            {
+                Code[++Index] = ' ';
+            }
+            else if (C == Quote)
+            {
+                Quote = 0;
+            }
+        }
+        else if ((C == '/') && (Text[Index + 1] == '*'))
+        {
+            *Comment = 1;
+            Code[++Index] = ' ';
+        }
+        else if ((C == '/') && (Text[Index + 1] == '/'))
+        {
+            break;
+        }
+        else if ((C == '"') || (C == '\''))
+        {
+            Quote = C;
+        }
+        else
+        {
+            Code[Index] = C;
+        }
+    }
+    Code[Index] = '\0';
+    while (Index && isspace((unsigned char)Code[Index - 1]))
+    {
+        Code[--Index] = '\0';
+    }
+    while (isspace((unsigned char)*Code))
+    {
+        Code++;
+    }
+    return Code;
+}
+
+static int Starts(const char *Code, const char *Word)
+{
+    size_t Length = strlen(Word);
+
+    return (strncmp(Code, Word, Length) == 0) && !isalnum((unsigned char)Code[Length]) && (Code[Length] != '_');
+}
+
+/* read main.c and follow its braces, parentheses, statements and functions */
+static int Source_Read(const char *Name)
+{
+    FILE *File;
+    int Comment = 0;
+    int Depth = 0;
+    int Paren = 0;
+    int Open = 0;
+    int Continued = 0;
+    int Header = 0;
+    int Body = 0;
+    int Switch = 0;
+    int Failed;
+
+    File = fopen(Name, "r");
+    if (File == NULL)
+    {
+        return 0;
+    }
+    for (Lines = 1; (Lines < LINES) && fgets(Source[Lines].Text, LINE_SIZE, File); Lines++)
+    {
+        Line_t *L = &Source[Lines];
+        char Buffer[LINE_SIZE];
+        const char *Code;
+        size_t Length;
+        int Index;
+
+        L->Depth = Depth;
+        L->Paren = Paren;
+        L->Comment = Comment;
+        L->Open = Open;
+        Code = Line_Code(L, Buffer, &Comment);
+        L->Preprocessor = Continued || (Code[0] == '#');
+        Length = strlen(Code);
+        Continued = L->Preprocessor && Length && (Code[Length - 1] == '\\');
+        if (L->Preprocessor || !Length)
+        {
+            L->Function = Body && Depth;
+            continue;
+        }
+        if (Depth == 0)
+        {
+            Body = (Code[0] == '{') && Header;
+            Header = (Code[Length - 1] == ')') || Paren;
+        }
+        L->Function = Body;
+        L->Switch = Switch;
+        Switch = Starts(Code, "switch");
+        if (strchr(OPERATORS, Code[0]) && isspace((unsigned char)Code[strspn(Code, OPERATORS)]))
+        {
+            /* a binary operator first goes on from the line before */
+            L->Open = 1;
+        }
+        for (Index = 0; Code[Index]; Index++)
+        {
+            Depth += (Code[Index] == '{') - (Code[Index] == '}');
+            Paren += (Code[Index] == '(') - (Code[Index] == ')');
+        }
+        Open = Paren || (!strchr(";{}:)", Code[Length - 1]) && !Starts(Code, "else") && !Starts(Code, "do"));
+    }
+    Failed = ferror(File);
+    fclose(File);
+    return !Failed;
+}
+
+/*
+ * Listing
+ */
+static int Opcode_Cycles(unsigned int Opcode)
+{
+    if (((Opcode & 0x3000) == 0x2000) ||            /* CALL, GOTO */
+        ((Opcode & 0x3C00) == 0x3400) ||            /* RETLW */
+        (Opcode == 0x0008) || (Opcode == 0x0009))   /* RETURN, RETFIE */
+    {
+        return 2;
+    }
+    return 1;
+}
+
+/* the two texts are the same but for white space, or one stops early as XC8 cuts long lines */
+static int Same_Text(const char *A, const char *B)
+{
+    for (;;)
+    {
+        while (isspace((unsigned char)*A))
+        {
+            A++;
+        }
+        while (isspace((unsigned char)*B))
+        {
+            B++;
+        }
+        if (!*A || !*B)
+        {
+            return 1;
+        }
+        if (*A++ != *B++)
+        {
+            return 0;
+        }
+    }
+}
+
+static int Listing_Read(const char *Name, unsigned long *Instructions)
+{
+    FILE *File;
+    char Text[LINE_SIZE];
+    int Current = 0;
+
+    File = fopen(Name, "r");
+    if (File == NULL)
+    {
+        return 0;
+    }
+    while (fgets(Text, sizeof(Text), File))
+    {
+        const char *Comment;
+        unsigned int Number;
+        unsigned int Address;
+        unsigned int Opcode;
+        int Used;
+
+        Comment = strchr(Text, ';');
+        if (Comment && (sscanf(Comment, ";%*[^:]: %u: %n", &Number, &Used) == 1))
+        {
+            size_t Length = strcspn(Comment + 1, ":");
+
+            Current = 0;
+            if ((Length >= 6) && (strncmp(Comment + 1 + Length - 6, "main.c", 6) == 0) &&
+                ((Length == 6) || strchr("/\\", Comment[Length - 6])))
+            {
+                if ((Number >= (unsigned int)Lines) || !Same_Text(Comment + Used, Source[Number].Text))
+                {
+                    fprintf(stderr, "cycles: %s is not a listing of this main.c, line %u differs\n", Name, Number);
+                    exit(2);
+                }
+                Current = (int)Number;
+            }
+        }
+        else if ((sscanf(Text, "%*u %4x %4x%n", &Address, &Opcode, &Used) == 2) && (Used > 0) &&
+                 (!Text[Used] || isspace((unsigned char)Text[Used])) && Current)
+        {
+            Source[Current].Cost += Opcode_Cycles(Opcode);
+            (*Instructions)++;
+        }
+    }
+    fclose(File);
+    return 1;
+}
+
+/*
+ * Rewriting
+ */
+
+/* the line with Insert put in at Offset */
+static void Put(const Line_t *L, size_t Offset, const char *Insert)
+{
+    printf("%.*s%s%s", (int)Offset, L->Text, Insert, L->Text + Offset);
+}
+
+/* find the opening parenthesis of the condition after Keyword, from Code */
+static size_t Condition(const Line_t *L, const char *Keyword)
+{
+    const char *At;
+
+    At = strstr(L->Text, Keyword);
+    return strchr(At, '(') - L->Text + 1;
+}
+
+/*
+ * Write the line with Cost, returning 0 when it cannot take it and
+ * the cost goes to the next line
+ */
+static int Write_Line(const Line_t *L, const char *Code, uint32_t Cost)
+{
+    char Charge[40];
+    size_t Start = Code - L->Text;
+
+    if (!Cost)
+    {
+        return 0;
+    }
+    snprintf(Charge, sizeof(Charge), "SIM_CYCLES(%lu), ", (unsigned long)Cost);
+    if (Starts(Code, "if") || Starts(Code, "while") || Starts(Code, "switch"))
+    {
+        Put(L, Condition(L, Code), Charge);
+    }
+    else if (Starts(Code, "else") && Starts(Code + 4 + strspn(Code + 4, " \t"), "if"))
+    {
+        Put(L, Condition(L, Code + 4), Charge);
+    }
+    else if ((Code[0] == '}') && Starts(Code + 1 + strspn(Code + 1, " \t"), "while"))
+    {
+        Put(L, Condition(L, Code + 1), Charge);
+    }
+    else if (Starts(Code, "for"))
+    {
+        size_t Test = strchr(L->Text + Condition(L, Code), ';') - L->Text + 1;
+
+        snprintf(Charge, sizeof(Charge), " SIM_CYCLES(%lu),%s", (unsigned long)Cost,
+                 (L->Text[Test + strspn(L->Text + Test, " ")] == ';') ? " 1" : "");
+        Put(L, Test, Charge);
+    }
+    else if (Starts(Code, "else") || Starts(Code, "do") || Starts(Code, "case") || Starts(Code, "default") ||
+             (isalpha((unsigned char)Code[0]) && (Code[strspn(Code, "abcdefghijklmnopqrstuvwxyz"
+                                                                  "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_")] == ':')))
+    {
+        return 0;
+    }
+    else if ((Code[0] == '{') && L->Switch)
+    {
+        /* the body of a switch, the cost goes after the first label */
+        return 0;
+    }
+    else if (Code[0] == '{')
+    {
+        snprintf(Charge, sizeof(Charge), " SIM_CYCLES(%lu);", (unsigned long)Cost);
+        Put(L, Start + 1, Charge);
+    }
+    else
+    {
+        snprintf(Charge, sizeof(Charge), "SIM_CYCLES(%lu); ", (unsigned long)Cost);
+        Put(L, Start, Charge);
+    }
+    return 1;
+}
+
+/* the cost of continuations to their statement, and of a function's header and end to its entry */
+static void Costs_Place(void)
+{
+    int Index;
+    int Statement = 0;
+    int Entry = 0;
+    uint32_t Header = 0;
+
+    for (Index = 1; Index < Lines; Index++)
+    {
+        Line_t *L = &Source[Index];
+        char Buffer[LINE_SIZE];
+        int Comment = L->Comment;
+        const char *Code = Line_Code(L, Buffer, &Comment);
+
+        if (L->Preprocessor || !Code[0])
+        {
+            continue;
+        }
+        if (!L->Function)
+        {
+            /* a function header, or const data whose cost is dropped */
+            Header = ((Code[strlen(Code) - 1] == ')') || L->Paren) ? Header + L->Cost : 0;
+            L->Cost = 0;
+        }
+        else if (L->Depth == 0)
+        {
+            Entry = Index;
+            L->Cost += Header;
+            Header = 0;
+        }
+        else if ((L->Depth == 1) && (Code[0] == '}'))
+        {
+            Source[Entry].Cost += L->Cost;
+            L->Cost = 0;
+        }
+        else if ((L->Paren || L->Open) && Statement)
+        {
+            Source[Statement].Cost += L->Cost;
+            L->Cost = 0;
+        }
+        if (!L->Paren && !L->Open)
+        {
+            Statement = Index;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long Instructions = 0;
+    unsigned long Uniform = 0;
+    unsigned long Costed = 0;
+    unsigned long Carried = 0;
+    uint32_t Carry = 0;
+    int Index;
+
+    if ((argc == 4) && (strcmp(argv[1], "-u") == 0))
+    {
+        Uniform = strtoul(argv[2], NULL, 10);
+    }
+    if ((argc != 3) && !Uniform)
+    {
+        fprintf(stderr, "usage: cycles listing.lst main.c > main_cycles.c\n"
+                        "       cycles -u <cycles> main.c > main_cycles.c\n");
+        return 2;
+    }
+    if (!Source_Read(argv[argc - 1]))
+    {
+        fprintf(stderr, "cycles: cannot read %s\n", argv[argc - 1]);
+        return 2;
+    }
+    if (!Uniform && !Listing_Read(argv[1], &Instructions))
+    {
+        fprintf(stderr, "cycles: cannot read %s\n", argv[1]);
+        return 2;
+    }
+    for (Index = 1; Uniform && (Index < Lines); Index++)
+    {
+        char Buffer[LINE_SIZE];
+        int Comment = Source[Index].Comment;
+
+        if (!Source[Index].Preprocessor && Line_Code(&Source[Index], Buffer, &Comment)[0])
+        {
+            Source[Index].Cost = (uint32_t)Uniform;
+        }
+    }
+    Costs_Place();
+
+    printf("#line 1 \"%s\"\n", argv[argc - 1]);
+    for (Index = 1; Index < Lines; Index++)
+    {
+        Line_t *L = &Source[Index];
+        char Buffer[LINE_SIZE];
+        int Comment = L->Comment;
+        const char *Code = Line_Code(L, Buffer, &Comment);
+
+        Carry += L->Cost;
+        if (L->Function && !L->Preprocessor && Code[0] && !L->Paren && !L->Open &&
+            Write_Line(L, L->Text + (Code - Buffer), Carry))
+        {
+            Costed++;
+            Carry = 0;
+            continue;
+        }
+        Carried += (L->Cost != 0);
+        if (L->Function && (L->Depth == 1) && (Code[0] == '}'))
+        {
+            /* from a label or else with nothing after it in the function */
+            Carry = 0;
+        }
+        fputs(L->Text, stdout);
+    }
+    fprintf(stderr, "cycles: %lu instructions, %lu lines of main.c charged, %lu carried to the next\n",
+            Instructions, Costed, Carried);
+    return 0;
+}
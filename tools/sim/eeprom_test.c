@@ -0,0 +1,230 @@
+/*
+ * File:   eeprom_test.c
+ *
+ * Description:
+ *      Data EEPROM records. Checks that records are written from an
+ *      erased part and from layout version 0, that a save does not
+ *      stall the main loop or lose IR edges, and that data EEPROM is
+ *      never read while a write is in progress.
+ */
+#include "sim.h"
+
+/* check a record in the simulated EEPROM against Data */
+static int Record_Is(uint8_t Address, uint8_t Tag, const uint8_t *Data, uint8_t Length)
+{
+    uint8_t Crc;
+    uint8_t Index;
+
+    if (Sim_EE[Address] != Tag)
+    {
+        return 0;
+    }
+    Crc = CRC8(0, Tag);
+    for (Index = 0; Index < Length; Index++)
+    {
+        if (Sim_EE[Address + 1 + Index] != Data[Index])
+        {
+            return 0;
+        }
+        Crc = CRC8(Crc, Data[Index]);
+    }
+    return Sim_EE[Address + 1 + Length] == Crc;
+}
+
+static void Check_Records(void)
+{
+    uint8_t Learn[SW_KEYS];
+    uint8_t Key;
+
+    for (Key = 0; Key < SW_KEYS; Key++)
+    {
+        Learn[Key] = SW_Learn[Key] & SW_LEARN_BOUNCE;
+    }
+    Sim_Check(Record_Is(EE_DEBOUNCE, EE_TAG_DEBOUNCE, Learn, SW_KEYS), "debounce record");
+    Sim_Check(Record_Is(EE_TUNABLES, EE_TAG_TUNABLES, Tune, TUNE_COUNT), "tunables record");
+    Sim_Check(Record_Is(EE_MOTOR_CONST, EE_TAG_MOTOR, (uint8_t *)&MotorConst, sizeof(MotorConst)), "motor record");
+}
+
+static void Erased_Test(void)
+{
+    memset(Sim_EE, 0xFF, sizeof(Sim_EE));
+    Sim_PowerOn(1);
+    Sim_Run(200000);
+    Check_Records();
+    Sim_Check(Tune[TUNE_RELAY_SETTLE] == RELAY_SETTLE_TICKS, "tunable default");
+    Sim_Check(MotorConst.Coast == MOTOR_COAST_DEFAULT, "motor default");
+    printf("eeprom_test: erased, records written\n");
+}
+
+/* a save of two records while the remote sends */
+static void Save_Test(void)
+{
+    uint32_t Time;
+    uint16_t Frame;
+    int Count;
+
+    Sim_StallMax = 0;
+    Tune_Set(TUNE_RELAY_MUTE, 7);
+    Tune_Set(TUNE_RELAY_PULLIN, 30);
+    Tune_Set(TUNE_MOTOR_CONST + 3, 25);
+    Tune_Save();
+
+    Time = Sim_Time + 1000;
+    for (Count = 0; Count < 4; Count++)
+    {
+        Frame = Sim_RC5Frame(0, Count, Count & 1);
+        Time = Sim_RC5(Time, Frame, 0, 0) + 20000;
+    }
+    Sim_Run(Time - Sim_Time + 5000);
+
+    Check_Records();
+    Sim_Check(Sim_EE[EE_TUNABLES + 1 + TUNE_RELAY_MUTE] == 7, "saved tunable");
+    Sim_Check(Sim_EE[EE_MOTOR_CONST + 1 + 3] == 25, "saved motor constant");
+    Sim_Check(IR_EdgeOverrun == 0, "IR edge queue overrun during the save");
+    Sim_Check(IR_LastFrame == Frame, "IR frame lost during the save");
+    printf("eeprom_test: save while receiving IR, longest stall %u sub-ticks\n", Sim_StallMax);
+    Sim_Check(Sim_StallMax == 0, "the main loop waited for data EEPROM");
+}
+
+static const uint8_t V0[] = {20, 12, 10, 40, 3, 4, 5, 6, 7, 8, 9};
+
+static uint16_t Total_Writes(void)
+{
+    uint16_t Writes;
+    uint8_t Address;
+
+    for (Writes = 0, Address = 0; Address < SIM_EE_SIZE; Address++)
+    {
+        Writes += Sim_EEWrites[Address];
+    }
+    return Writes;
+}
+
+/* start from layout version 0 and run until Cut bytes are written */
+static void Legacy_Start(uint16_t Cut)
+{
+    memset(Sim_EE, 0xFF, sizeof(Sim_EE));
+    memcpy(Sim_EE, V0, sizeof(V0));
+    memset(Sim_EEWrites, 0, sizeof(Sim_EEWrites));
+    Sim_PowerOn(1);
+    while (Total_Writes() < Cut)
+    {
+        Sim_Step();
+    }
+}
+
+static int Legacy_Migrated(void)
+{
+    uint8_t Key;
+
+    for (Key = 0; Key < SW_KEYS; Key++)
+    {
+        if (SW_Learn[Key] != V0[EE_V0_DEBOUNCE + Key])
+        {
+            return 0;
+        }
+    }
+    return memcmp(&MotorConst, V0, sizeof(MotorConst)) == 0;
+}
+
+static uint16_t Migration_Writes;
+
+static void Legacy_Test(void)
+{
+    Legacy_Start(0);
+    Sim_Run(300000);
+    Check_Records();
+    Sim_Check(Legacy_Migrated(), "layout version 0 values lost in the migration");
+    Migration_Writes = Total_Writes();
+    printf("eeprom_test: layout version 0 migrated, %u bytes written\n", Migration_Writes);
+}
+
+/*
+ * A version 1 tunables record is kept, except the coil hold duty,
+ * which had no effect when it was saved.
+ */
+static void Tunables_V1_Test(void)
+{
+    uint8_t Record[1 + TUNE_COUNT + 1];
+    uint8_t Id;
+
+    Record[0] = EE_TAG_TUNABLES_V1;
+    for (Id = 0; Id < TUNE_COUNT; Id++)
+    {
+        Record[1 + Id] = Tune_Limit[Id].Default;
+    }
+    Record[1 + TUNE_RELAY_MUTE] = 7;
+    Record[1 + TUNE_HOLD_DUTY] = 2;
+    Record[1 + TUNE_COUNT] = 0;
+    for (Id = 0; Id <= TUNE_COUNT; Id++)
+    {
+        Record[1 + TUNE_COUNT] = CRC8(Record[1 + TUNE_COUNT], Record[Id]);
+    }
+    memcpy(&Sim_EE[EE_TUNABLES], Record, sizeof(Record));
+    Sim_PowerOn(1);
+    Sim_Run(200000);
+    Check_Records();
+    Sim_Check(Tune[TUNE_RELAY_MUTE] == 7, "version 1 tunable lost");
+    Sim_Check(Tune[TUNE_HOLD_DUTY] == SUBTICKS, "version 1 hold duty kept");
+    printf("eeprom_test: version 1 tunables kept, hold duty back to full drive\n");
+}
+
+/*
+ * Power fails after each number of bytes written in the migration,
+ * and the next start must find the old values.
+ */
+static void Torn_Test(void)
+{
+    uint16_t Cut;
+
+    for (Cut = 0; Cut < Migration_Writes; Cut++)
+    {
+        Legacy_Start(Cut);
+        Sim_PowerOn(1);
+        Sim_Check(Legacy_Migrated(), "layout version 0 values lost to a torn migration");
+        Sim_Run(300000);
+        Check_Records();
+        Sim_PowerOn(1);
+        Sim_Check(!EE_Legacy && Legacy_Migrated(), "migration not finished after a torn migration");
+    }
+    printf("eeprom_test: migration cut by a power failure after 0 to %u bytes is done again\n", Cut - 1);
+}
+
+/*
+ * The tunables menu times out while the last byte of a save is
+ * being written, and must not wait for it to read the records. The
+ * motor tag is spoiled so the save ends with a write of the tag.
+ */
+static void Menu_Test(void)
+{
+    Tune_Set(TUNE_RELAY_MUTE, 8);
+    Sim_EE[EE_MOTOR_CONST] = 0xFF;
+    Tune_Save();
+    while (EE_Pending || (EE_Current != EE_RECORD_NONE))
+    {
+        Sim_Step();
+    }
+    Sim_Check(EE_BUSY(), "no write in progress after the last byte of a save");
+    Tune_MenuId = 0;
+    Tune_MenuPeriods = 1;
+    Tune_MenuDeadline = App.LastTick + 1;
+    Sim_StallMax = 0;
+    Sim_Run(2 * TUNE_MENU_TICKS * 1000);
+    Sim_Check(Tune_MenuId == TUNE_MENU_OFF, "menu not closed");
+    Sim_Check(Tune[TUNE_RELAY_MUTE] == 8, "saved tunable not read back");
+    printf("eeprom_test: menu timeout during a save, longest stall %u sub-ticks\n", Sim_StallMax);
+    Sim_Check(Sim_StallMax == 0, "the menu timeout waited for data EEPROM");
+}
+
+int main(void)
+{
+    Erased_Test();
+    Save_Test();
+    Menu_Test();
+    Tunables_V1_Test();
+    Legacy_Test();
+    Torn_Test();
+    printf("eeprom_test: %u reads while a write was in progress\n", Sim_EEReadBusy);
+    Sim_Check(Sim_EEReadBusy == 0, "data EEPROM read while a write was in progress");
+    return 0;
+}
@@ -0,0 +1,500 @@
+/*
+ * File:   fault_test.c
+ *
+ * Description:
+ *      Recovery from faults. Each trial starts from the same state,
+ *      (cd) playing with (mute) off, and runs RUN_MS of use: a save
+ *      of changed tunables and motor constants, a key press and a
+ *      volume move at random times in the first 300 milliseconds,
+ *      and at POWER_MS a power cycle, after which the constants come
+ *      from data EEPROM again. Each trial is run without a fault and
+ *      then with one injected at a random time, see Faults in sim.h,
+ *      and the two are compared a millisecond at a time.
+ *
+ *      The fault classes are:
+ *          stuck low       a switch line on PORTA held low, then
+ *          stuck high      held high, for 0.4 to 1 second
+ *          EEPROM write    a write of the save fails
+ *          watchdog reset  a reset at a random sub-tick
+ *          watchdog hang   the TIMER2 interrupt stops and the
+ *                          watchdog times out
+ *          brown-out       a reset with the supply low for 1 to 50
+ *                          milliseconds
+ *
+ *      A reset leaves the ports inputs, so every relay drops out,
+ *      and the firmware starts again with (mute) on. Time to safe
+ *      runs from a reset, or from the hang, to the (mute) contact
+ *      opening. Stuck lines and EEPROM faults leave the outputs in
+ *      the firmware's hands and have no time to safe.
+ *
+ *      The state is restored when the contacts, the front panel
+ *      state and the constants are those of the run without the
+ *      fault and stay so, and time to restored runs from the fault
+ *      to the last time they became so. After an EEPROM fault only
+ *      the constants are compared. A stuck line may rightly change
+ *      the panel, it looks like a held key, so there it is the time
+ *      from freeing the line to a press of (1) being taken.
+ *
+ *      The run without a fault must make no thump and keep the
+ *      outputs safe throughout: the (mute) contact open, or at most
+ *      one source contact closed and none bouncing. A reset must
+ *      make the outputs safe within SAFE_RESET_US, and a hang within
+ *      the watchdog timeout and that. Every stuck line must let the
+ *      keys work again, and every reset must restore the state but
+ *      for a press made and let go while the controller was down.
+ *      The rest is reported: thumps, saves torn or failed, presses
+ *      missed and the trials whose state was not restored.
+ *
+ *      Usage: fault_test [trials]
+ */
+#include "journal.h"
+
+#define TRIALS (40)
+#define RUN_MS (3000)
+#define POWER_MS (2000)
+#define PRESS_MS (80)
+#define SAFE_RESET_US (5000)
+#define SAMPLE_PANEL (4)                /* contacts and panel, then the constants */
+#define SAMPLE_SIZE (SAMPLE_PANEL + SW_KEYS + TUNE_COUNT + sizeof(MotorConst_t))
+
+typedef uint8_t State_t[JOURNAL_STATE_MAX + sizeof(uint32_t)];
+typedef uint8_t Sample_t[SAMPLE_SIZE];
+
+typedef enum
+{
+    FAULT_NONE, FAULT_STUCK_LOW, FAULT_STUCK_HIGH, FAULT_EEPROM, FAULT_WATCHDOG, FAULT_HANG, FAULT_BROWNOUT,
+    FAULTS
+} Fault_t;
+
+static const char *const Fault_Name[FAULTS] =
+{
+    "none", "stuck low", "stuck high", "EEPROM write", "watchdog reset", "watchdog hang", "brown-out",
+};
+
+/* the stimulus and the fault of a trial, in milliseconds from the start */
+typedef struct
+{
+    uint8_t Value[6];                   /* TUNE_RC5_TOLERANCE, TUNE_MOTOR_DEAD and the motor constants */
+    uint32_t Key;
+    SelectSwitch_t Which;
+    uint32_t Move;
+    uint32_t MoveLength;
+    MotorDrive_t Drive;
+    uint32_t Fault;
+    uint32_t Offset;                    /* microseconds into the millisecond */
+    uint32_t Length;                    /* of a stuck line or the supply low */
+    uint8_t Line;
+} Plan_t;
+
+typedef struct
+{
+    uint32_t Trials;
+    uint32_t Safe;
+    uint32_t SafeMax;                   /* microseconds */
+    double SafeSum;
+    uint32_t Restored;
+    uint32_t RestoredMax;
+    double RestoredSum;
+    uint32_t Thumps;
+    uint32_t Torn;                      /* saves torn by a reset or failed */
+    uint32_t Missed;                    /* presses made and let go while down */
+} Result_t;
+
+static State_t Start;
+static size_t Ram_Length;
+static Sample_t Reference[RUN_MS];
+static jmp_buf Jump;
+
+static void State_Save(State_t State)
+{
+    Ram_Length = Sim_RamSave(State);
+    memcpy(State + JOURNAL_STATE_MAX, &Sim_Time, sizeof(uint32_t));
+    Journal_Save(State);
+}
+
+static void State_Load(const State_t State)
+{
+    size_t Index;
+    size_t Length;
+
+    memcpy(&Sim_Time, State + JOURNAL_STATE_MAX, sizeof(uint32_t));
+    for (Index = 0, Length = 0; Index < SIM_RAM_COUNT; Index++)
+    {
+        Sim_RamCopy(Sim_Ram[Index].Address, State + Length, Sim_Ram[Index].Size);
+        Length += Sim_Ram[Index].Size;
+    }
+    for (Index = 0; Index < JOURNAL_SIM_COUNT; Index++)
+    {
+        Sim_RamCopy(Journal_Sim[Index].Address, State + Length, Journal_Sim[Index].Size);
+        Length += Journal_Sim[Index].Size;
+    }
+}
+
+static uint32_t Random(uint32_t Low, uint32_t High)
+{
+    return Low + (uint32_t)rand() % (High - Low + 1);
+}
+
+/* run to End, carrying on after a reset */
+static void Advance_To(uint32_t End)
+{
+    Sim_ResetJump = &Jump;
+    setjmp(Jump);
+    while (Sim_Time < End)
+    {
+        Sim_AdvanceWith(End, Sim_Step);
+    }
+    Sim_ResetJump = NULL;
+}
+
+/* the outputs are safe, see the file description */
+static int Safe(void)
+{
+    int Sources;
+    int Index;
+
+    if (!Sim_Relay[SIM_RELAY_MUTE].Closed)
+    {
+        return 1;
+    }
+    for (Sources = 0, Index = 0; Index < SIM_RELAY_SOURCES; Index++)
+    {
+        if (Sim_RelayBouncing(&Sim_Relay[Index], Sim_Time))
+        {
+            return 0;
+        }
+        Sources += Sim_Relay[Index].Closed;
+    }
+    return Sources <= 1;
+}
+
+static void Sample(Sample_t Out)
+{
+    uint16_t Contacts;
+    uint8_t Index;
+
+    for (Contacts = 0, Index = 0; Index < SIM_RELAYS; Index++)
+    {
+        Contacts |= (uint16_t)Sim_Relay[Index].Closed << Index;
+    }
+    Out[0] = (uint8_t)Contacts;
+    Out[1] = (uint8_t)(Contacts >> 8);
+    Out[2] = App.Panel.PortB;
+    Out[3] = App.Panel.PortC;
+    for (Index = 0; Index < SW_KEYS; Index++)
+    {
+        Out[SAMPLE_PANEL + Index] = SW_Learn[Index] & SW_LEARN_BOUNCE;
+    }
+    memcpy(Out + SAMPLE_PANEL + SW_KEYS, Tune, TUNE_COUNT);
+    memcpy(Out + SAMPLE_PANEL + SW_KEYS + TUNE_COUNT, &MotorConst, sizeof(MotorConst_t));
+}
+
+/* power off long enough for the relays to open and the shaft to stop, and on */
+static void Power_Cycle(void)
+{
+    uint8_t Index;
+
+    for (Index = 0; Index < SIM_RELAYS; Index++)
+    {
+        Sim_Relay[Index].Coil = Sim_Relay[Index].Closed = 0;
+        Sim_Relay[Index].Click = Sim_Relay[Index].Moved = 0;
+    }
+    Sim_Pot.Speed = 0;
+    Sim_Pot.Driven = Sim_Pot.Stopped = 0;
+    Sim_EEFail = 0;
+    Sim_ResetAt = 0;
+    Sim_EEBusy = 0;
+    Sim_Garbage = 0x5EED;
+    Sim_PowerOn(1);
+}
+
+static void Plan_Make(Plan_t *Plan, Fault_t Fault)
+{
+    uint8_t Index;
+
+    for (Index = 0; Index < 6; Index++)
+    {
+        uint8_t Id = (Index < 2) ? ((Index == 0) ? TUNE_RC5_TOLERANCE : TUNE_MOTOR_DEAD) : TUNE_MOTOR_CONST + Index - 2;
+
+        Plan->Value[Index] = (uint8_t)Random(Tune_Limit[Id].Min, Tune_Limit[Id].Max);
+    }
+    Plan->Key = Random(0, 300);
+    Plan->Which = (SelectSwitch_t)Random(SW_1, SW_REC);
+    Plan->Move = Random(0, 300);
+    Plan->MoveLength = Random(100, 300);
+    Plan->Drive = (rand() & 1) ? MOTOR_UP : MOTOR_DOWN;
+    Plan->Fault = (Fault == FAULT_EEPROM) ? Random(0, 30) : Random(0, 400);
+    Plan->Offset = Random(0, 999);
+    Plan->Length = (Fault == FAULT_BROWNOUT) ? Random(1, 50) : Random(400, 1000);
+    Plan->Line = (uint8_t)Random(0, 3);
+}
+
+/* the stimulus for millisecond Ms of a trial */
+static void Stimulus(const Plan_t *Plan, uint32_t Ms)
+{
+    uint8_t Index;
+
+    if (Ms == 0)
+    {
+        for (Index = 0; Index < 6; Index++)
+        {
+            uint8_t Id = (Index < 2) ? ((Index == 0) ? TUNE_RC5_TOLERANCE : TUNE_MOTOR_DEAD) : TUNE_MOTOR_CONST + Index - 2;
+
+            Sim_Check(Tune_Set(Id, Plan->Value[Index]), "tunable refused");
+        }
+        Tune_Save();
+    }
+    if (Ms == Plan->Key)
+    {
+        Sim_Press(Plan->Which);
+    }
+    else if (Ms == Plan->Key + PRESS_MS)
+    {
+        Sim_Release();
+    }
+    if (Ms == Plan->Move)
+    {
+        Motor_Request(Plan->Drive);
+    }
+    else if (Ms == Plan->Move + Plan->MoveLength)
+    {
+        Motor_Request(MOTOR_STOP);
+    }
+    if (Ms == POWER_MS)
+    {
+        Power_Cycle();
+    }
+}
+
+/*
+ * Run a trial with the fault given, FAULT_NONE to make the
+ * reference, and add its times to Result
+ */
+static void Trial(const Plan_t *Plan, Fault_t Fault, Result_t *Result)
+{
+    uint32_t Base;
+    uint32_t At;
+    uint32_t Ms;
+    uint32_t Muted;                     /* time the (mute) contact opened, 0 for not yet */
+    uint32_t Differs;
+    uint32_t Restart;
+    uint32_t Resets;
+    uint32_t Release;
+    uint8_t Lost;
+    uint32_t Freed;
+    uint32_t Taken;
+    uint16_t Torn;
+    PanelState_t Panel;
+    Sample_t Now;
+    size_t From;
+
+    State_Load(Start);
+    Base = Sim_Time;
+    Sim_RelayClicks = 0;
+    Sim_RelayQuiet = (Fault != FAULT_NONE);
+    Sim_WatchdogReset = (Fault == FAULT_HANG);
+    Torn = Sim_EETorn;
+    At = Base + Plan->Fault * 1000;
+    if ((Fault == FAULT_WATCHDOG) || (Fault == FAULT_BROWNOUT))
+    {
+        At += Plan->Offset;
+        Sim_ResetAt = At;
+        Sim_ResetCause = (Fault == FAULT_WATCHDOG) ? SIM_RESET_WATCHDOG : SIM_RESET_BROWNOUT;
+        Sim_ResetHold = (Fault == FAULT_WATCHDOG) ? 0 : Plan->Length * 1000;
+    }
+    From = (Fault == FAULT_EEPROM) ? SAMPLE_PANEL : 0;
+    Muted = Differs = 0;
+    Lost = 0;
+    Restart = 0;
+    Resets = Sim_Resets;
+    Freed = Taken = 0;
+    Panel = App.Panel;
+
+    for (Ms = 0; Ms < RUN_MS; Ms++)
+    {
+        Stimulus(Plan, Ms);
+        if ((Fault != FAULT_NONE) && (Ms == Plan->Fault))
+        {
+            if (Fault == FAULT_STUCK_LOW)
+            {
+                Sim_PortALow = (uint8_t)(1 << Plan->Line);
+            }
+            else if (Fault == FAULT_STUCK_HIGH)
+            {
+                Sim_PortAHigh = (uint8_t)(1 << Plan->Line);
+            }
+            else if (Fault == FAULT_EEPROM)
+            {
+                Sim_EEFail = 1;
+            }
+            else if (Fault == FAULT_HANG)
+            {
+                PIE1bits.TMR2IE = 0;
+            }
+        }
+        if (((Fault == FAULT_STUCK_LOW) || (Fault == FAULT_STUCK_HIGH)) && (Ms == Plan->Fault + Plan->Length))
+        {
+            Sim_PortALow = Sim_PortAHigh = 0;
+            Sim_Press(SW_1);
+            Freed = Ms;
+            Panel = App.Panel;
+        }
+        else if (Freed && (Ms == Freed + PRESS_MS))
+        {
+            Sim_Release();
+        }
+
+        Advance_To(Base + (Ms + 1) * 1000);
+        if (!Restart && (Sim_Resets != Resets))
+        {
+            Restart = Sim_Time;
+        }
+
+        if (Fault == FAULT_NONE)
+        {
+            Sim_Check(Safe(), "outputs not safe without a fault");
+            Sample(Reference[Ms]);
+            continue;
+        }
+        if (!Muted && (Ms >= Plan->Fault) && !Sim_Relay[SIM_RELAY_MUTE].Closed &&
+            ((Fault == FAULT_WATCHDOG) || (Fault == FAULT_HANG) || (Fault == FAULT_BROWNOUT)))
+        {
+            /* when it parted, a reset may hold for longer, or at the fault when it was open then */
+            Muted = (Sim_Relay[SIM_RELAY_MUTE].Touch > At) ? Sim_Relay[SIM_RELAY_MUTE].Touch : At;
+        }
+        Sample(Now);
+        if (memcmp(Now + From, Reference[Ms] + From, SAMPLE_SIZE - From) != 0)
+        {
+            if (Ms < POWER_MS)
+            {
+                Differs = Base + (Ms + 1) * 1000;
+                Lost = (Ms == POWER_MS - 1);
+            }
+            else if (memcmp(Now + SAMPLE_PANEL, Reference[Ms] + SAMPLE_PANEL, SAMPLE_SIZE - SAMPLE_PANEL) != 0)
+            {
+                /* the constants from data EEPROM after the power cycle */
+                Lost = 1;
+            }
+        }
+        if (Freed && !Taken && (Ms < POWER_MS) &&
+            ((App.Panel.PortB != Panel.PortB) || (App.Panel.PortC != Panel.PortC)))
+        {
+            Taken = Ms + 1;
+        }
+    }
+    Sim_WatchdogReset = 0;
+    Sim_ResetAt = 0;
+    if (Fault == FAULT_NONE)
+    {
+        Sim_Check(Sim_RelayClicks == 0, "thump without a fault");
+        return;
+    }
+
+    Result->Trials++;
+    Result->Thumps += Sim_RelayClicks;
+    Result->Torn += (Sim_EETorn != Torn) || ((Fault == FAULT_EEPROM) && (Sim_EEFail == 0));
+    if (Muted)
+    {
+        Result->Safe++;
+        if (Muted - At > Result->SafeMax)
+        {
+            Result->SafeMax = Muted - At;
+        }
+        Result->SafeSum += Muted - At;
+    }
+    if ((Fault == FAULT_STUCK_LOW) || (Fault == FAULT_STUCK_HIGH))
+    {
+        Sim_Check(Taken != 0, "keys do not work after a stuck line");
+        Differs = Base + Taken * 1000;
+        At = Base + Freed * 1000;
+    }
+    else if (Lost)
+    {
+        /* a press let go before the controller started again is missed */
+        Release = Base + (Plan->Key + PRESS_MS) * 1000;
+        if ((Release > At) && (Release <= Restart))
+        {
+            Result->Missed++;
+            return;
+        }
+        Sim_Check(Fault == FAULT_EEPROM, "state not restored after a reset");
+        return;
+    }
+    Result->Restored++;
+    if (Differs > At)
+    {
+        if (Differs - At > Result->RestoredMax)
+        {
+            Result->RestoredMax = Differs - At;
+        }
+        Result->RestoredSum += Differs - At;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Result_t Result[FAULTS];
+    uint32_t Trials;
+    uint32_t Index;
+    Fault_t Fault;
+    Plan_t Plan;
+
+    Trials = (argc > 1) ? (uint32_t)atol(argv[1]) : TRIALS;
+
+    /* (cd) playing with (mute) off, the constants saved */
+    memset(Sim_EE, 0xFF, sizeof(Sim_EE));
+    Sim_PowerOn(1);
+    Sim_Run(500000);
+    Sim_Press(SW_3);
+    Sim_Run(PRESS_MS * 1000);
+    Sim_Release();
+    Sim_Run(300000);
+    Sim_Press(SW_3);
+    Sim_Run(PRESS_MS * 1000);
+    Sim_Release();
+    Sim_Run(1000000);
+    Sim_Check(Sim_Relay[2].Closed && Sim_Relay[SIM_RELAY_MUTE].Closed, "(cd) not playing");
+    State_Save(Start);
+
+    memset(Result, 0, sizeof(Result));
+    srand(99);
+    for (Index = 0; Index < Trials; Index++)
+    {
+        for (Fault = FAULT_NONE + 1; Fault < FAULTS; Fault++)
+        {
+            Plan_Make(&Plan, Fault);
+            Trial(&Plan, FAULT_NONE, NULL);
+            Trial(&Plan, Fault, &Result[Fault]);
+        }
+    }
+
+    printf("fault_test: %lu trials of each fault, times in milliseconds\n", (unsigned long)Trials);
+    printf("fault_test: %-15s %17s %21s %7s %5s %7s\n", "fault", "to safe mean/max", "restored  mean/max", "thumps",
+           "torn", "missed");
+    for (Fault = FAULT_NONE + 1; Fault < FAULTS; Fault++)
+    {
+        const Result_t *Each = &Result[Fault];
+        char Safe[32];
+
+        if (Each->Safe)
+        {
+            snprintf(Safe, sizeof(Safe), "%8.1f %8.1f", Each->SafeSum / Each->Safe / 1000, Each->SafeMax / 1000.0);
+        }
+        else
+        {
+            snprintf(Safe, sizeof(Safe), "%17s", "-");
+        }
+        printf("fault_test: %-15s %s %4lu/%-4lu %5.1f %5.1f %7lu %5lu %7lu\n", Fault_Name[Fault], Safe,
+               (unsigned long)Each->Restored, (unsigned long)Each->Trials,
+               Each->Restored ? Each->RestoredSum / Each->Restored / 1000 : 0, Each->RestoredMax / 1000.0,
+               (unsigned long)Each->Thumps, (unsigned long)Each->Torn, (unsigned long)Each->Missed);
+    }
+    Sim_Check(Result[FAULT_WATCHDOG].Safe == Result[FAULT_WATCHDOG].Trials, "outputs not safe after a watchdog reset");
+    Sim_Check(Result[FAULT_HANG].Safe == Result[FAULT_HANG].Trials, "outputs not safe after a hang");
+    Sim_Check(Result[FAULT_BROWNOUT].Safe == Result[FAULT_BROWNOUT].Trials, "outputs not safe after a brown-out");
+    Sim_Check(Result[FAULT_WATCHDOG].SafeMax <= SAFE_RESET_US, "outputs not safe soon after a watchdog reset");
+    Sim_Check(Result[FAULT_BROWNOUT].SafeMax <= SAFE_RESET_US, "outputs not safe soon after a brown-out");
+    Sim_Check(Result[FAULT_HANG].SafeMax <= SIM_WDT_SUBTICKS * SIM_SUBTICK_US + SAFE_RESET_US,
+              "outputs not safe soon after the watchdog timeout");
+    return 0;
+}
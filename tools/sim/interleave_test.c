@@ -0,0 +1,591 @@
+/*
+ * File:   interleave_test.c
+ *
+ * Description:
+ *      Interrupts landing between the main loop's accesses to shared
+ *      data. The Makefile builds this with the memory access hooks of
+ *      -fsanitize=thread but without its run time: the hooks are the
+ *      __tsan_ functions below, so every load and store made by the
+ *      firmware calls in here first.
+ *
+ *      A main loop function is run once from a saved state to list
+ *      its accesses to the firmware RAM. It is then run again from
+ *      the same state with the interrupt handler injected at each
+ *      point of that list, once for each interrupt source. On the
+ *      PIC a value wider than a byte is read and written a byte at a
+ *      time, so an interrupt is also injected part way through each
+ *      wider access. Interrupts are not injected while GIE is clear.
+ *
+ *      Partial-order reduction: an interrupt injected before an
+ *      access that does not touch what the interrupt handler reads
+ *      or writes ends in the same state as one injected before the
+ *      next access, so only the points just before, or inside, an
+ *      access that conflicts with the handler are run.
+ *
+ *      Reported:
+ *          torn read     the handler wrote part of a value the main
+ *                        loop was part way through reading
+ *          torn write    the handler read part of a value the main
+ *                        loop was part way through writing
+ *          lost update   the main loop wrote over a byte the handler
+ *                        had just written
+ *
+ *      Special function register bits are set and cleared with one
+ *      instruction on the PIC, so they are not checked for lost
+ *      updates.
+ *
+ *      The passes of the application loop in a few seconds of busy
+ *      stimulus are explored, then Timebase_Now() across a TIMER1
+ *      roll over, then two planted faults that must be found.
+ */
+#define _GNU_SOURCE
+#include "journal.h"
+
+#include <dlfcn.h>
+
+/* the hooks and what raises an interrupt are not hooked themselves */
+#define NO_HOOKS __attribute__((no_sanitize_thread))
+
+#define TRACE_MAX (65536)
+#define FINDINGS_MAX (64)
+
+typedef enum
+{
+    EVENT_EDGE,                 /* IR receiver edge on TIMER0 */
+    EVENT_SUBTICK,              /* TIMER2 */
+    EVENT_OVERFLOW,             /* TIMER1 roll over, then its interrupt */
+    EVENTS
+} Event_t;
+
+static const char *const Event_Name[EVENTS] = {"IR edge", "TIMER2", "TIMER1 overflow"};
+
+typedef struct
+{
+    uint16_t Offset;
+    uint8_t Size;
+    uint8_t Write;
+    void *Pc;
+} Access_t;
+
+typedef struct
+{
+    const char *Kind;
+    const char *Variable;
+    const char *Function;
+    Event_t Event;
+    uint32_t Count;
+} Finding_t;
+
+static size_t Ram_Length;
+static uint8_t Isr_Read[SIM_RAM_MAX];
+static uint8_t Isr_Wrote[SIM_RAM_MAX];
+
+static Access_t Trace[TRACE_MAX];
+static uint32_t Trace_Length;
+static uint32_t Access_Index;
+
+static int Main_Active;
+static int In_Hook;
+static int Recording;
+static uint32_t Inject_At;
+static int Inject_Inside;
+static Event_t Inject_Event;
+static int Injected;
+
+static Finding_t Finding[FINDINGS_MAX];
+static int Findings;
+static uint32_t Runs;
+
+/* offset of a byte of firmware RAM in a RAM image, -1 when it is not */
+static long Ram_Offset(const volatile void *Address)
+{
+    size_t Index;
+    size_t Length;
+
+    for (Index = 0, Length = 0; Index < SIM_RAM_COUNT; Index++)
+    {
+        const volatile uint8_t *Start = Sim_Ram[Index].Address;
+
+        if (((const volatile uint8_t *)Address >= Start) &&
+            ((const volatile uint8_t *)Address < Start + Sim_Ram[Index].Size))
+        {
+            return (long)(Length + ((const volatile uint8_t *)Address - Start));
+        }
+        Length += Sim_Ram[Index].Size;
+    }
+    return -1;
+}
+
+static const Sim_Ram_t *Ram_Entry(size_t Offset)
+{
+    size_t Index;
+
+    for (Index = 0; Index < SIM_RAM_COUNT; Index++)
+    {
+        if (Offset < Sim_Ram[Index].Size)
+        {
+            return &Sim_Ram[Index];
+        }
+        Offset -= Sim_Ram[Index].Size;
+    }
+    return NULL;
+}
+
+static void Report(const char *Kind, const Access_t *Access)
+{
+    Dl_info Info;
+    const char *Function;
+    int Index;
+
+    Function = "?";
+    if (dladdr(Access->Pc, &Info) && Info.dli_sname)
+    {
+        Function = Info.dli_sname;
+    }
+    for (Index = 0; Index < Findings; Index++)
+    {
+        if ((Finding[Index].Kind == Kind) && (Finding[Index].Event == Inject_Event) &&
+            (strcmp(Finding[Index].Variable, Ram_Entry(Access->Offset)->Name) == 0) &&
+            (strcmp(Finding[Index].Function, Function) == 0))
+        {
+            Finding[Index].Count++;
+            return;
+        }
+    }
+    Sim_Check(Findings < FINDINGS_MAX, "too many findings");
+    Finding[Findings].Kind = Kind;
+    Finding[Findings].Variable = Ram_Entry(Access->Offset)->Name;
+    Finding[Findings].Function = Function;
+    Finding[Findings].Event = Inject_Event;
+    Finding[Findings].Count = 1;
+    Findings++;
+}
+
+/* raise the interrupt and run the handler, with its accesses marked */
+NO_HOOKS static void Interrupt(Event_t Event)
+{
+    uint16_t Timer;
+
+    In_Hook = 0;
+    switch (Event)
+    {
+        case EVENT_EDGE:
+            INTCONbits.TMR0IF = 1;
+            break;
+        case EVENT_SUBTICK:
+            PIR1bits.TMR2IF = 1;
+            break;
+        default:
+            Timer = ((uint16_t)TMR1H << 8) | TMR1L;
+            if (Timer < 0xFF00)
+            {
+                Timer = 0xFF00;
+            }
+            Timer += 0x100;
+            TMR1H = (uint8_t)(Timer >> 8);
+            TMR1L = (uint8_t)Timer;
+            PIR1bits.TMR1IF = 1;
+            break;
+    }
+    ISR();
+    In_Hook = 1;
+}
+
+NO_HOOKS static void Access(const volatile void *Address, size_t Size, int Write, void *Pc)
+{
+    Access_t This;
+    long Offset;
+    size_t Byte;
+
+    /* the handler run by the simulator while the main loop waits */
+    if (!Main_Active || In_Hook || ((Main_Active > 0) && Sim_InInterrupt))
+    {
+        return;
+    }
+    In_Hook = 1;
+    Offset = Ram_Offset(Address);
+    if (Offset < 0)
+    {
+        In_Hook = 0;
+        return;
+    }
+    if (Main_Active < 0)
+    {
+        /* in the interrupt handler */
+        for (Byte = 0; (Byte < Size) && (Offset + Byte < Ram_Length); Byte++)
+        {
+            if (Write)
+            {
+                Isr_Wrote[Offset + Byte] = 1;
+            }
+            else
+            {
+                Isr_Read[Offset + Byte] = 1;
+            }
+        }
+        In_Hook = 0;
+        return;
+    }
+
+    This.Offset = (uint16_t)Offset;
+    This.Size = (uint8_t)((Offset + Size <= Ram_Length) ? Size : Ram_Length - Offset);
+    This.Write = (uint8_t)Write;
+    This.Pc = Pc;
+    if (Recording && (Trace_Length < TRACE_MAX))
+    {
+        Trace[Trace_Length++] = This;
+    }
+    if (!Injected && (Access_Index == Inject_At) && INTCONbits.GIE)
+    {
+        Injected = 1;
+        memset(Isr_Read, 0, sizeof(Isr_Read));
+        memset(Isr_Wrote, 0, sizeof(Isr_Wrote));
+        Main_Active = -1;
+        Interrupt(Inject_Event);
+        Main_Active = 1;
+        for (Byte = 0; Byte < This.Size; Byte++)
+        {
+            if (Inject_Inside && !Write && Isr_Wrote[This.Offset + Byte])
+            {
+                Report("torn read", &This);
+                break;
+            }
+            if (Inject_Inside && Write && Isr_Read[This.Offset + Byte])
+            {
+                Report("torn write", &This);
+                break;
+            }
+            if (!Inject_Inside && Write && Isr_Wrote[This.Offset + Byte] &&
+                (Ram_Entry(This.Offset)->Kind != SIM_RAM_REGISTER))
+            {
+                Report("lost update", &This);
+                break;
+            }
+        }
+    }
+    Access_Index++;
+    In_Hook = 0;
+}
+
+/*
+ * The hooks -fsanitize=thread puts in front of each access
+ */
+NO_HOOKS void __tsan_init(void) {}
+NO_HOOKS void __tsan_func_entry(void *Pc) { (void)Pc; }
+NO_HOOKS void __tsan_func_exit(void) {}
+NO_HOOKS void __tsan_read1(void *A) { Access(A, 1, 0, __builtin_return_address(0)); }
+NO_HOOKS void __tsan_read2(void *A) { Access(A, 2, 0, __builtin_return_address(0)); }
+NO_HOOKS void __tsan_read4(void *A) { Access(A, 4, 0, __builtin_return_address(0)); }
+NO_HOOKS void __tsan_read8(void *A) { Access(A, 8, 0, __builtin_return_address(0)); }
+NO_HOOKS void __tsan_read16(void *A) { Access(A, 16, 0, __builtin_return_address(0)); }
+NO_HOOKS void __tsan_write1(void *A) { Access(A, 1, 1, __builtin_return_address(0)); }
+NO_HOOKS void __tsan_write2(void *A) { Access(A, 2, 1, __builtin_return_address(0)); }
+NO_HOOKS void __tsan_write4(void *A) { Access(A, 4, 1, __builtin_return_address(0)); }
+NO_HOOKS void __tsan_write8(void *A) { Access(A, 8, 1, __builtin_return_address(0)); }
+NO_HOOKS void __tsan_write16(void *A) { Access(A, 16, 1, __builtin_return_address(0)); }
+NO_HOOKS void __tsan_read_range(void *A, unsigned long Size) { Access(A, Size, 0, __builtin_return_address(0)); }
+NO_HOOKS void __tsan_write_range(void *A, unsigned long Size) { Access(A, Size, 1, __builtin_return_address(0)); }
+
+/*
+ * The state of journal.h, the firmware RAM first, and the time, put
+ * back whole before each run. A pass waiting for the data EEPROM
+ * moves the time on.
+ */
+typedef uint8_t State_t[JOURNAL_STATE_MAX + sizeof(uint32_t)];
+
+static void State_Save(State_t State)
+{
+    Ram_Length = Sim_RamSave(State);
+    memcpy(State + JOURNAL_STATE_MAX, &Sim_Time, sizeof(uint32_t));
+    Journal_Save(State);
+}
+
+static void State_Load(const State_t State)
+{
+    size_t Index;
+    size_t Length;
+
+    memcpy(&Sim_Time, State + JOURNAL_STATE_MAX, sizeof(uint32_t));
+    for (Index = 0, Length = 0; Index < SIM_RAM_COUNT; Index++)
+    {
+        Sim_RamCopy(Sim_Ram[Index].Address, State + Length, Sim_Ram[Index].Size);
+        Length += Sim_Ram[Index].Size;
+    }
+    for (Index = 0; Index < JOURNAL_SIM_COUNT; Index++)
+    {
+        Sim_RamCopy(Journal_Sim[Index].Address, State + Length, Journal_Sim[Index].Size);
+        Length += Journal_Sim[Index].Size;
+    }
+}
+
+/*
+ * The variables an interrupt source touches from this state. A whole
+ * variable is marked, the handler may touch another element of it
+ * from a later state.
+ */
+static void Footprint(const State_t State, Event_t Event, uint8_t *Touched, uint8_t *Written)
+{
+    size_t Index;
+    size_t Length;
+
+    State_Load(State);
+    memset(Isr_Read, 0, sizeof(Isr_Read));
+    memset(Isr_Wrote, 0, sizeof(Isr_Wrote));
+    Main_Active = -1;
+    Interrupt(Event);
+    In_Hook = 0;
+    Main_Active = 0;
+    for (Index = 0, Length = 0; Index < SIM_RAM_COUNT; Index++)
+    {
+        size_t Byte;
+        uint8_t Read;
+        uint8_t Wrote;
+
+        for (Read = 0, Wrote = 0, Byte = 0; Byte < Sim_Ram[Index].Size; Byte++)
+        {
+            Read |= Isr_Read[Length + Byte];
+            Wrote |= Isr_Wrote[Length + Byte];
+        }
+        memset(Touched + Length, Read | Wrote, Sim_Ram[Index].Size);
+        memset(Written + Length, Wrote, Sim_Ram[Index].Size);
+        Length += Sim_Ram[Index].Size;
+    }
+}
+
+/*
+ * Explore Function from the present state, one interrupt of each
+ * source at each point that conflicts with it. Returns the number
+ * of runs.
+ */
+static uint32_t Explore(void (*Function)(void))
+{
+    static State_t Start;
+    static uint8_t Touched[SIM_RAM_MAX];
+    static uint8_t Written[SIM_RAM_MAX];
+    static Access_t Base[TRACE_MAX];
+    uint32_t Base_Length;
+    uint32_t Count;
+    uint32_t Index;
+    int Event;
+
+    State_Save(Start);
+    Trace_Length = 0;
+    Access_Index = 0;
+    Inject_At = UINT32_MAX;
+    Injected = 0;
+    Recording = 1;
+    Main_Active = 1;
+    Function();
+    Main_Active = 0;
+    Recording = 0;
+    Base_Length = Trace_Length;
+    memcpy(Base, Trace, Base_Length * sizeof(Access_t));
+
+    Count = 0;
+    for (Event = 0; Event < EVENTS; Event++)
+    {
+        Footprint(Start, (Event_t)Event, Touched, Written);
+        for (Index = 0; Index < Base_Length; Index++)
+        {
+            const Access_t *This = &Base[Index];
+            int Conflict;
+            int Inside;
+            size_t Byte;
+
+            for (Conflict = 0, Byte = 0; Byte < This->Size; Byte++)
+            {
+                Conflict |= This->Write ? Touched[This->Offset + Byte] : Written[This->Offset + Byte];
+            }
+            if (!Conflict)
+            {
+                continue;
+            }
+            for (Inside = 0; Inside <= (This->Size > 1); Inside++)
+            {
+                State_Load(Start);
+                Access_Index = 0;
+                Inject_At = Index;
+                Inject_Inside = Inside;
+                Inject_Event = (Event_t)Event;
+                Injected = 0;
+                Main_Active = 1;
+                Function();
+                Main_Active = 0;
+                Count++;
+            }
+        }
+    }
+    State_Load(Start);
+    Runs += Count;
+    return Count;
+}
+
+/*
+ * Timebase_Now() with TIMER1 rolling over, and its interrupt, at
+ * each point. The result must be the time either before or after.
+ */
+static uint32_t Timebase_Result;
+
+static void Timebase_Call(void)
+{
+    Timebase_Result = Timebase_Now();
+}
+
+static void Timebase_Test(void)
+{
+    uint32_t Before;
+    uint32_t Index;
+    uint32_t Count;
+
+    TMR1H = 0xFF;
+    TMR1L = 0x80;
+    PIR1bits.TMR1IF = 0;
+    Before = ((uint32_t)TMR1_Overflow << 16) | 0xFF80;
+    Count = 0;
+    for (Index = 0; Index < 16; Index++)
+    {
+        static State_t Start;
+
+        State_Save(Start);
+        Access_Index = 0;
+        Inject_At = Index;
+        Inject_Inside = 0;
+        Inject_Event = EVENT_OVERFLOW;
+        Injected = 0;
+        Main_Active = 1;
+        Timebase_Call();
+        Main_Active = 0;
+        if (Injected)
+        {
+            Count++;
+            Sim_Check((Timebase_Result & 0xFFFFFF) == (Before & 0xFFFFFF) ||
+                      (Timebase_Result & 0xFFFFFF) == ((Before + 0x100) & 0xFFFFFF),
+                      "Timebase_Now() torn by a TIMER1 overflow");
+        }
+        State_Load(Start);
+    }
+    Runs += Count;
+    printf("interleave_test: Timebase_Now() with TIMER1 overflowing at each of %u points, whole\n",
+           (unsigned)Count);
+}
+
+/*
+ * Planted faults. Counting overruns from the main loop writes a byte
+ * the handler writes, and reading the slot at the head of the edge
+ * queue reads what the handler writes next.
+ */
+volatile uint16_t Planted_Edge;
+
+void Planted_Overrun(void)
+{
+    IR_EdgeOverrun = IR_EdgeOverrun + 1;
+}
+
+void Planted_Head(void)
+{
+    Planted_Edge = IR_EdgeQueue[IR_EdgeHead];
+}
+
+static int Found(const char *Kind, const char *Variable, const char *Function)
+{
+    int Index;
+
+    for (Index = 0; Index < Findings; Index++)
+    {
+        if ((strcmp(Finding[Index].Kind, Kind) == 0) && (strcmp(Finding[Index].Variable, Variable) == 0) &&
+            (strcmp(Finding[Index].Function, Function) == 0))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void Planted_Test(void)
+{
+    uint8_t Fill;
+
+    /* fill the queue so an edge is counted as an overrun */
+    for (Fill = 0; Fill < IR_EDGE_QUEUE_SIZE - 1; Fill++)
+    {
+        INTCONbits.TMR0IF = 1;
+        ISR();
+    }
+    Explore(Planted_Overrun);
+    IR_EdgeTail = IR_EdgeHead;
+    Explore(Planted_Head);
+    Sim_Check(Found("lost update", "IR_EdgeOverrun", "Planted_Overrun"), "planted lost update not found");
+    Sim_Check(Found("torn read", "IR_EdgeQueue", "Planted_Head"), "planted torn read not found");
+    printf("interleave_test: planted lost update and torn read found\n");
+}
+
+static void Print_Findings(void)
+{
+    int Index;
+
+    for (Index = 0; Index < Findings; Index++)
+    {
+        printf("  %s of %s in %s, by the %s interrupt, %u times\n", Finding[Index].Kind,
+               Finding[Index].Variable, Finding[Index].Function, Event_Name[Finding[Index].Event],
+               (unsigned)Finding[Index].Count);
+    }
+}
+
+/* explore every pass of the loop for Microseconds */
+static uint32_t Passes;
+
+static void Explore_Run(uint32_t Microseconds)
+{
+    uint32_t End;
+
+    End = Sim_Time + Microseconds;
+    while (Sim_Time < End)
+    {
+        Sim_SubTick();
+        if (Tick != App.LastTick)
+        {
+            Explore(App_Pass);
+            Sim_Pass();
+            Passes++;
+        }
+    }
+}
+
+int main(void)
+{
+    uint16_t Frame;
+
+    memset(Sim_EE, 0xFF, sizeof(Sim_EE));
+    Sim_PowerOn(1);
+
+    /* relays settling and the first records written */
+    Explore_Run(300000);
+    /* (cd), then (mute) off, then a held (volume) key */
+    Sim_Press(SW_3);
+    Explore_Run(60000);
+    Sim_Release();
+    Explore_Run(100000);
+    Sim_Press(SW_3);
+    Explore_Run(60000);
+    Sim_Release();
+    Frame = Sim_RC5Frame(RC5_SYSTEM, 16, 0);
+    Sim_RC5(Sim_Time + 1000, Frame, 0, 0);
+    Sim_RC5(Sim_Time + 1000 + 113778, Frame, 0, 0);
+    Explore_Run(400000);
+    /* the tunables menu, a change and a save */
+    Sim_RC5(Sim_Time + 1000, Sim_RC5Frame(RC5_SYSTEM, 15, 1), 0, 0);
+    Explore_Run(100000);
+    Sim_RC5(Sim_Time + 1000, Sim_RC5Frame(RC5_SYSTEM, 16, 0), 0, 0);
+    Explore_Run(100000);
+    Sim_RC5(Sim_Time + 1000, Sim_RC5Frame(RC5_SYSTEM, 13, 1), 0, 0);
+    Explore_Run(200000);
+
+    printf("interleave_test: %u passes of the loop, %u runs with an interrupt injected, %d findings\n",
+           (unsigned)Passes, (unsigned)Runs, Findings);
+    Print_Findings();
+    Sim_Check(Findings == 0, "interrupt interleaving fault in the firmware");
+
+    Timebase_Test();
+    Planted_Test();
+    return 0;
+}
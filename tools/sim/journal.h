@@ -0,0 +1,307 @@
+/*
+ * File:   journal.h
+ *
+ * Target: host (gcc or clang)
+ *
+ * Description:
+ *      Journal of the simulated state for stepping backward. A test
+ *      includes this file in place of sim.h and steps with
+ *      Journal_Step(), directly or through Sim_AdvanceWith().
+ *
+ *      Each step makes a record of the bytes of state it changed,
+ *      with their old and new values, and nothing else, so the
+ *      journal grows with changes and not with time. A run of idle
+ *      ticks skipped by Sim_AdvanceWith() is part of the record of
+ *      the step after it. The records are kept in a ring of
+ *      JOURNAL_SIZE bytes and the oldest are dropped to make room.
+ *
+ *      Journal_Back() undoes the newest record, and
+ *      Journal_BackToPin() undoes records until it has undone the
+ *      last write that changed a port line. Running on from there
+ *      with the same stimulus does the same again.
+ *
+ *      The state is the firmware RAM, the data EEPROM and the
+ *      simulator's own state, up to the IR edges not yet delivered.
+ *      The edges themselves are stimulus and are not journaled.
+ *
+ *      Record layout, the count is at both ends so the ring can be
+ *      walked from either:
+ *          u32 time before the step
+ *          u16 count
+ *          count of: u16 offset, u8 old value, u8 new value
+ *          u16 count
+ */
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "sim.h"
+
+#define JOURNAL_SIZE (1UL << 20)
+#define JOURNAL_STATE_MAX (SIM_RAM_MAX + 1024)
+#define JOURNAL_HEADER (4 + 2)
+#define JOURNAL_TRAILER (2)
+#define JOURNAL_CHANGE (4)
+
+/* the simulator's own state */
+static const struct
+{
+    volatile void *Address;
+    size_t Size;
+} Journal_Sim[] =
+{
+    {Sim_EE, sizeof(Sim_EE)},
+    {Sim_EEWrites, sizeof(Sim_EEWrites)},
+    {&Sim_EEReadBusy, sizeof(Sim_EEReadBusy)},
+    {&Sim_EEBusy, sizeof(Sim_EEBusy)},
+    {&Sim_EEPolled, sizeof(Sim_EEPolled)},
+    {&Sim_EEAddress, sizeof(Sim_EEAddress)},
+    {&Sim_EEData, sizeof(Sim_EEData)},
+    {&Sim_EECON1_Reg, sizeof(Sim_EECON1_Reg)},
+    {&Sim_EEADR_Reg, sizeof(Sim_EEADR_Reg)},
+    {&Sim_EEDATA_Reg, sizeof(Sim_EEDATA_Reg)},
+    {&Sim_IRLevel, sizeof(Sim_IRLevel)},
+    {&Sim_EdgeTail, sizeof(Sim_EdgeTail)},
+    {&Sim_PortAIn, sizeof(Sim_PortAIn)},
+    {&Sim_Watchdog, sizeof(Sim_Watchdog)},
+    {&Sim_Skipped, sizeof(Sim_Skipped)},
+    {Sim_Relay, sizeof(Sim_Relay)},
+    {&Sim_RelayClicks, sizeof(Sim_RelayClicks)},
+    {&Sim_RelayDropouts, sizeof(Sim_RelayDropouts)},
+    {&Sim_Pot, sizeof(Sim_Pot)},
+    {&Sim_PortAHigh, sizeof(Sim_PortAHigh)},
+    {&Sim_PortALow, sizeof(Sim_PortALow)},
+    {&Sim_EEFail, sizeof(Sim_EEFail)},
+    {&Sim_EETorn, sizeof(Sim_EETorn)},
+    {&Sim_ResetAt, sizeof(Sim_ResetAt)},
+    {&Sim_ResetCause, sizeof(Sim_ResetCause)},
+    {&Sim_ResetHold, sizeof(Sim_ResetHold)},
+    {&Sim_Resets, sizeof(Sim_Resets)},
+};
+#define JOURNAL_SIM_COUNT (sizeof(Journal_Sim) / sizeof(Journal_Sim[0]))
+
+static uint8_t Journal_Ring[JOURNAL_SIZE];
+static uint32_t Journal_Head;           /* bytes written, the ring wraps */
+static uint32_t Journal_Tail;           /* start of the oldest record */
+static uint32_t Journal_Records;
+static uint32_t Journal_Dropped;
+static uint8_t Journal_Last[JOURNAL_STATE_MAX];   /* the state after the newest record */
+static uint32_t Journal_Time;
+static size_t Journal_Length;
+
+/* copy the state to Image, returns its length */
+static size_t Journal_Save(uint8_t *Image)
+{
+    size_t Length;
+    size_t Index;
+
+    Length = Sim_RamSave(Image);
+    for (Index = 0; Index < JOURNAL_SIM_COUNT; Index++)
+    {
+        Sim_Check(Length + Journal_Sim[Index].Size <= JOURNAL_STATE_MAX, "journal state image too small");
+        Sim_RamCopy(Image + Length, Journal_Sim[Index].Address, Journal_Sim[Index].Size);
+        Length += Journal_Sim[Index].Size;
+    }
+    return Length;
+}
+
+/* put one byte of the state back */
+static void Journal_Restore(size_t Offset, uint8_t Value)
+{
+    size_t Index;
+
+    for (Index = 0; Index < SIM_RAM_COUNT; Index++)
+    {
+        if (Offset < Sim_Ram[Index].Size)
+        {
+            ((volatile uint8_t *)Sim_Ram[Index].Address)[Offset] = Value;
+            return;
+        }
+        Offset -= Sim_Ram[Index].Size;
+    }
+    for (Index = 0; Index < JOURNAL_SIM_COUNT; Index++)
+    {
+        if (Offset < Journal_Sim[Index].Size)
+        {
+            ((volatile uint8_t *)Journal_Sim[Index].Address)[Offset] = Value;
+            return;
+        }
+        Offset -= Journal_Sim[Index].Size;
+    }
+    Sim_Fail("journal offset out of range");
+}
+
+static uint8_t Journal_Byte(uint32_t Position)
+{
+    return Journal_Ring[Position % JOURNAL_SIZE];
+}
+
+static uint32_t Journal_Read(uint32_t Position, int Bytes)
+{
+    uint32_t Value;
+    int Index;
+
+    for (Value = 0, Index = 0; Index < Bytes; Index++)
+    {
+        Value |= (uint32_t)Journal_Byte(Position + Index) << (8 * Index);
+    }
+    return Value;
+}
+
+static void Journal_Write(uint32_t Value, int Bytes)
+{
+    while (Bytes--)
+    {
+        Journal_Ring[Journal_Head++ % JOURNAL_SIZE] = (uint8_t)Value;
+        Value >>= 8;
+    }
+}
+
+/* bytes in use */
+static uint32_t Journal_Used(void)
+{
+    return Journal_Head - Journal_Tail;
+}
+
+/*
+ * Start the journal from the present state, dropping any records
+ */
+void Journal_Start(void)
+{
+    Journal_Head = 0;
+    Journal_Tail = 0;
+    Journal_Records = 0;
+    Journal_Dropped = 0;
+    Journal_Length = Journal_Save(Journal_Last);
+    Journal_Time = Sim_Time;
+}
+
+/*
+ * One sub-tick with Sim_Step(), journaling what it changed
+ */
+void Journal_Step(void)
+{
+    static uint8_t Now[JOURNAL_STATE_MAX];
+    uint32_t Length;
+    uint16_t Count;
+    size_t Offset;
+
+    Sim_Step();
+    Sim_Check(Journal_Save(Now) == Journal_Length, "journal started before the state was known");
+
+    for (Count = 0, Offset = 0; Offset < Journal_Length; Offset++)
+    {
+        Count += Now[Offset] != Journal_Last[Offset];
+    }
+    Length = JOURNAL_HEADER + Count * JOURNAL_CHANGE + JOURNAL_TRAILER;
+    Sim_Check(Length <= JOURNAL_SIZE, "journal record larger than the journal");
+    while (Journal_Used() + Length > JOURNAL_SIZE)
+    {
+        Journal_Tail += JOURNAL_HEADER + Journal_Read(Journal_Tail + 4, 2) * JOURNAL_CHANGE + JOURNAL_TRAILER;
+        Journal_Records--;
+        Journal_Dropped++;
+    }
+
+    Journal_Write(Journal_Time, 4);
+    Journal_Write(Count, 2);
+    for (Offset = 0; Offset < Journal_Length; Offset++)
+    {
+        if (Now[Offset] != Journal_Last[Offset])
+        {
+            Journal_Write(Offset, 2);
+            Journal_Write(Journal_Last[Offset], 1);
+            Journal_Write(Now[Offset], 1);
+            Journal_Last[Offset] = Now[Offset];
+        }
+    }
+    Journal_Write(Count, 2);
+    Journal_Records++;
+    Journal_Time = Sim_Time;
+}
+
+/*
+ * Undo the newest record. Anything changed since it, by a skip or by
+ * the test, is undone first. Returns 0 when there is no record left.
+ */
+int Journal_Back(void)
+{
+    static uint8_t Now[JOURNAL_STATE_MAX];
+    uint32_t Start;
+    uint16_t Count;
+    size_t Offset;
+
+    Journal_Save(Now);
+    for (Offset = 0; Offset < Journal_Length; Offset++)
+    {
+        if (Now[Offset] != Journal_Last[Offset])
+        {
+            Journal_Restore(Offset, Journal_Last[Offset]);
+        }
+    }
+    Sim_Time = Journal_Time;
+    if (!Journal_Records)
+    {
+        return 0;
+    }
+
+    Count = Journal_Read(Journal_Head - JOURNAL_TRAILER, 2);
+    Start = Journal_Head - (JOURNAL_HEADER + Count * JOURNAL_CHANGE + JOURNAL_TRAILER);
+    for (Offset = 0; Offset < Count; Offset++)
+    {
+        uint32_t Change;
+        uint16_t At;
+
+        Change = Start + JOURNAL_HEADER + Offset * JOURNAL_CHANGE;
+        At = Journal_Read(Change, 2);
+        Journal_Last[At] = Journal_Byte(Change + 2);
+        Journal_Restore(At, Journal_Last[At]);
+    }
+    Journal_Time = Journal_Read(Start, 4);
+    Sim_Time = Journal_Time;
+    Journal_Head = Start;
+    Journal_Records--;
+    return 1;
+}
+
+/*
+ * Undo records up to and including the newest that changed a port
+ * line, RB0-RB7 as 0-7 or RC0-RC7 as 8-15, leaving the state as it
+ * was before that write. Returns 0 when no record in the journal
+ * changed it, with every record undone.
+ */
+int Journal_BackToPin(uint8_t Pin)
+{
+    size_t Offset;
+    uint8_t Mask;
+
+    Offset = Sim_RamOffset((Pin & 8) ? &PORTC : &PORTB);
+    Mask = 1 << (Pin & 7);
+    while (Journal_Records)
+    {
+        uint32_t Start;
+        uint16_t Count;
+        uint16_t Index;
+        int Found;
+
+        Count = Journal_Read(Journal_Head - JOURNAL_TRAILER, 2);
+        Start = Journal_Head - (JOURNAL_HEADER + Count * JOURNAL_CHANGE + JOURNAL_TRAILER);
+        for (Found = 0, Index = 0; Index < Count; Index++)
+        {
+            uint32_t Change;
+
+            Change = Start + JOURNAL_HEADER + Index * JOURNAL_CHANGE;
+            if ((Journal_Read(Change, 2) == Offset) &&
+                ((Journal_Byte(Change + 2) ^ Journal_Byte(Change + 3)) & Mask))
+            {
+                Found = 1;
+            }
+        }
+        Journal_Back();
+        if (Found)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#endif /* JOURNAL_H */
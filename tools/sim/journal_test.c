@@ -0,0 +1,137 @@
+/*
+ * File:   journal_test.c
+ *
+ * Description:
+ *      Stepping backward with the journal. The panel is driven
+ *      forward with the journal kept, then stepped back to saved
+ *      points, which must match bit for bit, and run back to the
+ *      last write of a relay line, which must be made again at the
+ *      same time when run forward.
+ */
+#include "journal.h"
+
+#define POINTS (128)
+
+static struct
+{
+    uint32_t Time;
+    uint8_t State[JOURNAL_STATE_MAX];
+} Point[POINTS];
+static int Points;
+
+static void Run(uint32_t Microseconds)
+{
+    uint32_t End;
+
+    End = Sim_Time + Microseconds;
+    while (Sim_Time < End)
+    {
+        Sim_AdvanceWith(End, Journal_Step);
+    }
+}
+
+/* one step, then keep the state to come back to */
+static void Save_Point(void)
+{
+    Journal_Step();
+    Sim_Check(Points < POINTS, "too many points");
+    Point[Points].Time = Sim_Time;
+    Journal_Save(Point[Points].State);
+    Points++;
+}
+
+/* run with a point every Every */
+static void Run_Points(uint32_t Microseconds, uint32_t Every)
+{
+    uint32_t End;
+
+    End = Sim_Time + Microseconds;
+    while (Sim_Time < End)
+    {
+        Run(Every);
+        Save_Point();
+    }
+}
+
+/*
+ * Select (tuner) and run until RB4 is driven, then undo it with
+ * Journal_BackToPin() and run forward again to the same write.
+ */
+static void Pin_Test(void)
+{
+    uint32_t Written;
+
+    Sim_Press(SW_5);
+    while (!(PORTB & (1 << 4)))
+    {
+        Journal_Step();
+    }
+    Written = Sim_Time;
+    Sim_Release();
+    Run(500000);
+    Sim_Check(PORTB & (1 << 4), "(tuner) relay not held");
+
+    Sim_Check(Journal_BackToPin(4), "no write of RB4 in the journal");
+    Sim_Check(!(PORTB & (1 << 4)) && (Sim_Time < Written), "not before the write of RB4");
+    while (!(PORTB & (1 << 4)))
+    {
+        Journal_Step();
+    }
+    Sim_Check(Sim_Time == Written, "RB4 written at another time when run again");
+    printf("journal_test: back to the last write of RB4 at %lu us and forward to it again\n",
+           (unsigned long)Written);
+}
+
+/* step back to each saved point, newest first */
+static void Back_Test(void)
+{
+    static uint8_t State[JOURNAL_STATE_MAX];
+    int Index;
+
+    for (Index = Points - 1; Index >= 0; Index--)
+    {
+        while (Sim_Time > Point[Index].Time)
+        {
+            Sim_Check(Journal_Back(), "journal ran out before a saved point");
+        }
+        Sim_Check(Sim_Time == Point[Index].Time, "stepped back past a saved point");
+        Journal_Save(State);
+        Sim_Check(memcmp(State, Point[Index].State, Journal_Length) == 0,
+                  "state stepped back to differs from the state saved");
+    }
+    printf("journal_test: back through %d saved points, each the same as saved\n", Points);
+}
+
+int main(void)
+{
+    uint32_t Written;
+
+    memset(Sim_EE, 0xFF, sizeof(Sim_EE));
+    Sim_PowerOn(1);
+    Journal_Start();
+
+    /* power on, (cd), (mute) off, volume up, then idle */
+    Run_Points(3000000, 100000);
+    Sim_Press(SW_3);
+    Run_Points(60000, 5000);
+    Sim_Release();
+    Run_Points(300000, 20000);
+    Sim_Press(SW_3);
+    Run_Points(60000, 5000);
+    Sim_Release();
+    Sim_RC5(Sim_Time + 1000, Sim_RC5Frame(RC5_SYSTEM, 16, 0), 0, 0);
+    Run_Points(500000, 25000);
+
+    Written = Journal_Head;
+    Run(10000000);
+    printf("journal_test: %lu bytes in %lu records, %lu bytes for 10 s idle\n",
+           (unsigned long)Journal_Used(), (unsigned long)Journal_Records,
+           (unsigned long)(Journal_Head - Written));
+    Sim_Check(Journal_Head - Written < 65536, "journal grows with idle time");
+    Sim_Check(Journal_Dropped == 0, "records dropped");
+    Save_Point();
+
+    Back_Test();
+    Pin_Test();
+    return 0;
+}
@@ -0,0 +1,640 @@
+/*
+ * File:   motor_fit.c
+ *
+ * Description:
+ *      Fits the volume motor constants of a unit to a trace of its
+ *      motor drive lines and the pot positions measured between the
+ *      moves, and writes them as a data EEPROM image in the record
+ *      format Motor_Init() reads: tag, data and CRC at EE_MOTOR_CONST.
+ *
+ *      Usage: motor_fit trace [image.hex]
+ *             motor_fit -m <seed>
+ *             motor_fit
+ *
+ *      The first form fits a trace and writes the image, the second
+ *      writes the trace of a modelled unit to stdout, and the third
+ *      checks the fit on modelled units.
+ *
+ * Traces:
+ *      One event a line, a '#' starts a comment. Each starts with the
+ *      time in milliseconds:
+ *
+ *          <ms> up | down | stop       the drive on (VOL+) or (VOL-),
+ *                                      or off
+ *          <ms> C <delta>              an entry of the DEBUG_TRACE
+ *                                      journal, the exclusive-or of
+ *                                      PORTC in hex. RC6 is (VOL+) and
+ *                                      RC5 (VOL-), the rest is ignored
+ *          <ms> pot <share>            the pot measured, as a share of
+ *                                      its travel from the bottom end
+ *                                      stop, 0 to 1
+ *
+ *      Measure the pot after each move has coasted to a stop, and
+ *      make some of the moves taps shorter than the spin-up, or the
+ *      spin-up and the coast cannot be told apart. Keep clear of the
+ *      end stops: the moves between two
+ *      measurements that are at least END_MARGIN from the ends and
+ *      have one drive between them are fitted, the rest are not.
+ *
+ * Fit:
+ *      The firmware's model of a drive of D ticks moves the shaft
+ *
+ *          Rate / 16 * (D - SpinUp) + Coast
+ *
+ *      ticks of travel at the nominal speed, the travel taken as
+ *      VOLUME_TRAVEL, with the rate of the direction and nothing
+ *      before SpinUp. For each SpinUp from 0 to MOTOR_DELAY_MAX the
+ *      up rate, the down rate and the coast are fitted by least
+ *      squares to the moves, and the SpinUp with the least squared
+ *      error is taken. A constant outside the limits Motor_Init()
+ *      checks is held at the limit and reported.
+ *
+ *      The image is Intel HEX with the data EEPROM at 0x4200, a word
+ *      to each byte, as MPLAB writes it. It holds the motor record
+ *      and leaves the rest erased, so the firmware writes the other
+ *      records with their defaults at the next power on.
+ *
+ * Check:
+ *      Units are drawn as pot_test draws them. Each is moved as -m
+ *      moves it, the trace fitted, and the image loaded into the
+ *      simulator's data EEPROM for Motor_Init() to read. The error
+ *      of the volume estimate over another set of moves must then be
+ *      less than with the default constants, and the 95th percentile
+ *      within FIT_ERROR of the travel.
+ */
+#include "sim.h"
+
+#define FIT_MOVES (40)
+#define CHECK_UNITS (20)
+#define CHECK_MOVES (12)
+#define END_MARGIN (0.02)
+#define POT_NOISE (0.002)               /* of the travel, a measurement */
+#define FIT_ERROR (1.5)                 /* percent of the travel */
+#define EVENTS (1000)
+#define IMAGE_ADDRESS (0x4200)
+
+typedef struct
+{
+    uint32_t Time;                      /* milliseconds */
+    MotorDrive_t Drive;                 /* MOTOR_STOP for a measurement */
+    double Pot;                         /* share of the travel, or below 0 for a drive */
+} Event_t;
+
+typedef struct
+{
+    MotorDrive_t Drive;
+    double Ticks;
+    double Travel;                      /* ticks of travel, signed */
+} Move_t;
+
+static Event_t Events[EVENTS];
+static uint32_t Event_Count;
+static Move_t Moves[EVENTS];
+static uint32_t Move_Count;
+static double *Error;
+static uint32_t Errors;
+
+static double Random(double Low, double High)
+{
+    return Low + (High - Low) * rand() / RAND_MAX;
+}
+
+/* read a trace, returns zero when it cannot be read */
+static int Trace_Read(FILE *File)
+{
+    char Line[256];
+    char Word[16];
+    unsigned long Time;
+    unsigned Delta;
+    double Share;
+    uint8_t Lines;
+    char *Text;
+
+    Event_Count = 0;
+    Lines = 0;
+    while (fgets(Line, sizeof(Line), File) && (Event_Count < EVENTS))
+    {
+        Event_t *Event = &Events[Event_Count];
+
+        if ((Text = strchr(Line, '#')) != NULL)
+        {
+            *Text = 0;
+        }
+        if (sscanf(Line, "%lu %15s", &Time, Word) != 2)
+        {
+            continue;
+        }
+        Event->Time = (uint32_t)Time;
+        Event->Pot = -1;
+        if (strcmp(Word, "pot") == 0)
+        {
+            if ((sscanf(Line, "%*u %*s %lf", &Share) != 1) || (Share < 0) || (Share > 1))
+            {
+                return 0;
+            }
+            Event->Drive = MOTOR_STOP;
+            Event->Pot = Share;
+        }
+        else if (strcmp(Word, "C") == 0)
+        {
+            if (sscanf(Line, "%*u %*s %x", &Delta) != 1)
+            {
+                return 0;
+            }
+            Lines ^= (uint8_t)Delta & (MOTOR_A_MASK | MOTOR_B_MASK);
+            Event->Drive = (Lines & MOTOR_A_MASK) ? MOTOR_UP : (Lines & MOTOR_B_MASK) ? MOTOR_DOWN : MOTOR_STOP;
+        }
+        else
+        {
+            Event->Drive = (strcmp(Word, "up") == 0) ? MOTOR_UP : (strcmp(Word, "down") == 0) ? MOTOR_DOWN : MOTOR_STOP;
+            if ((Event->Drive == MOTOR_STOP) && (strcmp(Word, "stop") != 0))
+            {
+                return 0;
+            }
+        }
+        Event_Count++;
+    }
+    return Event_Count != 0;
+}
+
+/* the moves with one drive between two measurements clear of the ends */
+static void Moves_Find(void)
+{
+    uint32_t Index;
+    int Last;                           /* the last measurement, or -1 */
+    int Drives;
+    uint32_t Start;
+    MotorDrive_t Drive;
+    MotorDrive_t Driving;
+    double Ticks;
+
+    Move_Count = 0;
+    Last = -1;
+    Drives = 0;
+    Ticks = 0;
+    Start = 0;
+    Drive = Driving = MOTOR_STOP;
+    for (Index = 0; Index < Event_Count; Index++)
+    {
+        const Event_t *Event = &Events[Index];
+
+        if (Event->Pot < 0)
+        {
+            if (Driving != MOTOR_STOP)
+            {
+                Ticks += Event->Time - Start;
+            }
+            if ((Event->Drive != MOTOR_STOP) && (Event->Drive != Driving))
+            {
+                Drive = Event->Drive;
+                Drives++;
+            }
+            Driving = Event->Drive;
+            Start = Event->Time;
+            continue;
+        }
+        if ((Last >= 0) && (Drives == 1) && (Driving == MOTOR_STOP) &&
+            (Events[Last].Pot >= END_MARGIN) && (Events[Last].Pot <= 1 - END_MARGIN) &&
+            (Event->Pot >= END_MARGIN) && (Event->Pot <= 1 - END_MARGIN))
+        {
+            Moves[Move_Count].Drive = Drive;
+            Moves[Move_Count].Ticks = Ticks;
+            Moves[Move_Count].Travel = (Event->Pot - Events[Last].Pot) * VOLUME_TRAVEL;
+            Move_Count++;
+        }
+        Last = (int)Index;
+        Drives = 0;
+        Ticks = 0;
+    }
+}
+
+/*
+ * The least squares rates and coast for a spin-up, returns the sum
+ * of the squared errors
+ */
+static double Fit_SpinUp(double SpinUp, double *Up, double *Down, double *Coast)
+{
+    double Normal[3][4];
+    double Row[3];
+    double Sum;
+    uint32_t Index;
+    int Column;
+    int Pivot;
+    int Other;
+
+    memset(Normal, 0, sizeof(Normal));
+    for (Index = 0; Index < Move_Count; Index++)
+    {
+        double Moving;
+        double Travel;
+
+        Moving = (Moves[Index].Ticks > SpinUp) ? Moves[Index].Ticks - SpinUp : 0;
+        Travel = (Moves[Index].Drive == MOTOR_UP) ? Moves[Index].Travel : -Moves[Index].Travel;
+        Row[0] = (Moves[Index].Drive == MOTOR_UP) ? Moving : 0;
+        Row[1] = (Moves[Index].Drive == MOTOR_DOWN) ? Moving : 0;
+        Row[2] = 1;
+        for (Pivot = 0; Pivot < 3; Pivot++)
+        {
+            for (Column = 0; Column < 3; Column++)
+            {
+                Normal[Pivot][Column] += Row[Pivot] * Row[Column];
+            }
+            Normal[Pivot][3] += Row[Pivot] * Travel;
+        }
+    }
+    /* Gauss-Jordan, the normal equations are symmetric and positive */
+    for (Pivot = 0; Pivot < 3; Pivot++)
+    {
+        if (fabs(Normal[Pivot][Pivot]) < 1e-9)
+        {
+            return INFINITY;
+        }
+        for (Other = 0; Other < 3; Other++)
+        {
+            double Factor;
+
+            if (Other == Pivot)
+            {
+                continue;
+            }
+            Factor = Normal[Other][Pivot] / Normal[Pivot][Pivot];
+            for (Column = 0; Column < 4; Column++)
+            {
+                Normal[Other][Column] -= Factor * Normal[Pivot][Column];
+            }
+        }
+    }
+    *Up = Normal[0][3] / Normal[0][0];
+    *Down = Normal[1][3] / Normal[1][1];
+    *Coast = Normal[2][3] / Normal[2][2];
+
+    for (Sum = 0, Index = 0; Index < Move_Count; Index++)
+    {
+        double Moving;
+        double Model;
+
+        Moving = (Moves[Index].Ticks > SpinUp) ? Moves[Index].Ticks - SpinUp : 0;
+        Model = ((Moves[Index].Drive == MOTOR_UP) ? *Up : *Down) * Moving + *Coast;
+        Model = (Moves[Index].Drive == MOTOR_UP) ? Model : -Model;
+        Sum += (Model - Moves[Index].Travel) * (Model - Moves[Index].Travel);
+    }
+    return Sum;
+}
+
+static uint8_t Limit(double Value, uint8_t Low, uint8_t High, const char *Name, int Quiet)
+{
+    if ((Value < Low - 0.5) || (Value > High + 0.5))
+    {
+        if (!Quiet)
+        {
+            printf("motor_fit: %s of %.1f held at %u\n", Name, Value, (Value < Low) ? Low : High);
+        }
+        return (Value < Low) ? Low : High;
+    }
+    return (uint8_t)(Value + 0.5);
+}
+
+/* fit the moves, returns zero when there are too few of each direction */
+static int Fit(MotorConst_t *Const, int Quiet)
+{
+    double Best;
+    double Sum;
+    double Up;
+    double Down;
+    double Coast;
+    uint8_t SpinUp;
+    uint8_t Fitted;
+    uint32_t Index;
+    uint32_t Count[MOTOR_DOWN + 1];
+
+    memset(Count, 0, sizeof(Count));
+    for (Index = 0; Index < Move_Count; Index++)
+    {
+        Count[Moves[Index].Drive]++;
+    }
+    if ((Count[MOTOR_UP] < 2) || (Count[MOTOR_DOWN] < 2) || (Move_Count < 4))
+    {
+        return 0;
+    }
+    Best = INFINITY;
+    Fitted = 0;
+    for (SpinUp = 0; SpinUp <= MOTOR_DELAY_MAX; SpinUp++)
+    {
+        Sum = Fit_SpinUp(SpinUp, &Up, &Down, &Coast);
+        if (Sum < Best)
+        {
+            Best = Sum;
+            Fitted = SpinUp;
+        }
+    }
+    Fit_SpinUp(Fitted, &Up, &Down, &Coast);
+    Const->UpRate = Limit(16 * Up, MOTOR_RATE_MIN, MOTOR_RATE_MAX, "UpRate", Quiet);
+    Const->DownRate = Limit(16 * Down, MOTOR_RATE_MIN, MOTOR_RATE_MAX, "DownRate", Quiet);
+    Const->SpinUp = Fitted;
+    Const->Coast = Limit(Coast, 0, MOTOR_DELAY_MAX, "Coast", Quiet);
+    if (!Quiet)
+    {
+        printf("motor_fit: %lu moves, %lu up and %lu down, error %.2f%% of the travel rms\n",
+               (unsigned long)Move_Count, (unsigned long)Count[MOTOR_UP], (unsigned long)Count[MOTOR_DOWN],
+               100 * sqrt(Best / Move_Count) / VOLUME_TRAVEL);
+        printf("motor_fit: UpRate %u (%.2f), DownRate %u (%.2f), SpinUp %u, Coast %u (%.1f)\n", Const->UpRate,
+               16 * Up, Const->DownRate, 16 * Down, Const->SpinUp, Const->Coast, Coast);
+    }
+    return 1;
+}
+
+/* data EEPROM erased but for the motor record */
+static void Image_Make(uint8_t *Image, const MotorConst_t *Const)
+{
+    const uint8_t *Data = (const uint8_t *)Const;
+    uint8_t Crc;
+    uint8_t Index;
+
+    memset(Image, 0xFF, SIM_EE_SIZE);
+    Image[EE_MOTOR_CONST] = EE_TAG_MOTOR;
+    Crc = CRC8(0, EE_TAG_MOTOR);
+    for (Index = 0; Index < sizeof(MotorConst_t); Index++)
+    {
+        Image[EE_MOTOR_CONST + 1 + Index] = Data[Index];
+        Crc = CRC8(Crc, Data[Index]);
+    }
+    Image[EE_MOTOR_CONST + 1 + sizeof(MotorConst_t)] = Crc;
+}
+
+/* the image as Intel HEX, eight bytes of data EEPROM a line */
+static int Image_Write(const char *Name, const uint8_t *Image)
+{
+    FILE *File;
+    uint8_t Line;
+    uint8_t Index;
+
+    File = fopen(Name, "w");
+    if (File == NULL)
+    {
+        return 0;
+    }
+    for (Line = 0; Line < SIM_EE_SIZE; Line += 8)
+    {
+        uint16_t Address;
+        uint8_t Sum;
+
+        Address = IMAGE_ADDRESS + 2 * Line;
+        fprintf(File, ":10%04X00", Address);
+        Sum = 0x10 + (uint8_t)(Address >> 8) + (uint8_t)Address;
+        for (Index = 0; Index < 8; Index++)
+        {
+            fprintf(File, "%02X00", Image[Line + Index]);
+            Sum += Image[Line + Index];
+        }
+        fprintf(File, "%02X\n", (uint8_t)-Sum);
+    }
+    fprintf(File, ":00000001FF\n");
+    return fclose(File) == 0;
+}
+
+/*
+ * Modelled units
+ */
+static void Make_Unit(Sim_Pot_t *Pot)
+{
+    Sim_Pot_t Nominal = SIM_POT_NOMINAL;
+
+    *Pot = Nominal;
+    Pot->Up = Random(0.8, 1.2);
+    Pot->Down = Pot->Up * Random(0.95, 1.05);
+    Pot->Volts = Random(4.2, 4.8);
+    Pot->Stall = Random(0.8, 1.2);
+    Pot->Slip = Random(0, 0.03);
+    Pot->Static = Random(5000, 25000);
+    Pot->SpinUp = Random(5000, 20000);
+    Pot->Coast = Random(10000, 40000);
+    Pot->Travel = Random(0.98, 1.02) * VOLUME_TRAVEL;
+    Pot->Position = Random(0, 0.1) * Pot->Travel;
+}
+
+static FILE *Trace;
+static uint8_t Trace_Lines;
+
+/* a sub-tick, with each change of the drive lines traced */
+static void Trace_Step(void)
+{
+    uint8_t Lines;
+
+    Sim_Step();
+    Lines = PORTC & (MOTOR_A_MASK | MOTOR_B_MASK);
+    if (Trace && (Lines != Trace_Lines))
+    {
+        fprintf(Trace, "%lu %s\n", (unsigned long)(Sim_Time / 1000),
+                (Lines & MOTOR_A_MASK) ? "up" : (Lines & MOTOR_B_MASK) ? "down" : "stop");
+    }
+    Trace_Lines = Lines;
+}
+
+static void Run(uint32_t Microseconds)
+{
+    uint32_t End;
+
+    End = Sim_Time + Microseconds;
+    while (Sim_Time < End)
+    {
+        Sim_AdvanceWith(End, Trace_Step);
+    }
+}
+
+/* drive for Microseconds, then stop, wait for the shaft to stand and measure it */
+static void Move(MotorDrive_t Drive, uint32_t Microseconds)
+{
+    Motor_Request(Drive);
+    Run(Microseconds);
+    Motor_Request(MOTOR_STOP);
+    do
+    {
+        Run(10000);
+    } while ((App.MotorDrive != MOTOR_STOP) || Sim_PotMoving());
+    Run(200000);
+    if (Trace)
+    {
+        double Share;
+
+        Share = Sim_Pot.Position / Sim_Pot.Travel + Random(-POT_NOISE, POT_NOISE);
+        fprintf(Trace, "%lu pot %.4f\n", (unsigned long)(Sim_Time / 1000), (Share < 0) ? 0 : (Share > 1) ? 1 : Share);
+    }
+}
+
+/* power on a unit with the data EEPROM given, near the bottom end stop */
+static void Start(const Sim_Pot_t *Pot, const uint8_t *Image)
+{
+    Sim_Time = 0;
+    Sim_EdgeHead = Sim_EdgeTail = 0;
+    Sim_Pot = *Pot;
+    memcpy(Sim_EE, Image, SIM_EE_SIZE);
+    Sim_PowerOn(1);
+    App.Volume = VOLUME_MIN + VOLUME_TRAVEL / 10;
+    Trace_Lines = 0;
+}
+
+/* the trace of FIT_MOVES moves of a unit, a third each taps, short moves and holds of seconds */
+static void Model(const Sim_Pot_t *Pot)
+{
+    uint8_t Erased[SIM_EE_SIZE];
+    int Index;
+
+    memset(Erased, 0xFF, sizeof(Erased));
+    Start(Pot, Erased);
+    fprintf(Trace, "# Modelled unit: up %.3f, down %.3f at %.2f V, stall %.2f V, slip %.3f\n", Pot->Up, Pot->Down,
+            Pot->Volts, Pot->Stall, Pot->Slip);
+    fprintf(Trace, "# static %.0f us, spin-up %.0f us, coast %.0f us, travel %.0f\n", Pot->Static, Pot->SpinUp,
+            Pot->Coast, Pot->Travel);
+    Move(MOTOR_DOWN, 6000000);
+    for (Index = 0; Index < FIT_MOVES; Index++)
+    {
+        double Share;
+        MotorDrive_t Drive;
+
+        Share = Sim_Pot.Position / Sim_Pot.Travel;
+        Drive = (Share < 0.3) ? MOTOR_UP : (Share > 0.7) ? MOTOR_DOWN : (rand() & 1) ? MOTOR_UP : MOTOR_DOWN;
+        Move(Drive, (Index % 3 == 0) ? (uint32_t)Random(5000, 60000) :
+                    (Index % 3 == 1) ? (uint32_t)Random(60000, 300000) : (uint32_t)Random(300000, 3000000));
+    }
+}
+
+/* the estimate after CHECK_MOVES moves of a unit, as pot_test moves it */
+static void Check_Unit(const Sim_Pot_t *Pot, const uint8_t *Image)
+{
+    int Index;
+
+    Trace = NULL;
+    Start(Pot, Image);
+    Move(MOTOR_DOWN, 60000000);
+    for (Index = 0; Index < CHECK_MOVES; Index++)
+    {
+        MotorDrive_t Drive;
+
+        Drive = (App.Volume < VOLUME_MIN + VOLUME_TRAVEL / 4) || (rand() & 1) ? MOTOR_UP : MOTOR_DOWN;
+        Move(Drive, (rand() & 1) ? (uint32_t)Random(30000, 300000) : (uint32_t)Random(300000, 3000000));
+        Error[Errors++] = fabs((App.Volume - (double)VOLUME_MIN) - Sim_Pot.Position);
+    }
+}
+
+static int Compare(const void *A, const void *B)
+{
+    double Left = *(const double *)A;
+    double Right = *(const double *)B;
+
+    return (Left > Right) - (Left < Right);
+}
+
+/* the 95th percentile error as a share of the travel */
+static double Report(const char *Constants)
+{
+    double Percentile;
+
+    qsort(Error, Errors, sizeof(double), Compare);
+    Percentile = 100 * Error[Errors * 95 / 100] / VOLUME_TRAVEL;
+    printf("motor_fit: %d units, %s constants, 95%% of %lu moves within %.2f%%, worst %.2f%%\n", CHECK_UNITS, Constants,
+           (unsigned long)Errors, Percentile, 100 * Error[Errors - 1] / VOLUME_TRAVEL);
+    return Percentile;
+}
+
+static void Check(void)
+{
+    static uint8_t Image[CHECK_UNITS][SIM_EE_SIZE];
+    uint8_t Erased[SIM_EE_SIZE];
+    Sim_Pot_t Unit[CHECK_UNITS];
+    double Default;
+    double Fitted;
+    int Index;
+
+    Error = malloc(CHECK_UNITS * CHECK_MOVES * sizeof(double));
+    Sim_Check(Error != NULL, "no room for the errors");
+    srand(88);
+    for (Index = 0; Index < CHECK_UNITS; Index++)
+    {
+        Make_Unit(&Unit[Index]);
+    }
+    for (Index = 0; Index < CHECK_UNITS; Index++)
+    {
+        MotorConst_t Const;
+
+        Trace = tmpfile();
+        Sim_Check(Trace != NULL, "cannot write the trace");
+        srand(1000 + Index);
+        Model(&Unit[Index]);
+        rewind(Trace);
+        Sim_Check(Trace_Read(Trace), "cannot read the trace back");
+        fclose(Trace);
+        Moves_Find();
+        Sim_Check(Fit(&Const, 1), "too few moves to fit");
+        Image_Make(Image[Index], &Const);
+    }
+
+    memset(Erased, 0xFF, sizeof(Erased));
+    for (Errors = 0, Index = 0; Index < CHECK_UNITS; Index++)
+    {
+        srand(Index);
+        Check_Unit(&Unit[Index], Erased);
+    }
+    Default = Report("default");
+    for (Errors = 0, Index = 0; Index < CHECK_UNITS; Index++)
+    {
+        srand(Index);
+        Check_Unit(&Unit[Index], Image[Index]);
+        Sim_Check(memcmp(Sim_EE, Image[Index], EE_MOTOR_CONST + sizeof(MotorConst_t) + 2) == 0,
+                  "the firmware rewrote the fitted record");
+    }
+    Fitted = Report("fitted");
+    Sim_Check(Fitted < Default, "fitted constants no better than the defaults");
+    Sim_Check(Fitted < FIT_ERROR, "fitted constants out by more than FIT_ERROR");
+}
+
+int main(int argc, char *argv[])
+{
+    MotorConst_t Const;
+    uint8_t Image[SIM_EE_SIZE];
+
+    /* the relays and the motor drive switch together at power on */
+    Sim_RelayQuiet = 1;
+    if (argc == 1)
+    {
+        Check();
+        return 0;
+    }
+    if ((argc == 3) && (strcmp(argv[1], "-m") == 0))
+    {
+        Sim_Pot_t Unit;
+
+        srand((unsigned)atoi(argv[2]));
+        Make_Unit(&Unit);
+        Trace = stdout;
+        Model(&Unit);
+        return 0;
+    }
+    if (argc > 3)
+    {
+        fprintf(stderr, "usage: motor_fit trace [image.hex]\n"
+                        "       motor_fit -m <seed>\n"
+                        "       motor_fit\n");
+        return 2;
+    }
+    Trace = fopen(argv[1], "r");
+    if ((Trace == NULL) || !Trace_Read(Trace))
+    {
+        fprintf(stderr, "motor_fit: cannot read %s\n", argv[1]);
+        return 2;
+    }
+    fclose(Trace);
+    Trace = NULL;
+    Moves_Find();
+    if (!Fit(&Const, 0))
+    {
+        fprintf(stderr, "motor_fit: %s has too few moves clear of the end stops in each direction\n", argv[1]);
+        return 1;
+    }
+    Image_Make(Image, &Const);
+    if ((argc == 3) && !Image_Write(argv[2], Image))
+    {
+        fprintf(stderr, "motor_fit: cannot write %s\n", argv[2]);
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * File:   motor_test.c
+ *
+ * Description:
+ *      Volume motor drive and position estimate. The motor is driven
+ *      into both end stops and reversed part way through its travel,
+ *      and the (VOL+) and (VOL-) port lines are checked on every
+ *      sub-tick. Idle ticks are skipped, the lines do not change in
+ *      them. The estimate is compared with the pot model of sim.h,
+ *      a nominal unit.
+ */
+#include "sim.h"
+
+static uint32_t Last_High[2];
+static uint32_t Dead_Min = UINT32_MAX;
+
+/*
+ * One sub-tick, checking the drive lines
+ */
+static void Step(void)
+{
+    int Line;
+
+    Sim_Step();
+    Sim_Check((PORTC & (MOTOR_A_MASK | MOTOR_B_MASK)) != (MOTOR_A_MASK | MOTOR_B_MASK),
+              "VOL+ and VOL- on together");
+    for (Line = 0; Line < 2; Line++)
+    {
+        uint8_t Mask;
+
+        Mask = Line ? MOTOR_B_MASK : MOTOR_A_MASK;
+        if (PORTC & Mask)
+        {
+            /* the other line was last on this long ago */
+            if (Last_High[!Line] && (Sim_Time - Last_High[!Line] < Dead_Min))
+            {
+                Dead_Min = Sim_Time - Last_High[!Line];
+            }
+            Last_High[Line] = Sim_Time;
+        }
+    }
+}
+
+static void Run(uint32_t Microseconds)
+{
+    uint32_t End;
+
+    End = Sim_Time + Microseconds;
+    while (Sim_Time < End)
+    {
+        Sim_AdvanceWith(End, Step);
+    }
+}
+
+int main(void)
+{
+    uint16_t Volume;
+
+    Sim_PowerOn(1);
+    Sim_Check(App.Volume == (VOLUME_MIN + VOLUME_MAX) / 2, "not started at mid travel");
+
+    Motor_Request(MOTOR_UP);
+    Run(30000000);
+    printf("motor_test: up into the end stop, volume %u of %u\n", App.Volume, VOLUME_MAX);
+    Sim_Check(App.Volume == VOLUME_MAX, "estimate not pinned at the top");
+    Sim_Check(!(PORTC & MOTOR_A_MASK), "VOL+ still driven at the end stop");
+    Sim_Check((Sim_Pot.Position == Sim_Pot.Travel) && Sim_Pot.Stopped, "pot not held at the top end stop");
+
+    Motor_Request(MOTOR_DOWN);
+    Run(1000000);
+    Motor_Request(MOTOR_STOP);
+    Run(100000);
+    Volume = App.Volume;
+    printf("motor_test: down for 1s, volume %u, pot at %.0f\n", Volume, Sim_Pot.Position + VOLUME_MIN);
+    Sim_Check(fabs(Volume - VOLUME_MIN - Sim_Pot.Position) < 20, "estimate of 1s of travel out");
+
+    /* reverse part way through the travel */
+    Motor_Request(MOTOR_UP);
+    Run(2000000);
+    Motor_Request(MOTOR_DOWN);
+    Run(2000000);
+    printf("motor_test: reversed, shortest dead time %lu us\n", (unsigned long)Dead_Min);
+    Sim_Check(Dead_Min >= (uint32_t)Tune[TUNE_MOTOR_DEAD] * 1000, "dead time too short");
+
+    Run(30000000);
+    printf("motor_test: down into the end stop, volume %u of %u\n", App.Volume, VOLUME_MIN);
+    Sim_Check(App.Volume == VOLUME_MIN, "estimate not pinned at the bottom");
+    Sim_Check(!(PORTC & MOTOR_B_MASK), "VOL- still driven at the end stop");
+    Sim_Check(Sim_Pot.Position == 0, "pot not at the bottom end stop");
+    return 0;
+}
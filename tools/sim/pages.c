@@ -0,0 +1,239 @@
+/*
+ * File:   pages.c
+ *
+ * Description:
+ *      Reads the XC8 listing of the PIC16F876A build of main.c and
+ *      reports each call or goto in hot code that selects another page
+ *      of program memory, with the cycles it costs. Hot code is the
+ *      functions marked HOT_CODE and the interrupt handler, which the
+ *      PAGE_HOT_CODE build links into page 0, see Hot code placement
+ *      in main.c.
+ *
+ *      Usage: pages listing.lst main.c
+ *
+ *      The listing is read as cycles reads it, see cycles.c. Each
+ *      instruction is decoded from its opcode. A call or goto is a
+ *      page select when the instructions just before it write PCLATH:
+ *      bcf or bsf of bits 3 and 4, clrf, or movlw and movwf. It is
+ *      reported when the page it selects is not the page it is in,
+ *      or when it selects its own page, which costs the same for
+ *      nothing. Its cost is those instructions, and after a call the
+ *      ones just after it that put PCLATH back for the caller.
+ *
+ *      Exits 0 with the report, 2 when the files cannot be read.
+ */
+#define main Cycles_Main
+#include "cycles.c"
+#undef main
+
+#define PCLATH (0x0A)
+
+static const char *Hot[LINES];         /* the hot function the line is in */
+
+/* mark the lines of the HOT_CODE functions and the interrupt handler */
+static int Hot_Find(void)
+{
+    static char Names[LINES / 4][64];
+    const char *Name = NULL;
+    int Count = 0;
+    int Index;
+
+    for (Index = 1; Index < Lines; Index++)
+    {
+        Line_t *L = &Source[Index];
+        char Buffer[LINE_SIZE];
+        int Comment = L->Comment;
+        const char *Code = Line_Code(L, Buffer, &Comment);
+
+        if (!L->Preprocessor && (L->Depth == 0) && !L->Function &&
+            (Starts(Code, "HOT_CODE") || strstr(Code, "__interrupt")) && strchr(Code, '('))
+        {
+            const char *Interrupt = strstr(Code, "__interrupt()");
+            const char *End = strchr(Interrupt ? Interrupt + strlen("__interrupt()") : Code, '(');
+            const char *Start = End;
+
+            while ((Start > Code) && (isalnum((unsigned char)Start[-1]) || (Start[-1] == '_')))
+            {
+                Start--;
+            }
+            snprintf(Names[Count], sizeof(Names[Count]), "%.*s", (int)(End - Start), Start);
+            Name = Names[Count++];
+        }
+        Hot[Index] = Name;
+        if (L->Function && (L->Depth == 1) && (Code[0] == '}'))
+        {
+            Name = NULL;
+        }
+    }
+    return Count;
+}
+
+/* the operand of the call or goto on a listing line, or its address */
+static void Target_Name(const char *Text, unsigned int Target, char *Name, size_t Size)
+{
+    static const char *const Mnemonics[] = {"fcall", "ljmp", "call", "goto"};
+    size_t Index;
+
+    for (Index = 0; Index < sizeof(Mnemonics) / sizeof(Mnemonics[0]); Index++)
+    {
+        const char *Found = strstr(Text, Mnemonics[Index]);
+
+        if (Found && isspace((unsigned char)Found[strlen(Mnemonics[Index])]) &&
+            (sscanf(Found + strlen(Mnemonics[Index]), " %63[^ \t\r\n;]", Name) == 1))
+        {
+            return;
+        }
+    }
+    snprintf(Name, Size, "%04Xh", Target);
+}
+
+typedef struct
+{
+    int Line;                           /* of main.c, 0 when none is pending */
+    int Call;                           /* or a goto */
+    unsigned int Own;                   /* page it is in */
+    unsigned int Page;                  /* page it selects */
+    int Cycles;
+    char Name[64];
+} Select_t;
+
+static unsigned long Found;
+static unsigned long Cycles;
+
+static void Select_Report(Select_t *S)
+{
+    if (S->Line)
+    {
+        printf("pages: main.c:%d %s %s %s, page %u %s %u, %d cycles\n", S->Line, Hot[S->Line],
+               S->Call ? "calls" : "jumps to", S->Name, S->Own, (S->Page == S->Own) ? "selects" : "to",
+               S->Page, S->Cycles);
+        Found++;
+        Cycles += (unsigned long)S->Cycles;
+        S->Line = 0;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *File;
+    char Text[LINE_SIZE];
+    Select_t Pending = {0};
+    int Current = 0;
+    int Functions;
+    unsigned int Select = 0;            /* PCLATH bits 3 and 4 written since the last other instruction */
+    unsigned int Selected = 0;          /* which of them */
+    unsigned int W = 0;
+    int Loaded = 0;                     /* the instruction before was MOVLW */
+    int Setup = 0;
+
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: pages listing.lst main.c\n");
+        return 2;
+    }
+    if (!Source_Read(argv[2]))
+    {
+        fprintf(stderr, "pages: cannot read %s\n", argv[2]);
+        return 2;
+    }
+    Functions = Hot_Find();
+    File = fopen(argv[1], "r");
+    if (File == NULL)
+    {
+        fprintf(stderr, "pages: cannot read %s\n", argv[1]);
+        return 2;
+    }
+    while (fgets(Text, sizeof(Text), File))
+    {
+        const char *Comment;
+        unsigned int Number;
+        unsigned int Address;
+        unsigned int Opcode;
+        unsigned int Own;
+        unsigned int Written = 0;
+        unsigned int Value = 0;
+        int Cost = 1;
+        int Used;
+
+        Comment = strchr(Text, ';');
+        if (Comment && (sscanf(Comment, ";%*[^:]: %u: %n", &Number, &Used) == 1))
+        {
+            size_t Length = strcspn(Comment + 1, ":");
+
+            Current = 0;
+            if ((Length >= 6) && (strncmp(Comment + 1 + Length - 6, "main.c", 6) == 0) &&
+                ((Length == 6) || strchr("/\\", Comment[Length - 6])))
+            {
+                if ((Number >= (unsigned int)Lines) || !Same_Text(Comment + Used, Source[Number].Text))
+                {
+                    fprintf(stderr, "pages: %s is not a listing of this main.c, line %u differs\n", argv[1], Number);
+                    return 2;
+                }
+                Current = (int)Number;
+            }
+            continue;
+        }
+        if ((sscanf(Text, "%*u %4x %4x%n", &Address, &Opcode, &Used) != 2) || (Used <= 0) ||
+            (Text[Used] && !isspace((unsigned char)Text[Used])))
+        {
+            continue;
+        }
+        Own = (Address >> 11) & 0x03;
+
+        if (((Opcode & 0x3800) == 0x1000) && ((Opcode & 0x7F) == PCLATH) &&
+            ((((Opcode >> 7) & 0x07) == 3) || (((Opcode >> 7) & 0x07) == 4)))
+        {
+            /* BCF or BSF PCLATH, 3 or 4 */
+            Written = 1u << ((Opcode >> 7) & 0x07);
+            Value = (Opcode & 0x0400) ? Written : 0;
+        }
+        else if (Opcode == (0x0180 | PCLATH))
+        {
+            /* CLRF PCLATH */
+            Written = 0x18;
+        }
+        else if (Opcode == (0x0080 | PCLATH))
+        {
+            /* MOVWF PCLATH, and the MOVLW before it */
+            Written = 0x18;
+            Value = W & 0x18;
+            Cost += Loaded;
+        }
+        if (Written)
+        {
+            Loaded = 0;
+            if (Pending.Line && Pending.Call && !Selected && ((Value ^ (Own << 3)) & Written) == 0)
+            {
+                /* puts PCLATH back for the caller after the return */
+                Pending.Cycles += Cost;
+                continue;
+            }
+            Select = (Select & ~Written) | Value;
+            Selected |= Written;
+            Setup += Cost;
+            continue;
+        }
+
+        Select_Report(&Pending);
+        if (((Opcode & 0x3000) == 0x2000) && Selected && Current && Hot[Current])
+        {
+            /* CALL or GOTO after a page select */
+            Pending.Line = Current;
+            Pending.Call = !(Opcode & 0x0800);
+            Pending.Own = Own;
+            Pending.Page = (((Own << 3) & ~Selected) | Select) >> 3 & 0x03;
+            Pending.Cycles = Setup;
+            Target_Name(Text, (Pending.Page << 11) | (Opcode & 0x07FF), Pending.Name, sizeof(Pending.Name));
+        }
+        Select = 0;
+        Selected = 0;
+        Setup = 0;
+        Loaded = ((Opcode & 0x3C00) == 0x3000);         /* MOVLW */
+        W = Opcode & 0xFF;
+    }
+    fclose(File);
+    Select_Report(&Pending);
+    printf("pages: %d hot functions, %lu page selects in them, %lu cycles when each runs once\n",
+           Functions, Found, Cycles);
+    return 0;
+}
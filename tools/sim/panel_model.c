@@ -0,0 +1,122 @@
+/*
+ * File:   panel_model.c
+ *
+ * Description:
+ *      Exhaustive check of Panel_Process(). Every front panel state
+ *      reachable from power up is found by breadth first search over
+ *      every switch event, and the properties documented on
+ *      Panel_Process() are checked on each transition.
+ *
+ *      The state each state was first reached from, and the event
+ *      that reached it, are kept so a violation is reported with the
+ *      shortest series of switch events from power up that makes it.
+ */
+#include "sim.h"
+
+#define PANEL_STATES (256 * 256)
+
+static uint8_t Seen[256][256];
+static uint8_t QueueB[PANEL_STATES];
+static uint8_t QueueC[PANEL_STATES];
+static uint16_t Parent[256][256];
+static uint8_t Reached_By[256][256];
+
+static const char *const Event_Name[] =
+{
+    "none", "1", "2", "3", "4", "5", "6", "rec", "mute", "vol_up", "vol_down"
+};
+
+static int Bits(uint8_t Value)
+{
+    int Count;
+
+    for (Count = 0; Value; Value >>= 1)
+    {
+        Count += Value & 1;
+    }
+    return Count;
+}
+
+/*
+ * Print the events from power up to state B, C, oldest first, then
+ * the Last event, which made the violation
+ */
+static void Print_Path(uint8_t B, uint8_t C, int Last)
+{
+    uint8_t Events[PANEL_STATES];
+    uint32_t Count;
+
+    Count = 0;
+    while (B || C)
+    {
+        uint16_t From;
+
+        Events[Count++] = Reached_By[B][C];
+        From = Parent[B][C];
+        B = From >> 8;
+        C = From & 0xFF;
+    }
+    printf("  power up");
+    while (Count)
+    {
+        printf(" -> %s", Event_Name[Events[--Count]]);
+    }
+    printf(" -> %s\n", Event_Name[Last]);
+}
+
+int main(void)
+{
+    uint32_t Head;
+    uint32_t Tail;
+    int Bad;
+
+    Head = 0;
+    Tail = 0;
+    Bad = 0;
+    QueueB[Tail] = 0;
+    QueueC[Tail] = 0;
+    Tail++;
+    Seen[0][0] = 1;
+
+    while (Head < Tail)
+    {
+        uint8_t FromB;
+        uint8_t FromC;
+        int Event;
+
+        FromB = QueueB[Head];
+        FromC = QueueC[Head];
+        Head++;
+        for (Event = SW_none; Event <= SW_VOL_DOWN; Event++)
+        {
+            uint8_t B;
+            uint8_t C;
+
+            App.Panel.PortB = FromB;
+            App.Panel.PortC = FromC;
+            Panel_Process((SelectSwitch_t)Event);
+            B = App.Panel.PortB;
+            C = App.Panel.PortC;
+
+            if ((Bits(B & 0x3F) > 1) || (Bits(C & 0x1F) > 1) ||
+                (!(B & (1<<6)) && (C & 0x1F)) || ((C ^ FromC) & 0x60))
+            {
+                printf("violation %02X %02X -%s-> %02X %02X\n",
+                       FromB, FromC, Event_Name[Event], B, C);
+                Print_Path(FromB, FromC, Event);
+                Bad++;
+            }
+            if (!Seen[B][C])
+            {
+                Seen[B][C] = 1;
+                Parent[B][C] = (FromB << 8) | FromC;
+                Reached_By[B][C] = Event;
+                QueueB[Tail] = B;
+                QueueC[Tail] = C;
+                Tail++;
+            }
+        }
+    }
+    printf("panel_model: %lu reachable states, %d violations\n", (unsigned long)Tail, Bad);
+    return Bad ? 1 : 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * File:   pot_test.c
+ *
+ * Description:
+ *      Accuracy of the volume estimate against the pot model of
+ *      sim.h, across randomised units.
+ *
+ *      Each unit is a pot with its own speeds, motor voltage, clutch
+ *      slip, spin-up, coast and travel, drawn across what the Alps
+ *      pots and the drive circuit allow. The pot is driven into the
+ *      bottom end stop, where the estimate must be exact, then moved
+ *      up and down by random amounts, from a tap of the key to a
+ *      hold of seconds, and the error of the estimate is taken after
+ *      each move has coasted to a stop.
+ *
+ *      The units are run twice, with the firmware's default motor
+ *      constants and with the constants of each unit as a fit of
+ *      its measurements would give them. The error is reported as a
+ *      share of the travel.
+ *
+ *      Usage: pot_test [units]
+ */
+#include "sim.h"
+
+#define UNITS (200)
+#define MOVES (12)
+
+static double *Error;
+static uint32_t Errors;
+
+static double Random(double Low, double High)
+{
+    return Low + (High - Low) * rand() / RAND_MAX;
+}
+
+static void Make_Unit(Sim_Pot_t *Pot)
+{
+    Sim_Pot_t Nominal = SIM_POT_NOMINAL;
+
+    *Pot = Nominal;
+    Pot->Up = Random(0.8, 1.2);
+    Pot->Down = Pot->Up * Random(0.95, 1.05);
+    Pot->Volts = Random(4.2, 4.8);
+    Pot->Stall = Random(0.8, 1.2);
+    Pot->Slip = Random(0, 0.03);
+    Pot->Static = Random(5000, 25000);
+    Pot->SpinUp = Random(5000, 20000);
+    Pot->Coast = Random(10000, 40000);
+    Pot->Travel = Random(0.98, 1.02) * VOLUME_TRAVEL;
+    Pot->Position = Random(0, 0.1) * Pot->Travel;
+}
+
+static uint8_t Limit(double Value, uint8_t Low, uint8_t High)
+{
+    return (Value < Low) ? Low : (Value > High) ? High : (uint8_t)(Value + 0.5);
+}
+
+/* the motor constants of the unit, as a fit would give them */
+static void Fit(const Sim_Pot_t *Pot)
+{
+    double Drive;
+
+    Drive = (1 - Pot->Slip) * (Pot->Volts - Pot->Stall) / (SIM_POT_VOLTS - Pot->Stall);
+    MotorConst.UpRate = Limit(16 * Pot->Up * Drive, MOTOR_RATE_MIN, MOTOR_RATE_MAX);
+    MotorConst.DownRate = Limit(16 * Pot->Down * Drive, MOTOR_RATE_MIN, MOTOR_RATE_MAX);
+    MotorConst.SpinUp = Limit((Pot->Static + Pot->SpinUp) / 1000, 0, MOTOR_DELAY_MAX);
+    MotorConst.Coast = Limit((Pot->Up + Pot->Down) / 2 * Drive * Pot->Coast / 1000, 0, MOTOR_DELAY_MAX);
+}
+
+/* drive for Microseconds, then stop and wait for the shaft to stand */
+static void Move(MotorDrive_t Drive, uint32_t Microseconds)
+{
+    Motor_Request(Drive);
+    Sim_Run(Microseconds);
+    Motor_Request(MOTOR_STOP);
+    do
+    {
+        Sim_Run(10000);
+    } while ((App.MotorDrive != MOTOR_STOP) || Sim_PotMoving());
+    Sim_Run(200000);
+}
+
+static double Estimate_Error(void)
+{
+    return (App.Volume - (double)VOLUME_MIN) - Sim_Pot.Position;
+}
+
+static void Run_Unit(const Sim_Pot_t *Pot, int Fitted)
+{
+    int Index;
+
+    Sim_Time = 0;
+    Sim_EdgeHead = Sim_EdgeTail = 0;
+    Sim_Pot = *Pot;
+    memset(Sim_EE, 0xFF, sizeof(Sim_EE));
+    Sim_PowerOn(1);
+    if (Fitted)
+    {
+        Fit(Pot);
+    }
+
+    /* near the bottom, down into the end stop */
+    App.Volume = VOLUME_MIN + VOLUME_TRAVEL / 10;
+    Move(MOTOR_DOWN, 60000000);
+    Sim_Check((App.Volume == VOLUME_MIN) && (Sim_Pot.Position == 0), "estimate not exact at the end stop");
+
+    for (Index = 0; Index < MOVES; Index++)
+    {
+        MotorDrive_t Drive;
+
+        Drive = (App.Volume < VOLUME_MIN + VOLUME_TRAVEL / 4) || (rand() & 1) ? MOTOR_UP : MOTOR_DOWN;
+        Move(Drive, (rand() & 1) ? (uint32_t)Random(30000, 300000) : (uint32_t)Random(300000, 3000000));
+        Error[Errors++] = fabs(Estimate_Error());
+    }
+}
+
+static int Compare(const void *A, const void *B)
+{
+    double Left = *(const double *)A;
+    double Right = *(const double *)B;
+
+    return (Left > Right) - (Left < Right);
+}
+
+/* the 95th percentile error as a share of the travel */
+static double Report(const char *Constants, int Units)
+{
+    double Sum;
+    double Percentile;
+    uint32_t Index;
+
+    qsort(Error, Errors, sizeof(double), Compare);
+    for (Sum = 0, Index = 0; Index < Errors; Index++)
+    {
+        Sum += Error[Index];
+    }
+    Percentile = 100 * Error[Errors * 95 / 100] / VOLUME_TRAVEL;
+    printf("pot_test: %d units, %s constants, error of %lu moves mean %.2f%%, 95%% within %.2f%%, worst %.2f%%\n",
+           Units, Constants, (unsigned long)Errors, 100 * Sum / Errors / VOLUME_TRAVEL, Percentile,
+           100 * Error[Errors - 1] / VOLUME_TRAVEL);
+    return Percentile;
+}
+
+int main(int argc, char *argv[])
+{
+    Sim_Pot_t *Unit;
+    double Default;
+    double Fitted;
+    int Units;
+    int Index;
+
+    Units = (argc > 1) ? atoi(argv[1]) : UNITS;
+    Unit = malloc(Units * sizeof(Sim_Pot_t));
+    Error = malloc(Units * MOVES * sizeof(double));
+    Sim_Check(Unit && Error && (Units > 0), "no room for the units");
+    srand(87);
+    for (Index = 0; Index < Units; Index++)
+    {
+        Make_Unit(&Unit[Index]);
+    }
+
+    for (Errors = 0, Index = 0; Index < Units; Index++)
+    {
+        srand(Index);
+        Run_Unit(&Unit[Index], 0);
+    }
+    Default = Report("default", Units);
+    for (Errors = 0, Index = 0; Index < Units; Index++)
+    {
+        srand(Index);
+        Run_Unit(&Unit[Index], 1);
+    }
+    Fitted = Report("fitted", Units);
+    Sim_Check(Fitted < Default, "fitted constants no better than the defaults");
+    Sim_Check(Fitted < 1.5, "fitted constants more than 1.5% out");
+    return 0;
+}
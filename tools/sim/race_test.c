@@ -0,0 +1,109 @@
+/*
+ * File:   race_test.c
+ *
+ * Description:
+ *      The IR edge queue under ThreadSanitizer. ISR() runs in a
+ *      thread of its own, taking an edge as fast as it can with a
+ *      TIMER2 sub-tick every fourth edge, while the main thread
+ *      takes them with IR_GetEdge() and decodes them with
+ *      IR_Decode(), as the main loop does.
+ *
+ *      The Makefile builds this with -fsanitize=thread and the
+ *      ISR_SHARED variables of main.c as C11 atomics, which is what
+ *      a one byte access is on the PIC. ThreadSanitizer then reports
+ *      any access to the queue entries, or to anything else, that
+ *      is not ordered by them. A thread is a harder test than an
+ *      interrupt: the two sides really run at once, where an
+ *      interrupt only ever runs between the main loop's accesses.
+ *
+ *      Each edge must arrive once, in order and whole, or be
+ *      counted as dropped by the interrupt handler. The edges are
+ *      numbered by their timestamps, and the handler waits when it
+ *      gets so far ahead that the numbers would wrap.
+ */
+#include "sim.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#define EDGES (200000)
+#define AHEAD (16)              /* edges the handler may run ahead, twice the queue */
+
+static atomic_int Done;
+static atomic_uint Taken;      /* number of the last edge taken */
+static uint32_t Dropped;
+
+static void *Interrupts(void *Unused)
+{
+    uint16_t Time;
+    uint32_t Count;
+
+    (void)Unused;
+    for (Count = 1; Count <= EDGES; Count++)
+    {
+        uint8_t Overrun;
+
+        /* the main thread must be able to tell the edges apart */
+        while (Count - atomic_load(&Taken) > AHEAD)
+        {
+            sched_yield();
+        }
+        /* edges two microseconds apart, bit 0 is the level */
+        Time = (uint16_t)(2 * Count);
+        TMR1H = (uint8_t)(Time >> 8);
+        TMR1L = (uint8_t)Time;
+        INTCONbits.TMR0IF = 1;
+        if ((Count & 3) == 0)
+        {
+            PIR1bits.TMR2IF = 1;
+        }
+        Overrun = IR_EdgeOverrun;
+        ISR();
+        Dropped += (uint8_t)(IR_EdgeOverrun - Overrun);
+    }
+    atomic_store(&Done, 1);
+    return NULL;
+}
+
+int main(void)
+{
+    pthread_t Thread;
+    uint32_t Received;
+    uint16_t Last;
+    uint16_t Edge;
+
+    Sim_PowerOn(1);
+    INTCONbits.TMR0IE = 1;
+    PIE1bits.TMR2IE = 1;
+    Received = 0;
+    Last = 0;
+    Sim_Check(pthread_create(&Thread, NULL, Interrupts, NULL) == 0, "no thread for the interrupt handler");
+    for (;;)
+    {
+        int Finished;
+
+        Finished = atomic_load(&Done);
+        while (IR_GetEdge(&Edge))
+        {
+            uint16_t Step;
+
+            Step = (uint16_t)((Edge & 0xFFFE) - Last) >> 1;
+            Sim_Check((Step != 0) && (Step <= AHEAD), "IR edge out of order, repeated or torn");
+            Last = Edge & 0xFFFE;
+            Received++;
+            atomic_fetch_add(&Taken, Step);
+            IR_Decode(Edge);
+        }
+        if (Finished)
+        {
+            break;
+        }
+        sched_yield();
+    }
+    pthread_join(Thread, NULL);
+    printf("race_test: %u edges, %u taken, %u dropped on a full queue\n", EDGES,
+           (unsigned)Received, (unsigned)Dropped);
+    Sim_Check(Received + Dropped == EDGES, "IR edges lost without being counted");
+    return 0;
+}
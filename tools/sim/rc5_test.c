@@ -0,0 +1,289 @@
+/*
+ * File:   rc5_test.c
+ *
+ * Description:
+ *      RC5 decoding through the TIMER0 edge interrupt, the edge queue
+ *      and IR_Decode(), with the application loop running.
+ *
+ *      Frames use RC5 system 0 so IR_Dispatch() takes no action on
+ *      them, and IR_LastFrame shows what was decoded, except for the
+ *      held key test, which drives the volume motor.
+ *
+ *      The receiver test charts the share of frames decoded through
+ *      the receiver model of sim.h against distance in the dark, in
+ *      a lit room and in sunlight with flickering lamps.
+ */
+#include "sim.h"
+
+#define TEST_SYSTEM (0)
+
+static uint16_t Random_Frame(void)
+{
+    return Sim_RC5Frame(TEST_SYSTEM, rand() % 128, rand() & 1);
+}
+
+/*
+ * Send a frame starting Delay microseconds from now and run until
+ * it has been dispatched. Returns 1 when it was decoded.
+ */
+static int Send(uint32_t Delay, uint16_t Frame, int Stretch, int Jitter)
+{
+    uint32_t End;
+
+    IR_LastFrame = 0;
+    End = Sim_RC5(Sim_Time + Delay, Frame, Stretch, Jitter);
+    Sim_Run(End + 5000 - Sim_Time);
+    return IR_LastFrame == Frame;
+}
+
+static void Jitter_Test(void)
+{
+    int Count;
+    int Good;
+
+    Good = 0;
+    for (Count = 0; Count < 2000; Count++)
+    {
+        Good += Send(2000, Random_Frame(), 0, 100);
+    }
+    printf("rc5_test: +/-100us jitter, %d/%d frames\n", Good, Count);
+    Sim_Check(Good == Count, "frame lost to jitter");
+}
+
+static void Stretch_Test(void)
+{
+    int Stretch;
+
+    for (Stretch = -300; Stretch <= 300; Stretch += 100)
+    {
+        int Count;
+        int Good;
+
+        Good = 0;
+        for (Count = 0; Count < 1000; Count++)
+        {
+            Good += Send(2000, Random_Frame(), Stretch, 50);
+        }
+        printf("rc5_test: %+dus mark stretch, %d/%d frames\n", Stretch, Good, Count);
+        Sim_Check(Good == Count, "frame lost to mark stretch");
+    }
+}
+
+/*
+ * A mark of noise, then a valid frame. The falling edge that starts
+ * the frame ends a space too long for the glitch's partial frame.
+ */
+static void Glitch_Test(void)
+{
+    uint32_t Width;
+    uint32_t Gap;
+    int Count;
+    int Good;
+
+    Count = 0;
+    Good = 0;
+    for (Width = 100; Width <= 2000; Width += 100)
+    {
+        for (Gap = 2500; Gap <= 9000; Gap += 500)
+        {
+            Sim_IR(Sim_Time + 1000, 0);
+            Sim_IR(Sim_Time + 1000 + Width, 1);
+            Good += Send(1000 + Width + Gap, Random_Frame(), 0, 0);
+            Count++;
+        }
+    }
+    printf("rc5_test: glitch then frame, %d/%d frames\n", Good, Count);
+    Sim_Check(Good == Count, "frame lost after a glitch");
+}
+
+/*
+ * A partial frame, then a frame 65536 microseconds plus a half bit
+ * later. Its first edge looks like the next half bit to TIMER1, so
+ * only the tick timeout keeps it from finishing the old frame.
+ */
+static void Gap_Test(void)
+{
+    uint32_t Start;
+
+    Start = Sim_Time + 1000;
+    Sim_IR(Start, 0);
+    Sim_IR(Start + RC5_HALF_BIT, 1);
+    Sim_Check(Send(2 * RC5_HALF_BIT + 65536, Sim_RC5Frame(TEST_SYSTEM, 9, 0), 0, 0),
+              "frame lost after a partial frame");
+    printf("rc5_test: partial frame then frame after 65.5ms, decoded\n");
+}
+
+/*
+ * Hold (volume) up with one repeat lost in the middle. The motor
+ * must not stop until the key is let go.
+ */
+#define REPEAT_US (113778)
+
+static void Hold_Test(void)
+{
+    uint16_t Frame;
+    uint32_t Start;
+    uint32_t Last;
+    int Count;
+    int Dropped;
+
+    Frame = Sim_RC5Frame(RC5_SYSTEM, 16, 1);
+    Start = Sim_Time + 1000;
+    for (Count = 0; Count < 8; Count++)
+    {
+        if (Count != 4)
+        {
+            Sim_RC5(Start + Count * REPEAT_US, Frame, 0, 100);
+        }
+    }
+    Last = Start + 7 * REPEAT_US + 14 * 2 * RC5_HALF_BIT;
+    Dropped = 0;
+    while (Sim_Time < Last)
+    {
+        Sim_Step();
+        if ((Sim_Time > Start + REPEAT_US) && !(PORTC & MOTOR_A_MASK))
+        {
+            Dropped = 1;
+        }
+    }
+    Sim_Check(!Dropped, "held volume key dropped on one lost repeat");
+    Sim_Run(2 * IR_HOLD_TICKS * 1000 + 10000);
+    Sim_Check(!(PORTC & MOTOR_A_MASK), "volume motor runs on after the key is let go");
+    printf("rc5_test: held key with a lost repeat, motor kept running\n");
+}
+
+/*
+ * Frames through the receiver model, a repeat period apart. Returns
+ * the number decoded and adds the frames decoded wrong to Wrong.
+ */
+#define RECEIVER_FRAMES (200)
+
+static int Receive(Sim_Receiver_t *Rx, int *Wrong)
+{
+    int Count;
+    int Good;
+
+    Rx->Time = Sim_Time;
+    Rx->BurstEnd = 0;
+    Rx->Charge = 0;
+    Rx->Level = Sim_IRLevel;
+    for (Good = 0, Count = 0; Count < RECEIVER_FRAMES; Count++)
+    {
+        uint16_t Frame;
+        uint32_t End;
+
+        Frame = Random_Frame();
+        IR_LastFrame = 0;
+        End = Sim_Time + REPEAT_US;
+        Sim_Receive(Rx, End, Sim_Time + 1000, Frame);
+        Sim_Run(End - Sim_Time);
+        Good += IR_LastFrame == Frame;
+        *Wrong += (IR_LastFrame != 0) && (IR_LastFrame != Frame);
+    }
+    return Good;
+}
+
+/* the mean stretch of the marks of a frame at Distance in the dark */
+static int Mark_Stretch(double Distance)
+{
+    Sim_Receiver_t Rx = {Distance, 20};
+    uint16_t Index;
+    uint32_t Fell;
+    int Stretch;
+    int Marks;
+
+    Rx.Time = Sim_Time;
+    Rx.Level = Sim_IRLevel;
+    Index = Sim_EdgeHead;
+    Sim_Receive(&Rx, Sim_Time + REPEAT_US, Sim_Time + 1000, Sim_RC5Frame(TEST_SYSTEM, 0x2A, 0));
+    for (Fell = 0, Stretch = 0, Marks = 0; Index != Sim_EdgeHead; Index = (Index + 1) % SIM_EDGES)
+    {
+        if (Sim_Edges[Index].Level == 0)
+        {
+            Fell = Sim_Edges[Index].Time;
+        }
+        else if (Fell)
+        {
+            uint32_t Width;
+
+            Width = Sim_Edges[Index].Time - Fell;
+            Stretch += (int)Width - ((Width > 3 * RC5_HALF_BIT / 2) ? 2 * RC5_HALF_BIT : RC5_HALF_BIT);
+            Marks++;
+        }
+    }
+    Sim_Run(REPEAT_US);
+    return Marks ? Stretch / Marks : 0;
+}
+
+static void Receiver_Test(void)
+{
+    static const struct
+    {
+        const char *Name;
+        double Noise;
+        double Bursts;
+        double BurstLevel;
+        double BurstLength;
+    } Light[] =
+    {
+        {"dark", 0, 0, 0, 0},
+        {"lit room", 0.2, 5, 2, 300},
+        {"sunlight", 0.4, 20, 3, 600},
+    };
+    static const double Distance[] = {1, 2, 4, 8, 12, 16, 20, 24};
+    int Rate[3][8];
+    int Wrong[3];
+    unsigned Index;
+    unsigned Metres;
+    int Near;
+    int Far;
+
+    Near = Mark_Stretch(1);
+    Far = Mark_Stretch(16);
+    printf("rc5_test: receiver marks %+dus at 1m, %+dus at 16m\n", Near, Far);
+    Sim_Check((Near > 0) && (Far < 0), "marks not stretched close up and shortened far away");
+
+    printf("rc5_test: frames decoded through the receiver, %d at each distance, range 20m\n",
+           RECEIVER_FRAMES);
+    printf("rc5_test:   %-10s", "metres");
+    for (Metres = 0; Metres < 8; Metres++)
+    {
+        printf("%5.0f", Distance[Metres]);
+    }
+    printf("  wrong\n");
+    for (Index = 0; Index < 3; Index++)
+    {
+        Wrong[Index] = 0;
+        printf("rc5_test:   %-10s", Light[Index].Name);
+        for (Metres = 0; Metres < 8; Metres++)
+        {
+            Sim_Receiver_t Rx = {Distance[Metres], 20, Light[Index].Noise, Light[Index].Bursts,
+                                 Light[Index].BurstLevel, Light[Index].BurstLength};
+
+            Rate[Index][Metres] = 100 * Receive(&Rx, &Wrong[Index]) / RECEIVER_FRAMES;
+            printf("%4d%%", Rate[Index][Metres]);
+        }
+        printf("%7d\n", Wrong[Index]);
+    }
+    for (Metres = 0; Metres < 8; Metres++)
+    {
+        Sim_Check((Distance[Metres] > 16) || (Rate[0][Metres] == 100), "frame lost in the dark within range");
+        Sim_Check((Distance[Metres] > 4) || (Rate[1][Metres] >= 95), "frames lost in a lit room close up");
+        Sim_Check((Metres == 0) || (Rate[0][Metres] <= Rate[0][Metres - 1]), "more frames decoded further away");
+    }
+    Sim_Check(Rate[0][7] < 50, "frames decoded out of range");
+    Sim_Check(Wrong[0] == 0, "frame decoded wrong in the dark");
+}
+
+int main(void)
+{
+    srand(1);
+    Sim_PowerOn(1);
+    Jitter_Test();
+    Stretch_Test();
+    Glitch_Test();
+    Gap_Test();
+    Hold_Test();
+    Receiver_Test();
+    return 0;
+}
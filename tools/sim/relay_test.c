@@ -0,0 +1,172 @@
+/*
+ * File:   relay_test.c
+ *
+ * Description:
+ *      Source changes against the relay model of sim.h. (mute) is
+ *      turned off, then each source is selected in turn, so every
+ *      change is sequenced by Panel_Commit() with the audio on.
+ *
+ *      Units are made with operate, bounce and release times drawn
+ *      across the range of small reed relays. The default mute and
+ *      settle times must be free of thumps on every unit, and the
+ *      shortest times that are free of them are found, which is the
+ *      fastest click free source change these relays allow.
+ *
+ *      A mute time shorter than the mute relay's release, with source
+ *      relays that operate faster than it releases, must thump,
+ *      and a coil economiser duty with an off time longer than a
+ *      relay's release must drop it out.
+ */
+#include "sim.h"
+
+#define UNITS (8)
+#define MUTE_MAX (8)
+#define SETTLE_MAX (16)
+
+static Sim_Relay_t Unit[UNITS][SIM_RELAYS];
+
+/* a unit, each relay within the range of small reed relays */
+static void Make_Units(void)
+{
+    int Index;
+    int Relay;
+
+    srand(86);
+    for (Index = 0; Index < UNITS; Index++)
+    {
+        for (Relay = 0; Relay < SIM_RELAYS; Relay++)
+        {
+            Sim_Relay_t *This = &Unit[Index][Relay];
+
+            memset(This, 0, sizeof(*This));
+            This->Operate = 300 + rand() % 1201;
+            This->Bounce = 100 + rand() % 901;
+            This->Release = 300 + rand() % 1701;
+            This->Break = 50 + rand() % 251;
+        }
+    }
+}
+
+static void Power_On(const Sim_Relay_t *Relays)
+{
+    Sim_Time = 0;
+    Sim_IRLevel = 1;
+    Sim_EdgeHead = Sim_EdgeTail = 0;
+    memcpy(Sim_Relay, Relays, sizeof(Sim_Relay));
+    Sim_RelayClicks = 0;
+    Sim_RelayDropouts = 0;
+    Sim_Release();
+    memset(Sim_EE, 0xFF, sizeof(Sim_EE));
+    Sim_PowerOn(1);
+    Sim_Run(100000);
+}
+
+static void Press(SelectSwitch_t Key)
+{
+    Sim_Press(Key);
+    Sim_Run(60000);
+    Sim_Release();
+    Sim_Run(100000);
+}
+
+/*
+ * Select (disc), turn (mute) off, then select each source in turn.
+ * Returns the number of thumps.
+ */
+static uint32_t Switch_Sources(const Sim_Relay_t *Relays, uint8_t Mute, uint8_t Settle)
+{
+    SelectSwitch_t Key;
+
+    Power_On(Relays);
+    Tune_Set(TUNE_RELAY_MUTE, Mute);
+    Tune_Set(TUNE_RELAY_SETTLE, Settle);
+    Press(SW_1);
+    Press(SW_1);
+    Sim_Check(PORTC & (1 << 7), "(mute) not turned off");
+    for (Key = SW_2; Key <= SW_6; Key++)
+    {
+        Press(Key);
+        Sim_Check(PORTC & (1 << 7), "(mute) left on after a source change");
+    }
+    Press(SW_1);
+    return Sim_RelayClicks;
+}
+
+/* the thumps of every unit */
+static uint32_t All_Units(uint8_t Mute, uint8_t Settle)
+{
+    uint32_t Clicks;
+    int Index;
+
+    for (Clicks = 0, Index = 0; Index < UNITS; Index++)
+    {
+        Clicks += Switch_Sources(Unit[Index], Mute, Settle);
+    }
+    return Clicks;
+}
+
+int main(void)
+{
+    static Sim_Relay_t Typical[SIM_RELAYS];
+    static Sim_Relay_t Slow[SIM_RELAYS];
+    int Index;
+    uint8_t Best_Mute;
+    uint8_t Best_Settle;
+    uint8_t Mute;
+    uint8_t Settle;
+    uint32_t Clicks;
+
+    memcpy(Typical, Sim_Relay, sizeof(Typical));
+    Make_Units();
+
+    Sim_RelayQuiet = 0;
+    All_Units(RELAY_MUTE_TICKS, RELAY_SETTLE_TICKS);
+    printf("relay_test: mute %u ms, settle %u ms, no thumps on %d units\n", RELAY_MUTE_TICKS,
+           RELAY_SETTLE_TICKS, UNITS);
+
+    /* the shortest mute and settle times free of thumps on every unit */
+    Sim_RelayQuiet = 1;
+    Best_Mute = 0;
+    Best_Settle = 0;
+    for (Mute = 1; Mute <= MUTE_MAX; Mute++)
+    {
+        for (Settle = INRUSH_TICKS + 1; Settle <= SETTLE_MAX; Settle++)
+        {
+            if ((Best_Mute && (Mute + Settle >= Best_Mute + Best_Settle)) || All_Units(Mute, Settle))
+            {
+                continue;
+            }
+            Best_Mute = Mute;
+            Best_Settle = Settle;
+        }
+    }
+    printf("relay_test: fastest free of thumps, mute %u ms and settle %u ms\n", Best_Mute, Best_Settle);
+    Sim_Check(Best_Mute && (Best_Mute + Best_Settle <= RELAY_MUTE_TICKS + RELAY_SETTLE_TICKS),
+              "no click free times as fast as the defaults");
+
+    /* a slow mute relay still closed when a fast source relay makes */
+    memcpy(Slow, Typical, sizeof(Slow));
+    Slow[SIM_RELAY_MUTE].Release = 2000;
+    for (Index = 0; Index < SIM_RELAY_SOURCES; Index++)
+    {
+        Slow[Index].Operate = 300;
+    }
+    Clicks = Switch_Sources(Slow, 1, RELAY_SETTLE_TICKS);
+    printf("relay_test: mute 1 ms against a %u us release, %lu thumps\n", Slow[SIM_RELAY_MUTE].Release,
+           (unsigned long)Clicks);
+    Sim_Check(Clicks > 0, "thump through the mute relay not found");
+
+    /* the coil economiser at a quarter, off for 750 us of each millisecond */
+    Switch_Sources(Typical, RELAY_MUTE_TICKS, RELAY_SETTLE_TICKS);
+    Tune_Set(TUNE_HOLD_DUTY, 1);
+    Sim_Run(200000);
+    Sim_Check(Sim_RelayDropouts == 0, "relay with a 1500 us release dropped out");
+    Typical[0].Release = 500;
+    Switch_Sources(Typical, RELAY_MUTE_TICKS, RELAY_SETTLE_TICKS);
+    Tune_Set(TUNE_HOLD_DUTY, 1);
+    Sim_Run(200000);
+    printf("relay_test: hold duty 1 of %u, %lu drop outs of a relay with a 500 us release\n", SUBTICKS,
+           (unsigned long)Sim_RelayDropouts);
+    Sim_Check(Sim_RelayDropouts > 0, "drop out in the coil economiser not found");
+    return 0;
+}
@@ -0,0 +1,823 @@
+/*
+ * File:   scenario.c
+ *
+ * Description:
+ *      Runs scenario files against the simulator. Each file is first
+ *      compiled to a compact bytecode, then the bytecode is run with
+ *      the controller, so the time spent goes to the controller
+ *      model and not to reading the text.
+ *
+ *      Usage: scenario file.scn ...
+ *
+ *      Each file runs from a cold power on with erased data EEPROM,
+ *      in a child process so no state is left over for the next.
+ *      Branches of a file are forked from the process that ran the
+ *      statements before them, so the shared prefix runs only once.
+ *
+ * Language:
+ *      One statement a line. A '#' starts a comment. Times are a
+ *      number with a unit of us, ms or s. A statement may start with
+ *      "at <time>", which first waits until that time from power on.
+ *
+ *      at <time>                           wait until the time
+ *      wait <time>                         wait for the time
+ *      press <key> [for <time>]            press a key, SW_1 to SW_6 or
+ *                                          SW_REC, and release it after
+ *                                          the time
+ *      release                             release every key
+ *      send RC5 addr <n> cmd <n> [x<n>]    send an RC5 frame, or n frames
+ *                                          of a held key 113.778ms apart
+ *      glitch <time>                       a noise mark on the IR receiver
+ *      reset                               reset from MCLRn, RAM is kept
+ *      expect <pin> high|low [within <time>]
+ *                                          check a port line now, or that
+ *                                          it gets there within the time
+ *      branch                              start a branch, which runs
+ *                                          from where the first branch
+ *                                          started and ends at the next
+ *                                          branch or the end of the file
+ *
+ *      Stimulus does not wait. "press ... for" releases the key in the
+ *      background and frames are sent while the script goes on, so an
+ *      "expect ... within" times from the press or the first frame.
+ *      Frames sent while earlier ones are still going follow them.
+ *      The edges of a frame are made one repeat before it starts, so
+ *      a long held key does not fill the simulator's edge list.
+ *
+ *      Statements before the first branch run once, then each branch
+ *      runs in its own copy of the simulator. Branches run together,
+ *      so an "at" in a branch is still timed from power on.
+ *
+ *      A pin is RB0-RB7 or RC0-RC7. It reads high when it was high in
+ *      any sub-tick of the last tick, so a relay line held by the
+ *      coil economiser reads high.
+ *
+ *      The relays are modelled by the simulator, and a source relay
+ *      bouncing while (mute) is off fails the scenario.
+ *
+ *      Exit status is 0 when every scenario passes, 1 when one fails
+ *      and 2 when one does not compile.
+ */
+#define _DEFAULT_SOURCE
+#include "sim.h"
+
+#include <ctype.h>
+#include <stdatomic.h>
+#include <strings.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define CODE_SIZE (4096)
+#define LINE_SIZE (256)
+#define RC5_REPEAT_US (113778)
+
+typedef enum
+{
+    OP_END,
+    OP_AT,          /* u32 time */
+    OP_WAIT,        /* u32 time */
+    OP_PRESS,       /* u8 key, u32 time held or 0 */
+    OP_RELEASE,
+    OP_RC5,         /* u16 frame, u8 count */
+    OP_GLITCH,      /* u32 width */
+    OP_RESET,
+    OP_EXPECT,      /* u16 line, u8 pin, u8 level, u32 within */
+    OP_BRANCH,      /* u16 offset of the next branch's offset or 0, u16 line */
+} Op_t;
+
+typedef struct
+{
+    const char *File;
+    int Line;
+    const char *Next;
+    uint8_t Code[CODE_SIZE];
+    uint16_t Length;
+    uint16_t Branch;        /* where to put the offset of the next branch */
+} Compiler_t;
+
+/*
+ * Compiler
+ */
+static void Compile_Error(Compiler_t *C, const char *Message, const char *Word)
+{
+    fprintf(stderr, "%s:%d: %s '%s'\n", C->File, C->Line, Message, Word);
+    exit(2);
+}
+
+static void Emit(Compiler_t *C, uint32_t Value, int Bytes)
+{
+    if (C->Length + Bytes > CODE_SIZE)
+    {
+        Compile_Error(C, "scenario too long at", "");
+    }
+    while (Bytes--)
+    {
+        C->Code[C->Length++] = (uint8_t)Value;
+        Value >>= 8;
+    }
+}
+
+/* the next word of the line, or "" at the end */
+static const char *Word(Compiler_t *C, char *Buffer)
+{
+    int Length;
+
+    while (isspace((unsigned char)*C->Next))
+    {
+        C->Next++;
+    }
+    for (Length = 0; *C->Next && !isspace((unsigned char)*C->Next) && (Length < LINE_SIZE - 1); Length++)
+    {
+        Buffer[Length] = *C->Next++;
+    }
+    Buffer[Length] = 0;
+    return Buffer;
+}
+
+static void Expect_Word(Compiler_t *C, const char *Expected)
+{
+    char Buffer[LINE_SIZE];
+
+    if (strcasecmp(Word(C, Buffer), Expected) != 0)
+    {
+        Compile_Error(C, "expected", Expected);
+    }
+}
+
+static uint32_t Number(Compiler_t *C, const char *Text, const char **End)
+{
+    char *Stop;
+    unsigned long Value;
+
+    Value = strtoul(Text, &Stop, 10);
+    if (Stop == Text)
+    {
+        Compile_Error(C, "expected a number, found", Text);
+    }
+    if (End)
+    {
+        *End = Stop;
+    }
+    else if (*Stop)
+    {
+        Compile_Error(C, "bad number", Text);
+    }
+    return (uint32_t)Value;
+}
+
+static uint32_t Time(Compiler_t *C)
+{
+    char Buffer[LINE_SIZE];
+    const char *Unit;
+    uint32_t Value;
+
+    Value = Number(C, Word(C, Buffer), &Unit);
+    if (strcmp(Unit, "us") == 0)
+    {
+        return Value;
+    }
+    if (strcmp(Unit, "ms") == 0)
+    {
+        return Value * 1000;
+    }
+    if (strcmp(Unit, "s") == 0)
+    {
+        return Value * 1000000;
+    }
+    Compile_Error(C, "expected a time in us, ms or s, found", Buffer);
+    return 0;
+}
+
+static uint8_t Key(Compiler_t *C)
+{
+    static const char *const Names[] = {"SW_1", "SW_2", "SW_3", "SW_4", "SW_5", "SW_6", "SW_REC"};
+    static const SelectSwitch_t Keys[] = {SW_1, SW_2, SW_3, SW_4, SW_5, SW_6, SW_REC};
+    char Buffer[LINE_SIZE];
+    unsigned Index;
+
+    Word(C, Buffer);
+    for (Index = 0; Index < sizeof(Keys) / sizeof(Keys[0]); Index++)
+    {
+        if (strcasecmp(Buffer, Names[Index]) == 0)
+        {
+            return Keys[Index];
+        }
+    }
+    Compile_Error(C, "unknown key", Buffer);
+    return 0;
+}
+
+/* pin number, port B is 0-7 and port C is 8-15 */
+static uint8_t Pin(Compiler_t *C)
+{
+    char Buffer[LINE_SIZE];
+
+    Word(C, Buffer);
+    if ((toupper((unsigned char)Buffer[0]) != 'R') ||
+        ((toupper((unsigned char)Buffer[1]) != 'B') && (toupper((unsigned char)Buffer[1]) != 'C')) ||
+        (Buffer[2] < '0') || (Buffer[2] > '7') || Buffer[3])
+    {
+        Compile_Error(C, "expected a pin RB0-RB7 or RC0-RC7, found", Buffer);
+    }
+    return (uint8_t)(((toupper((unsigned char)Buffer[1]) == 'C') ? 8 : 0) + (Buffer[2] - '0'));
+}
+
+static void Compile_Statement(Compiler_t *C, const char *Verb)
+{
+    char Buffer[LINE_SIZE];
+
+    if (strcasecmp(Verb, "at") == 0)
+    {
+        Emit(C, OP_AT, 1);
+        Emit(C, Time(C), 4);
+        Word(C, Buffer);
+        if (Buffer[0])
+        {
+            Compile_Statement(C, Buffer);
+        }
+        return;
+    }
+    if (strcasecmp(Verb, "wait") == 0)
+    {
+        Emit(C, OP_WAIT, 1);
+        Emit(C, Time(C), 4);
+    }
+    else if (strcasecmp(Verb, "press") == 0)
+    {
+        uint8_t Pressed;
+        uint32_t Held;
+
+        Pressed = Key(C);
+        Held = 0;
+        if (Word(C, Buffer)[0])
+        {
+            if (strcasecmp(Buffer, "for") != 0)
+            {
+                Compile_Error(C, "expected", "for");
+            }
+            Held = Time(C);
+        }
+        Emit(C, OP_PRESS, 1);
+        Emit(C, Pressed, 1);
+        Emit(C, Held, 4);
+    }
+    else if (strcasecmp(Verb, "release") == 0)
+    {
+        Emit(C, OP_RELEASE, 1);
+    }
+    else if (strcasecmp(Verb, "send") == 0)
+    {
+        uint32_t System;
+        uint32_t Command;
+        uint32_t Count;
+
+        Expect_Word(C, "RC5");
+        Expect_Word(C, "addr");
+        System = Number(C, Word(C, Buffer), NULL);
+        Expect_Word(C, "cmd");
+        Command = Number(C, Word(C, Buffer), NULL);
+        Count = 1;
+        if (Word(C, Buffer)[0])
+        {
+            if (tolower((unsigned char)Buffer[0]) != 'x')
+            {
+                Compile_Error(C, "expected a count x<n>, found", Buffer);
+            }
+            Count = Number(C, Buffer + 1, NULL);
+        }
+        if ((System > 31) || (Command > 127) || (Count < 1) || (Count > 255))
+        {
+            Compile_Error(C, "RC5 address, command or count out of range", "");
+        }
+        Emit(C, OP_RC5, 1);
+        Emit(C, Sim_RC5Frame(System, Command, 0), 2);
+        Emit(C, Count, 1);
+    }
+    else if (strcasecmp(Verb, "glitch") == 0)
+    {
+        Emit(C, OP_GLITCH, 1);
+        Emit(C, Time(C), 4);
+    }
+    else if (strcasecmp(Verb, "reset") == 0)
+    {
+        Emit(C, OP_RESET, 1);
+    }
+    else if (strcasecmp(Verb, "branch") == 0)
+    {
+        Emit(C, OP_BRANCH, 1);
+        if (C->Branch)
+        {
+            C->Code[C->Branch] = (uint8_t)C->Length;
+            C->Code[C->Branch + 1] = (uint8_t)(C->Length >> 8);
+        }
+        C->Branch = C->Length;
+        Emit(C, 0, 2);
+        Emit(C, C->Line, 2);
+    }
+    else if (strcasecmp(Verb, "expect") == 0)
+    {
+        uint8_t Line;
+        uint8_t Level;
+        uint32_t Within;
+
+        Level = 0;
+        Line = Pin(C);
+        Word(C, Buffer);
+        if (strcasecmp(Buffer, "high") == 0)
+        {
+            Level = 1;
+        }
+        else if (strcasecmp(Buffer, "low") == 0)
+        {
+            Level = 0;
+        }
+        else
+        {
+            Compile_Error(C, "expected high or low, found", Buffer);
+        }
+        Within = 0;
+        if (Word(C, Buffer)[0])
+        {
+            if (strcasecmp(Buffer, "within") != 0)
+            {
+                Compile_Error(C, "expected", "within");
+            }
+            Within = Time(C);
+        }
+        Emit(C, OP_EXPECT, 1);
+        Emit(C, C->Line, 2);
+        Emit(C, Line, 1);
+        Emit(C, Level, 1);
+        Emit(C, Within, 4);
+    }
+    else
+    {
+        Compile_Error(C, "unknown statement", Verb);
+    }
+    if (Word(C, Buffer)[0])
+    {
+        Compile_Error(C, "unexpected", Buffer);
+    }
+}
+
+static void Compile(Compiler_t *C, FILE *Input)
+{
+    char Text[LINE_SIZE];
+    char Buffer[LINE_SIZE];
+
+    C->Line = 0;
+    C->Length = 0;
+    C->Branch = 0;
+    while (fgets(Text, sizeof(Text), Input))
+    {
+        char *Comment;
+
+        C->Line++;
+        Comment = strchr(Text, '#');
+        if (Comment)
+        {
+            *Comment = 0;
+        }
+        C->Next = Text;
+        if (Word(C, Buffer)[0])
+        {
+            Compile_Statement(C, Buffer);
+        }
+    }
+    Emit(C, OP_END, 1);
+}
+
+/*
+ * Hooks for tune_sweep.c, which runs the scenarios with each setting
+ * of the tunables and noise on the stimulus. Left unset, a scenario
+ * runs as described above.
+ *
+ * Run_Image is the data EEPROM at power on, erased when NULL.
+ * Run_Noise is called before each sub-tick, and RC5 frames are sent
+ * with Run_Stretch and Run_Jitter, see Sim_RC5().
+ *
+ * When Run_Measure is set a failed expectation is counted in it and
+ * the run goes on, as do relay clicks with Sim_RelayQuiet set. The
+ * wait of each "expect ... within" of up to RUN_REACTION_US is added
+ * to it, the whole time when it fails. A longer one times how long
+ * something is held rather than how soon it happens. It is in memory
+ * shared with the processes of the branches.
+ */
+#define RUN_REACTION_US (200000)
+
+typedef struct
+{
+    atomic_uint Runs;                   /* processes, a branch is one */
+    atomic_uint Waits;                  /* "expect ... within" a reaction */
+    atomic_ullong Waited;               /* microseconds, over all of them */
+    atomic_uint Late;                   /* "expect ... within" failed */
+    atomic_uint Wrong;                  /* "expect" now failed */
+    atomic_uint Clicks;
+    atomic_uint Broken;                 /* runs the simulator failed */
+} Run_Measure_t;
+
+static const uint8_t *Run_Image;
+static void (*Run_Noise)(void);
+static int Run_Stretch;
+static int Run_Jitter;
+static Run_Measure_t *Run_Measure;
+
+/* add the clicks of this process, since its run or branch started */
+static void Run_Account(void)
+{
+    if (Run_Measure)
+    {
+        atomic_fetch_add(&Run_Measure->Runs, 1);
+        atomic_fetch_add(&Run_Measure->Clicks, Sim_RelayClicks);
+    }
+}
+
+/* count an expectation, met or not, that waited Wait of its Within microseconds */
+static void Run_Expected(int Met, uint32_t Within, uint32_t Wait)
+{
+    if (!Met)
+    {
+        atomic_fetch_add(Within ? &Run_Measure->Late : &Run_Measure->Wrong, 1);
+    }
+    if (Within && (Within <= RUN_REACTION_US))
+    {
+        atomic_fetch_add(&Run_Measure->Waits, 1);
+        atomic_fetch_add(&Run_Measure->Waited, Wait);
+    }
+}
+
+/*
+ * Runner
+ */
+static uint8_t Line_History[SUBTICKS][2];
+static uint32_t Release_At;
+static uint32_t IR_Free;
+
+/* IR stimulus not yet made into edges, oldest at IR_SendTail */
+#define IR_SENDS (16)
+
+typedef struct
+{
+    uint32_t Time;          /* start of the next frame, or the glitch */
+    uint16_t Frame;
+    uint8_t Count;          /* frames left, 0 for a glitch */
+    uint32_t Width;         /* glitch mark */
+} IR_Send_t;
+
+static IR_Send_t IR_Send[IR_SENDS];
+static uint8_t IR_SendHead;
+static uint8_t IR_SendTail;
+
+/* queue stimulus to start at IR_Free, after any still going */
+static void IR_Queue(uint16_t Frame, uint8_t Count, uint32_t Width)
+{
+    uint8_t Next;
+
+    Next = (IR_SendHead + 1) % IR_SENDS;
+    if (Next == IR_SendTail)
+    {
+        Sim_Fail("scenario IR stimulus queue full");
+    }
+    if (IR_Free < Sim_Time + 1000)
+    {
+        IR_Free = Sim_Time + 1000;
+    }
+    IR_Send[IR_SendHead].Time = IR_Free;
+    IR_Send[IR_SendHead].Frame = Frame;
+    IR_Send[IR_SendHead].Count = Count;
+    IR_Send[IR_SendHead].Width = Width;
+    IR_SendHead = Next;
+    IR_Free += Count ? Count * RC5_REPEAT_US : Width + 2 * RC5_HALF_BIT;
+}
+
+/* make the edges of the stimulus that starts within one repeat */
+static void IR_Feed(void)
+{
+    while (IR_SendTail != IR_SendHead)
+    {
+        IR_Send_t *Send = &IR_Send[IR_SendTail];
+
+        if (Send->Time > Sim_Time + RC5_REPEAT_US)
+        {
+            return;
+        }
+        if (Send->Count)
+        {
+            Sim_RC5(Send->Time, Send->Frame, Run_Stretch, Run_Jitter);
+            Send->Time += RC5_REPEAT_US;
+            if (--Send->Count)
+            {
+                continue;
+            }
+        }
+        else
+        {
+            Sim_IR(Send->Time, 0);
+            Sim_IR(Send->Time + Send->Width, 1);
+        }
+        IR_SendTail = (IR_SendTail + 1) % IR_SENDS;
+    }
+}
+
+static void Run_Step(void)
+{
+    if (Run_Noise)
+    {
+        Run_Noise();
+    }
+    IR_Feed();
+    Sim_Step();
+    memmove(Line_History[1], Line_History[0], sizeof(Line_History) - sizeof(Line_History[0]));
+    Line_History[0][0] = PORTB;
+    Line_History[0][1] = PORTC;
+    if (Release_At && (Sim_Time >= Release_At))
+    {
+        Release_At = 0;
+        Sim_Release();
+    }
+}
+
+/*
+ * Run towards End, skipping idle ticks up to the next stimulus. The
+ * port lines do not change in an idle tick, so the history of the
+ * last one stands for those skipped.
+ */
+static void Run_Until(uint32_t End)
+{
+    if (Release_At && (Release_At <= End))
+    {
+        End = Release_At - 1;
+    }
+    if ((IR_SendTail != IR_SendHead) && (IR_Send[IR_SendTail].Time < End))
+    {
+        End = IR_Send[IR_SendTail].Time;
+    }
+    Sim_AdvanceWith(End, Run_Step);
+}
+
+static int Line_High(uint8_t Line)
+{
+    int Sub;
+
+    for (Sub = 0; Sub < SUBTICKS; Sub++)
+    {
+        if (Line_History[Sub][Line >> 3] & (1 << (Line & 7)))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t Read32(const uint8_t **Code)
+{
+    uint32_t Value;
+
+    Value = (*Code)[0] | ((uint32_t)(*Code)[1] << 8) | ((uint32_t)(*Code)[2] << 16) | ((uint32_t)(*Code)[3] << 24);
+    *Code += 4;
+    return Value;
+}
+
+static uint16_t Read16(const uint8_t **Code)
+{
+    uint16_t Value;
+
+    Value = (*Code)[0] | ((uint16_t)(*Code)[1] << 8);
+    *Code += 2;
+    return Value;
+}
+
+static uint8_t Toggle;
+static uint16_t Branches;
+static int In_Branch;
+
+static int Run_Code(const char *File, const uint8_t *Start, const uint8_t *Code);
+
+/*
+ * Fork a process for each branch from the first, Code, and wait for
+ * them all. Returns 1 when one fails.
+ */
+static int Run_Branches(const char *File, const uint8_t *Start, const uint8_t *Code)
+{
+    int Failed;
+    uint16_t Running;
+    int Status;
+
+    Failed = 0;
+    Running = 0;
+    for (;;)
+    {
+        uint16_t Next;
+        uint16_t Line;
+        pid_t Child;
+
+        Next = Read16(&Code);
+        Line = Read16(&Code);
+        fflush(stdout);
+        Child = fork();
+        if (Child == 0)
+        {
+            In_Branch = 1;
+            Sim_RelayClicks = 0;
+            Status = Run_Code(File, Start, Code);
+            Run_Account();
+            if (!Status && !Run_Measure)
+            {
+                printf("scenario: %s:%u, branch, %lu ms simulated, pass\n", File, Line,
+                       (unsigned long)(Sim_Time / 1000));
+            }
+            fflush(stdout);
+            _exit(Status);
+        }
+        if (Child < 0)
+        {
+            Failed = 1;
+        }
+        else
+        {
+            Running++;
+        }
+        if (!Next)
+        {
+            break;
+        }
+        Code = Start + Next;
+    }
+    Branches = Running;
+    while (Running--)
+    {
+        if ((wait(&Status) < 0) || !WIFEXITED(Status) || WEXITSTATUS(Status))
+        {
+            Failed = 1;
+        }
+    }
+    return Failed;
+}
+
+static int Run(const char *File, const uint8_t *Code)
+{
+    int Status;
+
+    Toggle = 0;
+    Branches = 0;
+    IR_SendHead = IR_SendTail;
+    if (Run_Image)
+    {
+        memcpy(Sim_EE, Run_Image, sizeof(Sim_EE));
+    }
+    else
+    {
+        memset(Sim_EE, 0xFF, sizeof(Sim_EE));
+    }
+    Sim_Release();
+    Sim_PowerOn(1);
+    Sim_RelayClicks = 0;
+    Status = Run_Code(File, Code, Code);
+    Run_Account();
+    return Status;
+}
+
+/* run from Code in the bytecode at Start to the end, or of the branch */
+static int Run_Code(const char *File, const uint8_t *Start, const uint8_t *Code)
+{
+    for (;;)
+    {
+        uint32_t End;
+
+        switch (*Code++)
+        {
+            case OP_END:
+                return 0;
+            case OP_BRANCH:
+                return In_Branch ? 0 : Run_Branches(File, Start, Code);
+            case OP_AT:
+                End = Read32(&Code);
+                while (Sim_Time < End)
+                {
+                    Run_Until(End);
+                }
+                break;
+            case OP_WAIT:
+                End = Sim_Time + Read32(&Code);
+                while (Sim_Time < End)
+                {
+                    Run_Until(End);
+                }
+                break;
+            case OP_PRESS:
+                Sim_Press((SelectSwitch_t)*Code++);
+                End = Read32(&Code);
+                Release_At = End ? Sim_Time + End : 0;
+                break;
+            case OP_RELEASE:
+                Release_At = 0;
+                Sim_Release();
+                break;
+            case OP_RC5:
+            {
+                uint16_t Frame;
+                uint8_t Count;
+
+                Frame = Read16(&Code) | (Toggle ? 0x0800 : 0);
+                Count = *Code++;
+                Toggle ^= 1;
+                IR_Queue(Frame, Count, 0);
+                break;
+            }
+            case OP_GLITCH:
+                IR_Queue(0, 0, Read32(&Code));
+                break;
+            case OP_RESET:
+                memset(Line_History, 0, sizeof(Line_History));
+                Sim_PowerOn(0);
+                break;
+            case OP_EXPECT:
+            {
+                uint16_t Line;
+                uint8_t Pin;
+                uint8_t Level;
+                uint32_t Start;
+                uint32_t Within;
+
+                Line = Read16(&Code);
+                Pin = *Code++;
+                Level = *Code++;
+                Start = Sim_Time;
+                Within = Read32(&Code);
+                End = Start + Within;
+                while ((Line_High(Pin) != Level) && (Sim_Time < End))
+                {
+                    Run_Step();
+                }
+                if (Run_Measure)
+                {
+                    Run_Expected(Line_High(Pin) == Level, Within, Sim_Time - Start);
+                }
+                else if (Line_High(Pin) != Level)
+                {
+                    printf("%s:%u: FAIL at %lu.%03lu ms: R%c%u is %s\n", File, Line,
+                           (unsigned long)(Sim_Time / 1000), (unsigned long)(Sim_Time % 1000),
+                           (Pin & 8) ? 'C' : 'B', Pin & 7, Level ? "low" : "high");
+                    return 1;
+                }
+                break;
+            }
+            default:
+                printf("%s: bad bytecode\n", File);
+                return 1;
+        }
+    }
+}
+
+int main(int Count, char **Files)
+{
+    int Index;
+    int Failed;
+
+    Failed = 0;
+    for (Index = 1; Index < Count; Index++)
+    {
+        static Compiler_t C;
+        FILE *Input;
+        pid_t Child;
+        int Status;
+
+        Input = fopen(Files[Index], "r");
+        if (!Input)
+        {
+            perror(Files[Index]);
+            return 2;
+        }
+        C.File = Files[Index];
+        Compile(&C, Input);
+        fclose(Input);
+
+        fflush(stdout);
+        Child = fork();
+        if (Child == 0)
+        {
+            Status = Run(C.File, C.Code);
+            if (!Status)
+            {
+                printf("scenario: %s, %u bytes of code, %lu ms simulated", C.File, C.Length,
+                       (unsigned long)(Sim_Time / 1000));
+                if (Branches)
+                {
+                    printf(" then %u branches", Branches);
+                }
+                if (Sim_CycleCount)
+                {
+                    printf(", longest pass %lu cycles", (unsigned long)Sim_PassCyclesMax);
+                }
+                printf(", pass\n");
+            }
+            fflush(stdout);
+            _exit(Status);
+        }
+        if ((Child < 0) || (waitpid(Child, &Status, 0) < 0) || !WIFEXITED(Status) || WEXITSTATUS(Status))
+        {
+            Failed = 1;
+        }
+    }
+    return Failed;
+}
@@ -0,0 +1,1224 @@
+/*
+ * File:   sim.h
+ *
+ * Target: host (gcc or clang)
+ *
+ * Description:
+ *      Host simulator for the S21 input selector firmware. A test
+ *      includes this file once, which compiles main.c in the same
+ *      translation unit with main() renamed to Firmware_Main().
+ *
+ *      Time advances one TIMER2 sub-tick, 250 microseconds, at a
+ *      time. Each step delivers the IR receiver edges that fall in
+ *      the sub-tick to the TIMER0 interrupt, stamped with the time
+ *      of the edge in TIMER1, then runs the TIMER2 interrupt, then
+ *      runs one pass of the application loop when the tick moved.
+ *
+ *      main() cannot return, so Sim_Boot() and Sim_Pass() call its
+ *      two halves, App_Init() and App_Pass(), directly.
+ *
+ *      Sim_Run() and Sim_Advance() skip idle time. A tick that leaves
+ *      the firmware RAM as it found it, apart from the clock and the
+ *      deadlines, is followed by more of the same until a deadline
+ *      falls due, an IR edge arrives or the caller's time is up, so
+ *      those ticks are counted off at once. The result is the same,
+ *      bit for bit, as stepping every sub-tick, which Sim_NoSkip
+ *      does and skip_test checks.
+ *
+ *      The data EEPROM takes SIM_EE_WRITE_SUBTICKS to finish a
+ *      write. Code that polls WR and then clears the watchdog is
+ *      waiting, and the simulator lets time pass while it does, so
+ *      interrupts and IR edges carry on through the stall. The
+ *      longest stall of a pass is kept in Sim_StallMax.
+ *
+ *      The relays have operate, release and bounce times, and a
+ *      source contact bouncing while (mute) is off fails the test,
+ *      see Sim_RelayStep(). The volume pot turns with inertia and
+ *      slips at its end stops, see Sim_PotStep().
+ *
+ *      Faults can be injected: stuck switch lines, failed and torn
+ *      data EEPROM writes, and watchdog and brown-out resets, see
+ *      Sim_Reset().
+ *
+ *      A pass takes no time unless SIM_FIRMWARE is main.c as cycles.c
+ *      writes it, with the PIC's cycles for each line, see Cycles.
+ */
+#ifndef SIM_H
+#define SIM_H
+
+/* charged by main.c as cycles.c writes it, see Cycles */
+void Sim_Cycle(unsigned int Cycles);
+#define SIM_CYCLES(Cycles) Sim_Cycle(Cycles)
+
+#ifndef SIM_FIRMWARE
+#define SIM_FIRMWARE "../../16F870_AVI_S21_MI.X/main.c"
+#endif
+
+#define main Firmware_Main
+#include SIM_FIRMWARE
+#undef main
+
+#include <math.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIM_SUBTICK_US (250)
+#define SIM_EE_WRITE_SUBTICKS (16)      /* 4 milliseconds */
+#define SIM_WDT_SUBTICKS (448)          /* 112 milliseconds */
+#define SIM_PWRT_US (72000)             /* power up timer */
+#define SIM_EE_SIZE (64)
+#define SIM_EDGES (1024)
+
+uint32_t Sim_Time;                      /* microseconds */
+uint16_t Sim_Watchdog;
+uint16_t Sim_Stall;
+uint16_t Sim_StallMax;
+uint8_t Sim_InPass;
+uint8_t Sim_NoSkip;
+uint8_t Sim_InInterrupt;                /* in ISR() run by Sim_Interrupt() */
+uint32_t Sim_Skipped;                   /* ticks */
+
+uint8_t Sim_EE[SIM_EE_SIZE];
+uint16_t Sim_EEWrites[SIM_EE_SIZE];
+uint16_t Sim_EEReadBusy;
+uint8_t Sim_EEBusy;
+uint8_t Sim_EEPolled;
+uint8_t Sim_EEAddress;
+uint8_t Sim_EEData;
+volatile Sim_EECON1_t Sim_EECON1_Reg;
+volatile unsigned char Sim_EEADR_Reg;
+volatile unsigned char Sim_EEDATA_Reg;
+
+/* switch inputs as read on PORTA, none pressed, RA3 is the active low (record) */
+uint8_t Sim_PortAIn = SW_EN_MASK | 0x08;
+
+/* IR receiver output, high when no carrier */
+uint8_t Sim_IRLevel = 1;
+struct
+{
+    uint32_t Time;
+    uint8_t Level;
+} Sim_Edges[SIM_EDGES];
+uint16_t Sim_EdgeHead;
+uint16_t Sim_EdgeTail;
+
+void Sim_Fail(const char *Message)
+{
+    printf("FAIL at %lu us: %s\n", (unsigned long)Sim_Time, Message);
+    exit(1);
+}
+
+void Sim_Check(int Condition, const char *Message)
+{
+    if (!Condition)
+    {
+        Sim_Fail(Message);
+    }
+}
+
+/*
+ * Faults
+ *
+ * Sim_PortAHigh and Sim_PortALow hold switch lines on PORTA stuck
+ * high or low, whatever the keys do.
+ *
+ * The next Sim_EEFail writes to data EEPROM fail. Each takes its
+ * time and clears WR, but leaves the cell as it was, as a worn out
+ * cell does.
+ *
+ * Sim_Reset() resets the controller as a watchdog timeout or a
+ * brown-out does, at the end of a sub-tick. A write in progress is
+ * torn, the cell left with some bits new and the rest old, and
+ * counted in Sim_EETorn. The ports are inputs for Sim_ResetHold
+ * microseconds, so every relay drops out and the motor stops, and a
+ * brown-out holds the power up timer on top. Then the firmware
+ * starts again with the __persistent RAM kept and PCON showing the
+ * cause.
+ *
+ * Sim_ResetAt resets the controller with Sim_ResetCause at the end
+ * of the sub-tick that reaches it, which may be between passes of
+ * the application loop or in a wait for a write. Idle ticks are not
+ * skipped past it. A watchdog timeout fails the test unless
+ * Sim_WatchdogReset is set, when it resets the controller.
+ *
+ * A reset leaves the pass of the application loop, or the caller's
+ * step, by longjmp() to Sim_ResetJump when the test has set it. A
+ * reset in a pass without it fails the test.
+ */
+typedef enum {SIM_RESET_WATCHDOG, SIM_RESET_BROWNOUT} Sim_ResetCause_t;
+
+uint8_t Sim_PortAHigh;
+uint8_t Sim_PortALow;
+uint16_t Sim_EEFail;
+uint16_t Sim_EETorn;
+uint32_t Sim_ResetAt;                   /* 0 for none */
+uint8_t Sim_ResetCause;
+uint32_t Sim_ResetHold;                 /* microseconds */
+uint8_t Sim_WatchdogReset;
+uint32_t Sim_Resets;
+jmp_buf *Sim_ResetJump;
+
+void Sim_Reset(Sim_ResetCause_t Cause);
+
+/*
+ * PORTA, the bits TRISA makes inputs read the switch lines and the
+ * rest the latch
+ */
+volatile Sim_PORTA_t *Sim_PortA(void)
+{
+    uint8_t Pins;
+
+    Pins = (Sim_PortAIn | Sim_PortAHigh) & ~Sim_PortALow;
+    Sim_PORTA_Reg.Byte = (Sim_PORTA_Reg.Byte & ~TRISA) | (Pins & TRISA);
+    return &Sim_PORTA_Reg;
+}
+
+/*
+ * Data EEPROM
+ *
+ * A write starts when WR is set. The address and data are latched
+ * the next time any EEPROM register is used, which is before the
+ * code could change them.
+ */
+static void Sim_EELatch(void)
+{
+    if (Sim_EECON1_Reg.WR && !Sim_EEBusy)
+    {
+        Sim_Check(Sim_EECON1_Reg.WREN, "EEPROM write without WREN");
+        Sim_EEAddress = Sim_EEADR_Reg % SIM_EE_SIZE;
+        Sim_EEData = Sim_EEDATA_Reg;
+        Sim_EEBusy = SIM_EE_WRITE_SUBTICKS;
+    }
+}
+
+static void Sim_EEStep(void)
+{
+    Sim_EELatch();
+    if (Sim_EEBusy && (--Sim_EEBusy == 0))
+    {
+        if (Sim_EEFail)
+        {
+            Sim_EEFail--;
+        }
+        else
+        {
+            Sim_EE[Sim_EEAddress] = Sim_EEData;
+        }
+        Sim_EEWrites[Sim_EEAddress]++;
+        Sim_EECON1_Reg.WR = 0;
+    }
+}
+
+volatile Sim_EECON1_t *Sim_EECON1(void)
+{
+    Sim_EELatch();
+    if (Sim_EEBusy)
+    {
+        Sim_EEPolled = 1;
+    }
+    return &Sim_EECON1_Reg;
+}
+
+volatile unsigned char *Sim_EEADR(void)
+{
+    Sim_EELatch();
+    return &Sim_EEADR_Reg;
+}
+
+volatile unsigned char *Sim_EEDATA(void)
+{
+    Sim_EELatch();
+    if (Sim_EECON1_Reg.RD)
+    {
+        Sim_EECON1_Reg.RD = 0;
+        if (Sim_EEBusy)
+        {
+            Sim_EEReadBusy++;
+        }
+        Sim_EEDATA_Reg = Sim_EE[Sim_EEADR_Reg % SIM_EE_SIZE];
+    }
+    return &Sim_EEDATA_Reg;
+}
+
+/*
+ * Relays
+ *
+ * Each relay line drives a reed relay with its own timing. When the
+ * coil is turned on the contact first touches Operate after it and
+ * bounces for Bounce. When the coil is turned off the contact parts
+ * Release after it, the flyback diode keeping the current up until
+ * then, and bounces for Break. A coil off for less than Release, as
+ * in the off part of the coil economiser's period, does not let the
+ * contact go, one off for longer drops it out.
+ *
+ * The contacts are followed in steps of SIM_RELAY_STEP_US through
+ * each sub-tick. Audio reaches the amplifier through the source
+ * relay that is closed and the mute relay, which is closed when
+ * (mute) is off. A source contact that is bouncing, made or broken,
+ * while the mute contact is touching passes the bounce through as a
+ * thump. Each such window is counted in Sim_RelayClicks, and each
+ * relay dropped out while its line is on in Sim_RelayDropouts. Both
+ * are failures unless Sim_RelayQuiet is set.
+ *
+ * Idle ticks are not skipped while a contact is moving.
+ */
+#define SIM_RELAYS (12)
+#define SIM_RELAY_SOURCES (6)           /* RB0-RB5 */
+#define SIM_RELAY_MUTE (11)             /* RC7 */
+#define SIM_RELAY_STEP_US (10)
+
+typedef struct
+{
+    uint32_t Since;                     /* time the coil last changed */
+    uint32_t Touch;                     /* time the contact last moved */
+    uint16_t Operate;                   /* microseconds */
+    uint16_t Bounce;
+    uint16_t Release;
+    uint16_t Break;
+    uint8_t Coil;
+    uint8_t Closed;
+    uint8_t Click;                      /* in a click window */
+    uint8_t Moved;                      /* Touch is set */
+} Sim_Relay_t;
+
+/* RB0-RB5 source relays RL7-RL12, RC0-RC4 record relays RL1-RL5, RC7 mute relay RL6 */
+static volatile unsigned char *const Sim_RelayPort[SIM_RELAYS] =
+{
+    &PORTB, &PORTB, &PORTB, &PORTB, &PORTB, &PORTB,
+    &PORTC, &PORTC, &PORTC, &PORTC, &PORTC, &PORTC,
+};
+static const uint8_t Sim_RelayBit[SIM_RELAYS] = {0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 7};
+
+#define SIM_RELAY_TIMING {0, 0, 1000, 500, 1500, 200, 0, 0, 0, 0}
+
+Sim_Relay_t Sim_Relay[SIM_RELAYS] =
+{
+    SIM_RELAY_TIMING, SIM_RELAY_TIMING, SIM_RELAY_TIMING, SIM_RELAY_TIMING,
+    SIM_RELAY_TIMING, SIM_RELAY_TIMING, SIM_RELAY_TIMING, SIM_RELAY_TIMING,
+    SIM_RELAY_TIMING, SIM_RELAY_TIMING, SIM_RELAY_TIMING, SIM_RELAY_TIMING,
+};
+uint32_t Sim_RelayClicks;
+uint32_t Sim_RelayDropouts;
+uint8_t Sim_RelayQuiet;
+
+/* the contact of a relay is between touching and settled at Time */
+static int Sim_RelayBouncing(const Sim_Relay_t *Relay, uint32_t Time)
+{
+    return Relay->Moved && (Time >= Relay->Touch) &&
+           (Time - Relay->Touch < (Relay->Closed ? Relay->Bounce : Relay->Break));
+}
+
+/* a contact is yet to move or still bouncing */
+static int Sim_RelayMoving(void)
+{
+    int Index;
+
+    for (Index = 0; Index < SIM_RELAYS; Index++)
+    {
+        if ((Sim_Relay[Index].Coil != Sim_Relay[Index].Closed) ||
+            Sim_RelayBouncing(&Sim_Relay[Index], Sim_Time))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* move the contacts that fall due by Time */
+static void Sim_RelayContacts(uint32_t Time)
+{
+    int Index;
+
+    for (Index = 0; Index < SIM_RELAYS; Index++)
+    {
+        Sim_Relay_t *Relay = &Sim_Relay[Index];
+
+        if (Relay->Coil && !Relay->Closed && (Time - Relay->Since >= Relay->Operate))
+        {
+            Relay->Closed = 1;
+            Relay->Touch = Relay->Since + Relay->Operate;
+            Relay->Moved = 1;
+        }
+        else if (!Relay->Coil && Relay->Closed && (Time - Relay->Since >= Relay->Release))
+        {
+            uint8_t Drive = (Sim_RelayPort[Index] == &PORTB) ? Drive_PortB : Drive_PortC;
+
+            if (Drive & (1 << Sim_RelayBit[Index]))
+            {
+                Sim_RelayDropouts++;
+                Sim_Check(Sim_RelayQuiet, "relay dropped out while held");
+            }
+            Relay->Closed = 0;
+            Relay->Touch = Relay->Since + Relay->Release;
+            Relay->Moved = 1;
+        }
+    }
+}
+
+/*
+ * Follow the contacts through the sub-tick that ended at Sim_Time,
+ * then take the coils from the ports written at its end
+ */
+static void Sim_RelayStep(void)
+{
+    uint32_t Time;
+    int Index;
+
+    for (Time = Sim_Time - SIM_SUBTICK_US + SIM_RELAY_STEP_US; Sim_RelayMoving() && (Time <= Sim_Time);
+         Time += SIM_RELAY_STEP_US)
+    {
+        const Sim_Relay_t *Mute = &Sim_Relay[SIM_RELAY_MUTE];
+        int Unmuted;
+
+        Sim_RelayContacts(Time);
+        Unmuted = Mute->Closed || Sim_RelayBouncing(Mute, Time);
+        for (Index = 0; Index < SIM_RELAY_SOURCES; Index++)
+        {
+            Sim_Relay_t *Relay = &Sim_Relay[Index];
+            int Click;
+
+            Click = Unmuted && Sim_RelayBouncing(Relay, Time);
+            if (Click && !Relay->Click)
+            {
+                Sim_RelayClicks++;
+                Sim_Check(Sim_RelayQuiet, "audio through a bouncing source relay contact while unmuted");
+            }
+            Relay->Click = (uint8_t)Click;
+        }
+    }
+    for (Index = 0; Index < SIM_RELAYS; Index++)
+    {
+        Sim_Relay_t *Relay = &Sim_Relay[Index];
+        volatile unsigned char *Tris = (Sim_RelayPort[Index] == &PORTB) ? &TRISB : &TRISC;
+        uint8_t Coil;
+
+        Coil = ((*Sim_RelayPort[Index] & ~*Tris) >> Sim_RelayBit[Index]) & 1;
+        if (Coil != Relay->Coil)
+        {
+            Relay->Coil = Coil;
+            Relay->Since = Sim_Time;
+        }
+    }
+}
+
+/*
+ * Volume pot
+ *
+ * The motorised Alps pot behind the (VOL+) and (VOL-) lines. Its
+ * position and speed are in the units of App.Volume, ticks of travel
+ * at the nominal speed, so a speed of 1 is 12 degrees a second and
+ * the bottom end stop is at 0.
+ *
+ * The speed the shaft turns at with the drive on goes with the motor
+ * voltage over its stall voltage, less what the slip clutch loses,
+ * and differs with direction. From standing it does not move for
+ * Static microseconds, then spins up to speed with the time constant
+ * SpinUp. With the drive off it coasts down with the time constant
+ * Coast. At an end stop the shaft stops and the clutch slips.
+ *
+ * Sim_Pot is a nominal unit, one that matches the firmware's default
+ * motor constants. A test can give it other values.
+ */
+#define SIM_POT_VOLTS (4.5)             /* drive the speeds are given at */
+#define SIM_POT_REST (0.001)            /* slower than this is standing */
+
+typedef struct
+{
+    double Position;
+    double Speed;
+    double Travel;                      /* from end stop to end stop */
+    double Up;                          /* speed at SIM_POT_VOLTS */
+    double Down;
+    double Volts;                       /* motor drive */
+    double Stall;                       /* volts the motor stalls at */
+    double Slip;                        /* fraction of the speed the clutch loses */
+    double Static;                      /* microseconds */
+    double SpinUp;
+    double Coast;
+    uint32_t Driven;                    /* microseconds the drive has been on */
+    uint32_t Stopped;                   /* sub-ticks held at an end stop while driven */
+} Sim_Pot_t;
+
+#define SIM_POT_NOMINAL {VOLUME_TRAVEL / 2, 0, VOLUME_TRAVEL, 1, 1, SIM_POT_VOLTS, 1.0, 0, 10000, 10000, 30000, 0, 0}
+
+Sim_Pot_t Sim_Pot = SIM_POT_NOMINAL;
+
+/* the shaft is turning or driven */
+static int Sim_PotMoving(void)
+{
+    return (Sim_Pot.Speed != 0) || (PORTC & (MOTOR_A_MASK | MOTOR_B_MASK));
+}
+
+/*
+ * Turn the shaft through the sub-tick that ended at Sim_Time, with
+ * the drive lines written at its start
+ */
+static void Sim_PotStep(void)
+{
+    double Target;
+    double Time;
+    int Drive;
+
+    Sim_Check((PORTC & (MOTOR_A_MASK | MOTOR_B_MASK)) != (MOTOR_A_MASK | MOTOR_B_MASK),
+              "VOL+ and VOL- on together");
+    Drive = (PORTC & MOTOR_A_MASK) ? 1 : (PORTC & MOTOR_B_MASK) ? -1 : 0;
+    Time = SIM_SUBTICK_US;
+    if (Drive)
+    {
+        Sim_Pot.Driven += SIM_SUBTICK_US;
+        Target = Drive * ((Drive > 0) ? Sim_Pot.Up : Sim_Pot.Down) * (1 - Sim_Pot.Slip) *
+                 (Sim_Pot.Volts - Sim_Pot.Stall) / (SIM_POT_VOLTS - Sim_Pot.Stall);
+        if ((Sim_Pot.Speed == 0) && (Sim_Pot.Driven <= Sim_Pot.Static))
+        {
+            Target = 0;
+        }
+        Sim_Pot.Speed = Target + (Sim_Pot.Speed - Target) * exp(-Time / Sim_Pot.SpinUp);
+    }
+    else
+    {
+        Sim_Pot.Driven = 0;
+        Sim_Pot.Speed *= exp(-Time / Sim_Pot.Coast);
+        if (fabs(Sim_Pot.Speed) < SIM_POT_REST)
+        {
+            Sim_Pot.Speed = 0;
+        }
+    }
+    Sim_Pot.Position += Sim_Pot.Speed * Time / 1000;
+    if ((Sim_Pot.Position <= 0) || (Sim_Pot.Position >= Sim_Pot.Travel))
+    {
+        Sim_Pot.Position = (Sim_Pot.Position <= 0) ? 0 : Sim_Pot.Travel;
+        Sim_Pot.Speed = 0;
+        Sim_Pot.Stopped += (Drive != 0);
+    }
+}
+
+/*
+ * IR receiver
+ */
+void Sim_IR(uint32_t Time, uint8_t Level)
+{
+    uint16_t Next;
+
+    Next = (Sim_EdgeHead + 1) % SIM_EDGES;
+    Sim_Check(Next != Sim_EdgeTail, "IR edge list full");
+    Sim_Edges[Sim_EdgeHead].Time = Time;
+    Sim_Edges[Sim_EdgeHead].Level = Level;
+    Sim_EdgeHead = Next;
+}
+
+/*
+ * Queue one RC5 frame starting at Time. Stretch is added to each
+ * mark, half before and half after it, as a receiver AGC does, and
+ * Jitter is the most each edge is moved at random. Returns the time
+ * the frame ends.
+ */
+uint32_t Sim_RC5(uint32_t Time, uint16_t Frame, int Stretch, int Jitter)
+{
+    uint8_t Level;
+    uint8_t Half[28];
+    int Bit;
+    int k;
+
+    k = 0;
+    for (Bit = 13; Bit >= 0; Bit--)
+    {
+        /* a one is a space then a mark, the receiver output is low in a mark */
+        Half[k++] = (Frame >> Bit) & 1;
+        Half[k++] = !((Frame >> Bit) & 1);
+    }
+    Level = 1;
+    for (k = 0; k < 28; k++)
+    {
+        if (Half[k] != Level)
+        {
+            int Shift;
+
+            Level = Half[k];
+            Shift = (Level == 0) ? -Stretch / 2 : Stretch / 2;
+            if (Jitter)
+            {
+                Shift += (rand() % (2 * Jitter + 1)) - Jitter;
+            }
+            Sim_IR(Time + Shift, Level);
+        }
+        Time += RC5_HALF_BIT;
+    }
+    if (Level == 0)
+    {
+        Sim_IR(Time + Stretch / 2, 1);
+    }
+    return Time;
+}
+
+uint16_t Sim_RC5Frame(uint8_t System, uint8_t Command, uint8_t Toggle)
+{
+    uint16_t Frame;
+
+    Frame = 0x2000 | ((uint16_t)(System & 0x1F) << 6) | (Command & 0x3F);
+    if (Command < 64)
+    {
+        Frame |= 0x1000;
+    }
+    if (Toggle)
+    {
+        Frame |= 0x0800;
+    }
+    return Frame;
+}
+
+/*
+ * IR receiver model
+ *
+ * A demodulating receiver, as the TSOP parts, followed a carrier
+ * cycle at a time. The remote's 36 kHz bursts reach it with a level
+ * that falls with the square of Distance and is at the receiver's
+ * threshold at Range. Ambient light adds noise of RMS Noise, and
+ * lamps and sunlight flicker add bursts of up to BurstLength at
+ * BurstLevel, Bursts times a second. Levels are in units of the
+ * threshold the receiver has in the dark.
+ *
+ * The AGC raises the threshold with the average level it sees. The
+ * detector charges towards a level that goes with the input over the
+ * threshold, as far as it saturates, while the input is over it, and
+ * discharges while it is not. The output is low from a charge of
+ * SIM_RX_ON until it falls below SIM_RX_OFF. So a strong signal is
+ * seen sooner and held longer, stretching the marks, a weak one is
+ * seen late and dropped soon, shortening them, and one near the
+ * threshold breaks up.
+ */
+#define SIM_PI (3.14159265358979323846)
+#define SIM_CARRIER_US (1000.0 / 36)
+#define SIM_RX_SATURATE (4.0)           /* input over threshold the detector saturates at */
+#define SIM_RX_CHARGE (6.0)             /* charge for each threshold of input */
+#define SIM_RX_DISCHARGE (4.0)          /* each carrier cycle under the threshold */
+#define SIM_RX_ON (4.0)
+#define SIM_RX_OFF (2.0)
+#define SIM_RX_AGC_US (50000.0)         /* time constant of the AGC */
+#define SIM_RX_AGC_GAIN (0.5)
+
+typedef struct
+{
+    double Distance;                    /* metres */
+    double Range;                       /* metres */
+    double Noise;
+    double Bursts;                      /* a second */
+    double BurstLevel;
+    double BurstLength;                 /* microseconds */
+    double Time;                        /* the receiver has been followed to */
+    double BurstEnd;
+    double Average;                     /* level seen by the AGC */
+    double Charge;
+    uint8_t Level;                      /* output */
+} Sim_Receiver_t;
+
+/* normally distributed, mean 0 and deviation 1 */
+static double Sim_Gauss(void)
+{
+    double U1;
+    double U2;
+
+    U1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    U2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sqrt(-2 * log(U1)) * cos(2 * SIM_PI * U2);
+}
+
+/*
+ * Follow the receiver to End, with the remote sending Frame from
+ * Start, or sending nothing when Frame is 0, and queue the edges of
+ * its output
+ */
+void Sim_Receive(Sim_Receiver_t *Rx, uint32_t End, uint32_t Start, uint16_t Frame)
+{
+    double Signal;
+
+    Signal = (Rx->Range / Rx->Distance) * (Rx->Range / Rx->Distance);
+    for (; Rx->Time < End; Rx->Time += SIM_CARRIER_US)
+    {
+        double Input;
+        double Threshold;
+        double Over;
+
+        Input = 0;
+        if (Frame && (Rx->Time >= Start) && (Rx->Time < Start + 28 * RC5_HALF_BIT))
+        {
+            int Half;
+            int Bit;
+
+            /* a one is a space then a mark */
+            Half = (int)((Rx->Time - Start) / RC5_HALF_BIT);
+            Bit = (Frame >> (13 - Half / 2)) & 1;
+            Input = ((Half & 1) == Bit) ? Signal : 0;
+        }
+        if ((Rx->Time >= Rx->BurstEnd) && ((double)rand() / RAND_MAX < Rx->Bursts * SIM_CARRIER_US / 1e6))
+        {
+            Rx->BurstEnd = Rx->Time + Rx->BurstLength * rand() / RAND_MAX;
+        }
+        if (Rx->Time < Rx->BurstEnd)
+        {
+            Input += Rx->BurstLevel;
+        }
+        Input = fabs(Input + Rx->Noise * Sim_Gauss());
+
+        Rx->Average += (Input - Rx->Average) * SIM_CARRIER_US / SIM_RX_AGC_US;
+        Threshold = 1 + SIM_RX_AGC_GAIN * Rx->Average;
+        Over = Input / Threshold;
+        if (Over > 1)
+        {
+            Rx->Charge += (SIM_RX_CHARGE * ((Over < SIM_RX_SATURATE) ? Over : SIM_RX_SATURATE) - Rx->Charge) / 4;
+        }
+        else if (Rx->Charge > SIM_RX_DISCHARGE)
+        {
+            Rx->Charge -= SIM_RX_DISCHARGE;
+        }
+        else
+        {
+            Rx->Charge = 0;
+        }
+
+        if (Rx->Level && (Rx->Charge >= SIM_RX_ON))
+        {
+            Rx->Level = 0;
+            Sim_IR((uint32_t)Rx->Time, 0);
+        }
+        else if (!Rx->Level && (Rx->Charge < SIM_RX_OFF))
+        {
+            Rx->Level = 1;
+            Sim_IR((uint32_t)Rx->Time, 1);
+        }
+    }
+}
+
+/*
+ * Run the interrupt handler with TIMER1 showing Time
+ */
+static void Sim_Interrupt(uint32_t Time)
+{
+    if ((Time >> 16) != (Sim_Time >> 16))
+    {
+        PIR1bits.TMR1IF = 1;
+    }
+    Sim_Time = Time;
+    TMR1H = (uint8_t)(Time >> 8);
+    TMR1L = (uint8_t)Time;
+    Sim_InInterrupt = 1;
+    ISR();
+    Sim_InInterrupt = 0;
+}
+
+/*
+ * Advance one sub-tick, without running the application loop
+ */
+void Sim_SubTick(void)
+{
+    uint32_t End;
+
+    End = Sim_Time + SIM_SUBTICK_US;
+    while ((Sim_EdgeTail != Sim_EdgeHead) && (Sim_Edges[Sim_EdgeTail].Time < End))
+    {
+        uint8_t Level;
+        uint32_t Time;
+
+        Level = Sim_Edges[Sim_EdgeTail].Level;
+        Time = Sim_Edges[Sim_EdgeTail].Time;
+        Sim_EdgeTail = (Sim_EdgeTail + 1) % SIM_EDGES;
+        if (Time < Sim_Time)
+        {
+            Time = Sim_Time;
+        }
+        if (Level == Sim_IRLevel)
+        {
+            continue;
+        }
+        Sim_IRLevel = Level;
+        /* TIMER0 counts only the edge T0SE selects, set is falling */
+        if (INTCONbits.TMR0IE && (OPTION_REGbits.T0SE == !Level))
+        {
+            INTCONbits.TMR0IF = 1;
+            Sim_Interrupt(Time);
+        }
+    }
+    PIR1bits.TMR2IF = 1;
+    Sim_Interrupt(End);
+    Sim_RelayStep();
+    Sim_PotStep();
+    Sim_EEStep();
+    if (++Sim_Watchdog > SIM_WDT_SUBTICKS)
+    {
+        Sim_Check(Sim_WatchdogReset, "watchdog timeout");
+        Sim_Reset(SIM_RESET_WATCHDOG);
+    }
+    else if (Sim_ResetAt && (Sim_Time >= Sim_ResetAt))
+    {
+        Sim_ResetAt = 0;
+        Sim_Reset(Sim_ResetCause);
+    }
+    if (Sim_InPass)
+    {
+        Sim_Stall++;
+    }
+}
+
+/*
+ * Cycles
+ *
+ * The cycles a pass runs go on from the start of its sub-tick, and
+ * each time they fill a sub-tick it passes, interrupts and all, in
+ * the middle of the pass as a stall does. Those of the interrupt
+ * handler count against the pass it interrupts. With GIE clear they
+ * are held until it is set again, as the PIC holds the interrupt.
+ * The start up code before the application loop takes no time.
+ * Sim_CycleCount has every cycle charged and Sim_PassCyclesMax the
+ * most of a pass, with its interrupts.
+ */
+#define SIM_SUBTICK_CYCLES (SIM_SUBTICK_US * (_XTAL_FREQ / 4000000ul))
+
+uint32_t Sim_Cycles;                    /* of the pass since its sub-tick started */
+uint64_t Sim_CycleCount;
+uint32_t Sim_PassCyclesMax;
+
+void Sim_Cycle(unsigned int Cycles)
+{
+    Sim_CycleCount += Cycles;
+    Sim_Cycles += Cycles;
+    while (Sim_InPass && !Sim_InInterrupt && INTCONbits.GIE && (Sim_Cycles >= SIM_SUBTICK_CYCLES))
+    {
+        Sim_Cycles -= SIM_SUBTICK_CYCLES;
+        Sim_SubTick();
+    }
+}
+
+/*
+ * CLRWDT(). A clear right after polling a busy WR is the wait for
+ * a write to finish, so time passes until it is done.
+ */
+void Sim_ClearWatchdog(void)
+{
+    Sim_Watchdog = 0;
+    if (Sim_EEPolled && Sim_EEBusy)
+    {
+        Sim_SubTick();
+    }
+    Sim_EEPolled = 0;
+}
+
+/*
+ * The start of main() up to the application loop
+ */
+void Sim_Boot(void)
+{
+    App_Init();
+    Sim_Watchdog = 0;
+}
+
+/*
+ * One pass of the application loop in main()
+ */
+void Sim_Pass(void)
+{
+    uint64_t Start;
+
+    Sim_InPass = 1;
+    Sim_Stall = 0;
+    Sim_EEPolled = 0;
+    Sim_Cycles = 0;
+    Start = Sim_CycleCount;
+    App_Pass();
+    Sim_InPass = 0;
+    if (Sim_Stall > Sim_StallMax)
+    {
+        Sim_StallMax = Sim_Stall;
+    }
+    if (Sim_CycleCount - Start > Sim_PassCyclesMax)
+    {
+        Sim_PassCyclesMax = (uint32_t)(Sim_CycleCount - Start);
+    }
+}
+
+/*
+ * Advance one sub-tick and run a pass when the tick moved
+ */
+void Sim_Step(void)
+{
+    Sim_SubTick();
+    if (Tick != App.LastTick)
+    {
+        Sim_Pass();
+    }
+}
+
+/*
+ * The firmware RAM, listed in sim_ram.h by the Makefile. The values
+ * it has when the test starts are the ones the C start up code gives
+ * it, and are kept to reset it with.
+ */
+typedef enum
+{
+    SIM_RAM_CLEARED,                    /* set by the C start up code */
+    SIM_RAM_PERSISTENT,                 /* __persistent, kept over a reset */
+    SIM_RAM_REGISTER                    /* special function register */
+} Sim_RamKind_t;
+
+typedef struct
+{
+    volatile void *Address;
+    size_t Size;
+    Sim_RamKind_t Kind;
+    const char *Name;
+} Sim_Ram_t;
+
+#define SIM_RAM_CLEAR(Name) { (volatile void *)&Name, sizeof(Name), SIM_RAM_CLEARED, #Name },
+#define SIM_RAM_KEEP(Name) { (volatile void *)&Name, sizeof(Name), SIM_RAM_PERSISTENT, #Name },
+#define SIM_RAM_SFR(Name) { (volatile void *)&Name, sizeof(Name), SIM_RAM_REGISTER, #Name },
+
+const Sim_Ram_t Sim_Ram[] =
+{
+#include "sim_ram.h"
+};
+#define SIM_RAM_COUNT (sizeof(Sim_Ram) / sizeof(Sim_Ram[0]))
+
+uint8_t *Sim_RamStart[SIM_RAM_COUNT];
+uint32_t Sim_Garbage = 0x5EED;
+
+static void Sim_RamCopy(volatile void *To, const volatile void *From, size_t Size)
+{
+    volatile uint8_t *Dst = To;
+    const volatile uint8_t *Src = From;
+
+    while (Size--)
+    {
+        *Dst++ = *Src++;
+    }
+}
+
+__attribute__((constructor)) static void Sim_RamInit(void)
+{
+    size_t Index;
+
+    for (Index = 0; Index < SIM_RAM_COUNT; Index++)
+    {
+        Sim_RamStart[Index] = malloc(Sim_Ram[Index].Size);
+        Sim_RamCopy(Sim_RamStart[Index], Sim_Ram[Index].Address, Sim_Ram[Index].Size);
+    }
+}
+
+/*
+ * Reset the firmware RAM. The registers go back to their reset state
+ * and the C start up code sets the rest of RAM, except __persistent
+ * variables. Those are kept over a warm reset and hold garbage after
+ * power on, the same garbage each run.
+ */
+void Sim_RamReset(uint8_t Cold)
+{
+    size_t Index;
+    size_t Byte;
+
+    for (Index = 0; Index < SIM_RAM_COUNT; Index++)
+    {
+        if (Sim_Ram[Index].Kind != SIM_RAM_PERSISTENT)
+        {
+            Sim_RamCopy(Sim_Ram[Index].Address, Sim_RamStart[Index], Sim_Ram[Index].Size);
+        }
+        else if (Cold)
+        {
+            for (Byte = 0; Byte < Sim_Ram[Index].Size; Byte++)
+            {
+                Sim_Garbage = Sim_Garbage * 1103515245 + 12345;
+                ((volatile uint8_t *)Sim_Ram[Index].Address)[Byte] = Sim_Garbage >> 16;
+            }
+        }
+    }
+}
+
+/*
+ * Idle time
+ *
+ * The time the firmware keeps is the tick count, TIMER1 and its
+ * overflow count, and the deadlines, which are compared with the
+ * tick count by TICK_BEFORE(). A deadline either stays put or, once
+ * it has passed, is kept at the tick count.
+ */
+static volatile uint8_t *const Sim_Deadline[] =
+{
+    &App.OutDeadline, &App.SW_Deadline, &App.MotorDeadline, &App.HoldDeadline,
+    &RC5_GapDeadline, &Tune_MenuDeadline, &IR_HoldDeadline,
+#ifdef DEBUG_SERIAL
+    &Serial_Deadline, &Serial_Timeout,
+#endif
+};
+#define SIM_DEADLINES (sizeof(Sim_Deadline) / sizeof(Sim_Deadline[0]))
+#define SIM_RAM_MAX (512)
+
+/* copy the firmware RAM to Image, returns its length */
+size_t Sim_RamSave(uint8_t *Image)
+{
+    size_t Index;
+    size_t Length;
+
+    for (Index = 0, Length = 0; Index < SIM_RAM_COUNT; Index++)
+    {
+        Sim_Check(Length + Sim_Ram[Index].Size <= SIM_RAM_MAX, "firmware RAM image too small");
+        Sim_RamCopy(Image + Length, Sim_Ram[Index].Address, Sim_Ram[Index].Size);
+        Length += Sim_Ram[Index].Size;
+    }
+    return Length;
+}
+
+/* where a byte of the firmware RAM is in an image */
+static size_t Sim_RamOffset(volatile const void *Address)
+{
+    size_t Index;
+    size_t Length;
+
+    for (Index = 0, Length = 0; Index < SIM_RAM_COUNT; Index++)
+    {
+        if (((volatile const uint8_t *)Address >= (volatile const uint8_t *)Sim_Ram[Index].Address) &&
+            ((volatile const uint8_t *)Address < (volatile const uint8_t *)Sim_Ram[Index].Address + Sim_Ram[Index].Size))
+        {
+            return Length + ((volatile const uint8_t *)Address - (volatile const uint8_t *)Sim_Ram[Index].Address);
+        }
+        Length += Sim_Ram[Index].Size;
+    }
+    Sim_Fail("clock or deadline not in the firmware RAM");
+    return 0;
+}
+
+/*
+ * Run one tick from the start of a tick with Step, and return how
+ * many more ticks would do the same, leaving all but the clock and
+ * the deadlines as they are, or 0 when the tick did something.
+ *
+ * A deadline that stayed put bounds the count to the ticks before
+ * TICK_BEFORE() against it would change. One that moved with the
+ * tick count is moved on with it.
+ */
+static uint32_t Sim_Idle(void (*Step)(void), uint8_t *Follows)
+{
+    static uint8_t Before[SIM_RAM_MAX];
+    static uint8_t After[SIM_RAM_MAX];
+    volatile const void *const Clock[] = {&Tick, &App.LastTick, &TMR1H, &TMR1L, &TMR1_Overflow};
+    size_t Length;
+    uint32_t Ticks;
+    size_t Index;
+    int Sub;
+
+    Length = Sim_RamSave(Before);
+    for (Sub = 0; Sub < SUBTICKS; Sub++)
+    {
+        Step();
+    }
+    Sim_RamSave(After);
+    if (Sim_EEBusy || (Tick != App.LastTick) ||
+        (After[Sim_RamOffset(&Tick)] != (uint8_t)(Before[Sim_RamOffset(&Tick)] + 1)))
+    {
+        return 0;
+    }
+    for (Index = 0; Index < sizeof(Clock) / sizeof(Clock[0]); Index++)
+    {
+        After[Sim_RamOffset(Clock[Index])] = Before[Sim_RamOffset(Clock[Index])];
+    }
+
+    Ticks = UINT32_MAX;
+    for (Index = 0; Index < SIM_DEADLINES; Index++)
+    {
+        size_t Offset;
+        int8_t Passed;
+
+        Offset = Sim_RamOffset(Sim_Deadline[Index]);
+        Follows[Index] = (After[Offset] == (uint8_t)(Before[Offset] + 1));
+        if (!Follows[Index] && (After[Offset] != Before[Offset]))
+        {
+            return 0;
+        }
+        Passed = (int8_t)(Tick - After[Offset]);
+        if (!Follows[Index])
+        {
+            uint32_t Same;
+
+            Same = (Passed < 0) ? -Passed - 1 : 127 - Passed;
+            if (Same < Ticks)
+            {
+                Ticks = Same;
+            }
+        }
+        After[Offset] = Before[Offset];
+    }
+    return memcmp(Before, After, Length) ? 0 : Ticks;
+}
+
+/* End, or the time of the next IR edge or reset when that is sooner */
+static uint32_t Sim_EdgeLimit(uint32_t End)
+{
+    if (Sim_ResetAt && (Sim_ResetAt < End))
+    {
+        End = Sim_ResetAt;
+    }
+    if ((Sim_EdgeTail != Sim_EdgeHead) && (Sim_Edges[Sim_EdgeTail].Time < End))
+    {
+        return Sim_Edges[Sim_EdgeTail].Time;
+    }
+    return End;
+}
+
+/*
+ * Advance towards End with Step, by at least one sub-tick, and skip
+ * idle ticks before End and before the next IR edge. Step is
+ * Sim_Step() or a caller's wrapper of it, and must not change the
+ * stimulus before End, unless it sets Sim_NoSkip while it does.
+ */
+void Sim_AdvanceWith(uint32_t End, void (*Step)(void))
+{
+    uint8_t Follows[SIM_DEADLINES];
+    uint32_t Ticks;
+    uint32_t Limit;
+    uint32_t Time;
+    size_t Index;
+
+    Limit = Sim_EdgeLimit(End);
+    if (Sim_NoSkip || (SubTick != 0) || (Tick != App.LastTick) || Sim_EEBusy || Sim_RelayMoving() || Sim_PotMoving() ||
+        (Sim_Time + 2 * SUBTICKS * SIM_SUBTICK_US > Limit))
+    {
+        Step();
+        return;
+    }
+    Ticks = Sim_Idle(Step, Follows);
+    Limit = Sim_EdgeLimit(End);
+    if (Sim_NoSkip || (Limit < Sim_Time) || Sim_RelayMoving() || Sim_PotMoving())
+    {
+        return;
+    }
+    if ((Limit - Sim_Time) / (SUBTICKS * SIM_SUBTICK_US) < Ticks)
+    {
+        Ticks = (Limit - Sim_Time) / (SUBTICKS * SIM_SUBTICK_US);
+    }
+    if (Ticks == 0)
+    {
+        return;
+    }
+
+    Time = Sim_Time + Ticks * SUBTICKS * SIM_SUBTICK_US;
+    if ((Time >> 16) != (Sim_Time >> 16))
+    {
+        if (PIE1bits.TMR1IE)
+        {
+            TMR1_Overflow += (uint8_t)((Time >> 16) - (Sim_Time >> 16));
+        }
+        else
+        {
+            PIR1bits.TMR1IF = 1;
+        }
+    }
+    Sim_Time = Time;
+    TMR1H = (uint8_t)(Time >> 8);
+    TMR1L = (uint8_t)Time;
+    Tick += (uint8_t)Ticks;
+    App.LastTick += (uint8_t)Ticks;
+    for (Index = 0; Index < SIM_DEADLINES; Index++)
+    {
+        if (Follows[Index])
+        {
+            *Sim_Deadline[Index] += (uint8_t)Ticks;
+        }
+    }
+    Sim_Skipped += Ticks;
+}
+
+void Sim_Advance(uint32_t End)
+{
+    Sim_AdvanceWith(End, Sim_Step);
+}
+
+void Sim_Run(uint32_t Microseconds)
+{
+    uint32_t End;
+
+    End = Sim_Time + Microseconds;
+    while (Sim_Time < End)
+    {
+        Sim_Advance(End);
+    }
+}
+
+/*
+ * Power the controller up. A cold start is a power on reset, a warm
+ * start is a reset from MCLRn with the __persistent RAM kept. The
+ * rest of the firmware RAM is set up again by Sim_RamReset() and the
+ * init functions.
+ */
+void Sim_PowerOn(uint8_t Cold)
+{
+    Sim_RamReset(Cold);
+    PCONbits.nPOR = !Cold;
+    PCONbits.nBOR = 1;
+    Sim_EECON1_Reg.Byte = 0;
+    Sim_EEBusy = 0;
+    Sim_Boot();
+}
+
+/*
+ * Reset the controller with the cause given, see Faults
+ */
+void Sim_Reset(Sim_ResetCause_t Cause)
+{
+    uint32_t End;
+
+    if (Sim_EEBusy)
+    {
+        Sim_Garbage = Sim_Garbage * 1103515245 + 12345;
+        Sim_EE[Sim_EEAddress] ^= (Sim_EE[Sim_EEAddress] ^ Sim_EEData) & (uint8_t)(Sim_Garbage >> 16);
+        Sim_EEWrites[Sim_EEAddress]++;
+        Sim_EEBusy = 0;
+        Sim_EETorn++;
+    }
+    Sim_Check(!Sim_InPass || Sim_ResetJump, "reset in a pass without Sim_ResetJump");
+    Sim_InPass = 0;
+    Sim_RamReset(0);
+    End = Sim_Time + Sim_ResetHold + ((Cause == SIM_RESET_BROWNOUT) ? SIM_PWRT_US : 0);
+    while (Sim_Time < End)
+    {
+        Sim_Time += SIM_SUBTICK_US;
+        Sim_RelayStep();
+        Sim_PotStep();
+    }
+    PCONbits.nPOR = 1;
+    PCONbits.nBOR = (Cause != SIM_RESET_BROWNOUT);
+    Sim_EECON1_Reg.Byte = 0;
+    Sim_EEPolled = 0;
+    Sim_Resets++;
+    Sim_Boot();
+    if (Sim_ResetJump)
+    {
+        longjmp(*Sim_ResetJump, 1);
+    }
+}
+
+/*
+ * Press the key for a source, or (record) with SW_REC
+ */
+void Sim_Press(SelectSwitch_t Key)
+{
+    uint8_t Code;
+
+    Sim_PortAIn |= SW_EN_MASK | 0x08;
+    if (Key == SW_REC)
+    {
+        Sim_PortAIn &= ~0x08;
+        return;
+    }
+    for (Code = 0; Code <= SW_EN_MASK; Code++)
+    {
+        if (SW_EN_Map[Code] == Key)
+        {
+            Sim_PortAIn = (Sim_PortAIn & ~SW_EN_MASK) | Code;
+            return;
+        }
+    }
+}
+
+void Sim_Release(void)
+{
+    Sim_PortAIn |= SW_EN_MASK | 0x08;
+}
+
+#endif /* SIM_H */
@@ -0,0 +1,171 @@
+/*
+ * File:   skip_test.c
+ *
+ * Description:
+ *      Skipping idle time. The same stimulus is run twice, once
+ *      stepping every sub-tick and once skipping idle ticks, and the
+ *      firmware RAM, the data EEPROM and the time must be the same,
+ *      bit for bit, at every checkpoint of the two runs.
+ *
+ *      The stimulus covers the relays settling at power on, the
+ *      first records being written, a front panel key, a held
+ *      (volume) key driving the motor, the tunables menu timing out,
+ *      the coil economiser and a long idle stretch.
+ */
+#include "sim.h"
+
+#define CHECKPOINTS (8192)
+
+typedef struct
+{
+    uint32_t Time;
+    uint8_t Ram[SIM_RAM_MAX];
+    uint8_t EE[SIM_EE_SIZE];
+} Checkpoint_t;
+
+static Checkpoint_t Stepped[CHECKPOINTS];
+static uint16_t Checkpoints;
+static uint16_t Checked;
+static size_t Ram_Length;
+static Sim_Relay_t Relays[SIM_RELAYS];
+static Sim_Pot_t Pot;
+
+/* the name of the firmware variable at Offset in a RAM image */
+static const char *Ram_Name(size_t Offset)
+{
+    size_t Index;
+
+    for (Index = 0; Index < SIM_RAM_COUNT; Index++)
+    {
+        if (Offset < Sim_Ram[Index].Size)
+        {
+            return Sim_Ram[Index].Name;
+        }
+        Offset -= Sim_Ram[Index].Size;
+    }
+    return "?";
+}
+
+static void Checkpoint(void)
+{
+    Checkpoint_t Now;
+    size_t Offset;
+
+    Sim_Check(Checkpoints < CHECKPOINTS, "too many checkpoints");
+    memset(&Now, 0, sizeof(Now));
+    Now.Time = Sim_Time;
+    Ram_Length = Sim_RamSave(Now.Ram);
+    memcpy(Now.EE, Sim_EE, sizeof(Now.EE));
+    if (Sim_NoSkip)
+    {
+        Stepped[Checkpoints++] = Now;
+        return;
+    }
+    Sim_Check(Now.Time == Stepped[Checkpoints].Time, "skipping ended at another time");
+    Sim_Check(memcmp(Now.EE, Stepped[Checkpoints].EE, sizeof(Now.EE)) == 0,
+              "data EEPROM differs from stepping");
+    for (Offset = 0; Offset < Ram_Length; Offset++)
+    {
+        if (Now.Ram[Offset] != Stepped[Checkpoints].Ram[Offset])
+        {
+            printf("skip_test: %s differs from stepping at %lu us\n", Ram_Name(Offset),
+                   (unsigned long)Sim_Time);
+            Sim_Fail("skipping is not bit-exact");
+        }
+    }
+    Checkpoints++;
+    Checked++;
+}
+
+/* run for Microseconds with a checkpoint every Every */
+static void Run(uint32_t Microseconds, uint32_t Every)
+{
+    uint32_t End;
+
+    End = Sim_Time + Microseconds;
+    while (Sim_Time < End)
+    {
+        Sim_Run((End - Sim_Time < Every) ? End - Sim_Time : Every);
+        Checkpoint();
+    }
+}
+
+static void Stimulus(void)
+{
+    uint16_t Frame;
+    uint32_t Time;
+    int Count;
+
+    Sim_Time = 0;
+    Sim_Garbage = 0x5EED;
+    Sim_IRLevel = 1;
+    Sim_EdgeHead = Sim_EdgeTail = 0;
+    Sim_Skipped = 0;
+    memcpy(Sim_Relay, Relays, sizeof(Sim_Relay));
+    Sim_Pot = Pot;
+    Sim_Release();
+    memset(Sim_EE, 0xFF, sizeof(Sim_EE));
+    srand(1);
+    Sim_PowerOn(1);
+    Checkpoints = 0;
+
+    /* power on, relays settle and the records are written */
+    Run(3000000, 7000);
+
+    /* (cd) and a second press for (mute) */
+    Sim_Press(SW_3);
+    Run(60000, 3000);
+    Sim_Release();
+    Run(500000, 7000);
+    Sim_Press(SW_3);
+    Run(60000, 3000);
+    Sim_Release();
+    Run(2000000, 13000);
+
+    /* (volume) up held for five repeats, with jitter */
+    Frame = Sim_RC5Frame(RC5_SYSTEM, 16, 1);
+    Time = Sim_Time + 1000;
+    for (Count = 0; Count < 5; Count++)
+    {
+        Sim_RC5(Time, Frame, 0, 100);
+        Time += 113778;
+    }
+    Run(3000000, 11000);
+
+    /* (menu) opens the tunables menu, which times out */
+    Sim_RC5(Sim_Time + 1000, Sim_RC5Frame(RC5_SYSTEM, 15, 0), 0, 0);
+    Run(15000000, 17000);
+
+    /* a noise mark, then the coil economiser at a quarter */
+    Sim_IR(Sim_Time + 1000, 0);
+    Sim_IR(Sim_Time + 1700, 1);
+    Tune_Set(TUNE_HOLD_DUTY, 1);
+    Sim_Press(SW_5);
+    Run(60000, 3000);
+    Sim_Release();
+    Run(5000000, 19000);
+
+    /* idle */
+    Run(600000000, 1000000);
+}
+
+int main(void)
+{
+    uint32_t Ticks;
+
+    memcpy(Relays, Sim_Relay, sizeof(Relays));
+    Pot = Sim_Pot;
+    Sim_NoSkip = 1;
+    Stimulus();
+    Ticks = Sim_Time / (SUBTICKS * SIM_SUBTICK_US);
+    Sim_Check(Sim_Skipped == 0, "ticks skipped while stepping");
+
+    Sim_NoSkip = 0;
+    Stimulus();
+    printf("skip_test: %lu ms simulated, %lu of %lu ticks skipped\n", (unsigned long)(Sim_Time / 1000),
+           (unsigned long)Sim_Skipped, (unsigned long)Ticks);
+    printf("skip_test: %u checkpoints of %u bytes of firmware RAM the same as stepping\n", Checked,
+           (unsigned)Ram_Length);
+    Sim_Check(Sim_Skipped > Ticks / 2, "most idle ticks not skipped");
+    return 0;
+}
@@ -0,0 +1,537 @@
+/*
+ * File:   tune_sweep.c
+ *
+ * Description:
+ *      Sweeps the switch debounce, the RC5 interval tolerance and the
+ *      relay mute and settle times over the scenario corpus, with
+ *      noise on the stimulus, and reports the latency, false triggers
+ *      and click windows of each setting. Prints the Pareto front and
+ *      writes the recommended setting as a data EEPROM image in the
+ *      record format Tune_Init() reads: tag, data and CRC at
+ *      EE_TUNABLES.
+ *
+ *      Usage: tune_sweep [-j jobs] [-s seeds] [-o image.hex]
+ *                        [-v <axis>=<value>,...] file.scn ...
+ *
+ *      Settings run in jobs processes at once, by default one for
+ *      each processor. Each scenario of a setting runs seeds times,
+ *      each with noise drawn from its own seed, 1 to seeds. -v sets
+ *      the values swept on an axis, one of those in Axis[]; the
+ *      tunables not swept keep their defaults.
+ *
+ *      Exit status is 0 when the recommended setting has no missed
+ *      expectation, false trigger or click, 1 when none does and 2
+ *      on a usage error or a scenario that does not compile.
+ *
+ * Noise:
+ *      Each run draws a unit from its seed. Every edge of the switch
+ *      lines bounces for up to NOISE_BOUNCE_US, the contact made and
+ *      apart by turns for up to a gap drawn up to NOISE_GAP_US, so a
+ *      worn switch can stay apart for longer than a short debounce.
+ *      Each relay is drawn up to twice as slow as the simulator's,
+ *      and RC5 frames are sent with a receiver stretch and edge
+ *      jitter, see Sim_RC5().
+ *
+ * Scoring:
+ *      The scenarios run as scenario.c runs them, with the setting
+ *      loaded from data EEPROM at power on, except that a failed
+ *      expectation is counted and the run goes on:
+ *
+ *      latency     the mean wait of each "expect ... within" up to
+ *                  RUN_REACTION_US, from the statement to the line
+ *                  changing, or the whole time when it does not
+ *      missed      "expect ... within" that timed out, and runs the
+ *                  simulator failed
+ *      false       "expect" of a line that was to stay as it was,
+ *                  and did not
+ *      clicks      source relay contacts bouncing while unmuted,
+ *                  see Sim_RelayClicks
+ *
+ *      A failed expectation can lead to more later in the same run,
+ *      so the counts rank settings rather than count faults. A
+ *      setting is on the Pareto front when no other is as good in
+ *      all four and better in one. The recommended setting is the
+ *      one of least latency with no missed, false or click, or with
+ *      the fewest of them when there is none.
+ *
+ *      The image is Intel HEX with the data EEPROM at 0x4200, as
+ *      motor_fit.c writes it.
+ */
+#define _DEFAULT_SOURCE
+#include "sim.h"
+#undef _DEFAULT_SOURCE                  /* defined again by scenario.c */
+
+#include <sys/mman.h>
+
+#define main Scenario_Main
+#include "scenario.c"
+#undef main
+
+#define FILES (16)
+#define AXES (5)
+#define VALUES (8)
+#define NOISE_BOUNCE_US (8000)
+#define NOISE_GAP_US (3000)
+#define IMAGE_ADDRESS (0x4200)
+
+typedef struct
+{
+    const char *Name;
+    uint8_t Id;
+    uint8_t Count;
+    uint8_t Value[VALUES];
+} Axis_t;
+
+static Axis_t Axis[AXES] =
+{
+    {"min",     TUNE_DEBOUNCE_MIN,      4,  {1, 3, 5, 8}},
+    {"margin",  TUNE_DEBOUNCE_MARGIN,   4,  {0, 2, 4, 6}},
+    {"rc5",     TUNE_RC5_TOLERANCE,     3,  {50, 80, 111}},
+    {"mute",    TUNE_RELAY_MUTE,        3,  {2, 5, 8}},
+    {"settle",  TUNE_RELAY_SETTLE,      4,  {4, 7, 10, 14}},
+};
+
+typedef struct
+{
+    double Latency;                     /* milliseconds */
+    uint32_t Missed;
+    uint32_t False;
+    uint32_t Clicks;
+} Score_t;
+
+static Compiler_t Corpus[FILES];
+static int Files;
+static unsigned int Seeds = 4;
+static Run_Measure_t *Measure;
+
+static uint32_t Draw(uint32_t Low, uint32_t High)
+{
+    return Low + (uint32_t)rand() % (High - Low + 1);
+}
+
+/*
+ * Switch noise
+ *
+ * A change of the switch lines the scenario makes starts a bounce.
+ * While the contact is apart the lines that changed read as they
+ * were, through Sim_PortAHigh and Sim_PortALow. Sim_NoSkip is set
+ * through a bounce, as the scenario does not bound the idle ticks
+ * skipped by its changes.
+ */
+static uint32_t Noise_Bounce;           /* longest bounce of an edge */
+static uint32_t Noise_Gap;              /* longest the contact stays made or apart */
+static uint8_t Noise_Keys;
+static uint8_t Noise_Lines;
+static uint8_t Noise_Apart;
+static uint32_t Noise_End;
+static uint32_t Noise_Next;
+
+static void Noise_Step(void)
+{
+    uint8_t Keys;
+
+    Keys = Sim_PortAIn & (SW_EN_MASK | 0x08);
+    if (Keys != Noise_Keys)
+    {
+        Noise_Lines = Keys ^ Noise_Keys;
+        Noise_Keys = Keys;
+        Noise_End = Sim_Time + Draw(0, Noise_Bounce);
+        Noise_Next = Sim_Time;
+        Noise_Apart = 0;
+    }
+    Sim_NoSkip = (Sim_Time < Noise_End);
+    if (!Sim_NoSkip)
+    {
+        Noise_Apart = 0;
+    }
+    while (Sim_NoSkip && (Sim_Time >= Noise_Next))
+    {
+        Noise_Apart ^= 1;
+        Noise_Next += Draw(50, Noise_Gap);
+    }
+    Sim_PortAHigh = Noise_Apart ? Noise_Lines & ~Keys : 0;
+    Sim_PortALow = Noise_Apart ? Noise_Lines & Keys : 0;
+}
+
+/* the unit of a run, from its seed */
+static void Noise_Draw(unsigned int Seed)
+{
+    int Index;
+
+    srand(Seed);
+    Noise_Bounce = Draw(1000, NOISE_BOUNCE_US);
+    Noise_Gap = Draw(300, NOISE_GAP_US);
+    Noise_Keys = SW_EN_MASK | 0x08;
+    for (Index = 0; Index < SIM_RELAYS; Index++)
+    {
+        Sim_Relay[Index].Operate += Draw(0, 2 * Sim_Relay[Index].Operate);
+        Sim_Relay[Index].Bounce += Draw(0, 2 * Sim_Relay[Index].Bounce);
+        Sim_Relay[Index].Release += Draw(0, 2 * Sim_Relay[Index].Release);
+        Sim_Relay[Index].Break += Draw(0, 2 * Sim_Relay[Index].Break);
+    }
+    Run_Stretch = (int)Draw(0, 400) - 200;
+    Run_Jitter = (int)Draw(0, 150);
+    Run_Noise = Noise_Step;
+}
+
+/*
+ * Settings
+ */
+static int Settings(void)
+{
+    int Count;
+    int Index;
+
+    for (Count = 1, Index = 0; Index < AXES; Index++)
+    {
+        Count *= Axis[Index].Count;
+    }
+    return Count;
+}
+
+/* the tunables of setting Setting, the defaults where not swept */
+static void Setting_Tunables(int Setting, uint8_t *Tunables)
+{
+    int Index;
+
+    for (Index = 0; Index < TUNE_COUNT; Index++)
+    {
+        Tunables[Index] = Tune_Limit[Index].Default;
+    }
+    for (Index = AXES - 1; Index >= 0; Index--)
+    {
+        Tunables[Axis[Index].Id] = Axis[Index].Value[Setting % Axis[Index].Count];
+        Setting /= Axis[Index].Count;
+    }
+}
+
+static void Image_Make(uint8_t *Image, const uint8_t *Tunables)
+{
+    uint8_t Crc;
+    uint8_t Index;
+
+    memset(Image, 0xFF, SIM_EE_SIZE);
+    Image[EE_TUNABLES] = EE_TAG_TUNABLES;
+    Crc = CRC8(0, EE_TAG_TUNABLES);
+    for (Index = 0; Index < TUNE_COUNT; Index++)
+    {
+        Image[EE_TUNABLES + 1 + Index] = Tunables[Index];
+        Crc = CRC8(Crc, Tunables[Index]);
+    }
+    Image[EE_TUNABLES + 1 + TUNE_COUNT] = Crc;
+}
+
+/* the image as Intel HEX, eight bytes of data EEPROM a line */
+static int Image_Write(const char *Name, const uint8_t *Image)
+{
+    FILE *File;
+    uint8_t Line;
+    uint8_t Index;
+
+    File = fopen(Name, "w");
+    if (File == NULL)
+    {
+        return 0;
+    }
+    for (Line = 0; Line < SIM_EE_SIZE; Line += 8)
+    {
+        uint16_t Address;
+        uint8_t Sum;
+
+        Address = IMAGE_ADDRESS + 2 * Line;
+        fprintf(File, ":10%04X00", Address);
+        Sum = 0x10 + (uint8_t)(Address >> 8) + (uint8_t)Address;
+        for (Index = 0; Index < 8; Index++)
+        {
+            fprintf(File, "%02X00", Image[Line + Index]);
+            Sum += Image[Line + Index];
+        }
+        fprintf(File, "%02X\n", (uint8_t)-Sum);
+    }
+    fprintf(File, ":00000001FF\n");
+    return fclose(File) == 0;
+}
+
+/*
+ * Sweep
+ */
+
+/* run every scenario of the corpus with every seed at Setting */
+static void Sweep_Setting(int Setting)
+{
+    uint8_t Tunables[TUNE_COUNT];
+    uint8_t Image[SIM_EE_SIZE];
+    unsigned int Seed;
+    int File;
+
+    Setting_Tunables(Setting, Tunables);
+    Image_Make(Image, Tunables);
+    for (File = 0; File < Files; File++)
+    {
+        for (Seed = 1; Seed <= Seeds; Seed++)
+        {
+            pid_t Child;
+            int Status;
+
+            fflush(stdout);
+            Child = fork();
+            if (Child == 0)
+            {
+                /* the simulator reports a failure it ends the run on */
+                if (freopen("/dev/null", "w", stdout) == NULL)
+                {
+                    _exit(1);
+                }
+                Noise_Draw(Seed);
+                Sim_RelayQuiet = 1;
+                Run_Image = Image;
+                Run_Measure = &Measure[Setting];
+                _exit(Run(Corpus[File].File, Corpus[File].Code));
+            }
+            if ((Child < 0) || (waitpid(Child, &Status, 0) < 0) || !WIFEXITED(Status) || WEXITSTATUS(Status))
+            {
+                atomic_fetch_add(&Measure[Setting].Broken, 1);
+            }
+        }
+    }
+}
+
+/* run the settings in Jobs processes at once */
+static int Sweep(int Jobs)
+{
+    int Count;
+    int Next;
+    int Running;
+    int Failed;
+
+    Count = Settings();
+    Failed = 0;
+    for (Next = 0, Running = 0; (Next < Count) || Running; )
+    {
+        int Status;
+
+        if ((Next < Count) && (Running < Jobs))
+        {
+            pid_t Child;
+
+            fflush(stdout);
+            Child = fork();
+            if (Child == 0)
+            {
+                Sweep_Setting(Next);
+                _exit(0);
+            }
+            if (Child < 0)
+            {
+                return 0;
+            }
+            Next++;
+            Running++;
+            continue;
+        }
+        if ((wait(&Status) < 0) || !WIFEXITED(Status) || WEXITSTATUS(Status))
+        {
+            Failed = 1;
+        }
+        Running--;
+    }
+    return !Failed;
+}
+
+static void Score(int Setting, Score_t *S)
+{
+    const Run_Measure_t *M = &Measure[Setting];
+    unsigned int Waits;
+
+    Waits = atomic_load(&M->Waits);
+    S->Latency = Waits ? atomic_load(&M->Waited) / 1000.0 / Waits : 0;
+    S->Missed = atomic_load(&M->Late) + atomic_load(&M->Broken);
+    S->False = atomic_load(&M->Wrong);
+    S->Clicks = atomic_load(&M->Clicks);
+}
+
+static uint32_t Faults(const Score_t *S)
+{
+    return S->Missed + S->False + S->Clicks;
+}
+
+/* A is as good as B in every measure and better in one */
+static int Dominates(const Score_t *A, const Score_t *B)
+{
+    if ((A->Latency > B->Latency) || (A->Missed > B->Missed) || (A->False > B->False) || (A->Clicks > B->Clicks))
+    {
+        return 0;
+    }
+    return (A->Latency < B->Latency) || (A->Missed < B->Missed) || (A->False < B->False) || (A->Clicks < B->Clicks);
+}
+
+static void Print(int Setting, const Score_t *S, const char *Note)
+{
+    uint8_t Tunables[TUNE_COUNT];
+    int Index;
+
+    Setting_Tunables(Setting, Tunables);
+    for (Index = 0; Index < AXES; Index++)
+    {
+        printf(" %7u", Tunables[Axis[Index].Id]);
+    }
+    printf(" %8.2f %7lu %7lu %7lu  %s\n", S->Latency, (unsigned long)S->Missed,
+           (unsigned long)S->False, (unsigned long)S->Clicks, Note);
+}
+
+/* -v <axis>=<value>,... */
+static int Axis_Values(const char *Text)
+{
+    size_t Length;
+    int Index;
+
+    for (Index = 0; Index < AXES; Index++)
+    {
+        Length = strlen(Axis[Index].Name);
+        if ((strncmp(Text, Axis[Index].Name, Length) == 0) && (Text[Length] == '='))
+        {
+            Axis_t *A = &Axis[Index];
+            const char *Next = Text + Length;
+
+            for (A->Count = 0; (*Next == '=') || (*Next == ','); A->Count++)
+            {
+                char *End;
+                unsigned long Value;
+
+                Value = strtoul(Next + 1, &End, 10);
+                if ((End == Next + 1) || (A->Count == VALUES) ||
+                    (Value < Tune_Limit[A->Id].Min) || (Value > Tune_Limit[A->Id].Max))
+                {
+                    return 0;
+                }
+                A->Value[A->Count] = (uint8_t)Value;
+                Next = End;
+            }
+            return *Next == '\0';
+        }
+    }
+    return 0;
+}
+
+static int Usage(void)
+{
+    fprintf(stderr, "usage: tune_sweep [-j jobs] [-s seeds] [-o image.hex]\n"
+                    "                  [-v min|margin|rc5|mute|settle=<value>,...] file.scn ...\n");
+    return 2;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *Output = NULL;
+    long Jobs;
+    int Count;
+    int Setting;
+    int Other;
+    int Best;
+    int Default;
+    int Option;
+    Score_t *S;
+    uint8_t Tunables[TUNE_COUNT];
+    uint8_t Image[SIM_EE_SIZE];
+
+    Jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((Option = getopt(argc, argv, "j:s:o:v:")) != -1)
+    {
+        if ((Option == 'j') && (atoi(optarg) > 0))
+        {
+            Jobs = atoi(optarg);
+        }
+        else if ((Option == 's') && (atoi(optarg) > 0))
+        {
+            Seeds = (unsigned int)atoi(optarg);
+        }
+        else if (Option == 'o')
+        {
+            Output = optarg;
+        }
+        else if ((Option != 'v') || !Axis_Values(optarg))
+        {
+            return Usage();
+        }
+    }
+    if ((optind == argc) || (argc - optind > FILES))
+    {
+        return Usage();
+    }
+    for (Files = 0; optind < argc; optind++, Files++)
+    {
+        FILE *Input;
+
+        Input = fopen(argv[optind], "r");
+        if (!Input)
+        {
+            perror(argv[optind]);
+            return 2;
+        }
+        Corpus[Files].File = argv[optind];
+        Compile(&Corpus[Files], Input);
+        fclose(Input);
+    }
+
+    Count = Settings();
+    Measure = mmap(NULL, Count * sizeof(Run_Measure_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    S = calloc(Count, sizeof(Score_t));
+    if ((Measure == MAP_FAILED) || (S == NULL) || !Sweep(Jobs < 1 ? 1 : (int)Jobs))
+    {
+        fprintf(stderr, "tune_sweep: a sweep process failed\n");
+        return 2;
+    }
+
+    Best = 0;
+    Default = -1;
+    for (Setting = 0; Setting < Count; Setting++)
+    {
+        int Index;
+
+        Score(Setting, &S[Setting]);
+        if ((Faults(&S[Setting]) < Faults(&S[Best])) ||
+            ((Faults(&S[Setting]) == Faults(&S[Best])) && (S[Setting].Latency < S[Best].Latency)))
+        {
+            Best = Setting;
+        }
+        Setting_Tunables(Setting, Tunables);
+        for (Index = 0; (Index < TUNE_COUNT) && (Tunables[Index] == Tune_Limit[Index].Default); Index++)
+        {
+        }
+        if (Index == TUNE_COUNT)
+        {
+            Default = Setting;
+        }
+    }
+
+    printf("tune_sweep: %d settings, %d scenarios, %u seeds\n", Count, Files, Seeds);
+    for (Other = 0; Other < AXES; Other++)
+    {
+        printf(" %7s", Axis[Other].Name);
+    }
+    printf(" %8s %7s %7s %7s\n", "latency", "missed", "false", "clicks");
+    for (Setting = 0; Setting < Count; Setting++)
+    {
+        for (Other = 0; (Other < Count) && !Dominates(&S[Other], &S[Setting]); Other++)
+        {
+        }
+        if ((Other == Count) || (Setting == Default) || (Setting == Best))
+        {
+            char Note[40];
+
+            snprintf(Note, sizeof(Note), "%s%s%s", (Setting == Best) ? "recommended" : "",
+                     ((Setting == Best) && (Setting == Default)) ? ", " : "",
+                     (Setting == Default) ? ((Other == Count) ? "default" : "default, dominated") : "");
+            Print(Setting, &S[Setting], Note);
+        }
+    }
+
+    Setting_Tunables(Best, Tunables);
+    Image_Make(Image, Tunables);
+    if (Output && !Image_Write(Output, Image))
+    {
+        fprintf(stderr, "tune_sweep: cannot write %s\n", Output);
+        return 2;
+    }
+    return Faults(&S[Best]) ? 1 : 0;
+}
@@ -0,0 +1,322 @@
+/*
+ * File:   wear_test.c
+ *
+ * Description:
+ *      Data EEPROM wear over the life of the unit, from the writes
+ *      Sim_EEWrites[] counts for each cell under a model of use.
+ *
+ *      A day of use is two power ons, USE_PRESSES presses of the
+ *      front panel keys and USE_VOLUME moves of the volume motor.
+ *      Presses bounce for 4 to 6 ticks when new, getting longer as
+ *      the switches wear, up to 8 to 10 ticks at the end of the
+ *      target life. Days are sampled across the target life, and
+ *      the writes of the hottest cell a day give the years until it
+ *      reaches its endurance. A layout whose hottest cell wears out
+ *      within TARGET_YEARS is flagged.
+ *
+ *      The layouts are the firmware's own and two others, made by
+ *      the test on top of it:
+ *          firmware        as built
+ *          every change    the learned debounce saved whenever a
+ *                          learned bounce changes
+ *          panel record    the source, (mute), (record) and volume
+ *                          kept in a data EEPROM record written on
+ *                          each change, in place of retained RAM.
+ *                          Its writes are counted, not made.
+ *
+ *      The firmware must not be flagged and the panel record must
+ *      be. Then PRESSES presses of random keys with a 4 to 6 tick
+ *      bounce are made with the firmware and the every change
+ *      layout, the check behind SW_SAVE_DELTA.
+ *
+ *      Usage: wear_test [presses]
+ */
+#include "sim.h"
+
+#define ENDURANCE (100000)      /* erase/write cycles of a cell, the least rated */
+#define TARGET_YEARS (10)
+#define SAMPLE_DAYS (30)
+#define USE_PRESSES (50)
+#define USE_VOLUME (40)
+#define PRESSES (100000)
+#define PRESSES_A_DAY (1000)
+#define EE_PANEL (0x28)         /* the panel record: tag, PortB, PortC, volume, CRC */
+#define EE_PANEL_SIZE (6)
+
+typedef enum {LAYOUT_FIRMWARE, LAYOUT_EVERY_CHANGE, LAYOUT_PANEL, LAYOUTS} Layout_t;
+
+static const char *const Layout_Name[LAYOUTS] = {"firmware", "every change", "panel record"};
+
+static Layout_t Layout;
+static uint8_t Learned[SW_KEYS];
+static uint8_t Panel[EE_PANEL_SIZE - 2];
+static uint32_t Writes[SIM_EE_SIZE];
+static double Age;                      /* years */
+
+/* count a write of Value to Address when it changes the cell */
+static void Panel_Write(uint8_t Address, uint8_t Value)
+{
+    if (Sim_EE[Address] != Value)
+    {
+        Sim_EE[Address] = Value;
+        Sim_EEWrites[Address]++;
+    }
+}
+
+/*
+ * One sub-tick, with the layout's writes. The firmware saves its
+ * own records.
+ */
+static void Step(void)
+{
+    uint8_t Key;
+
+    Sim_Step();
+    if (Layout == LAYOUT_EVERY_CHANGE)
+    {
+        for (Key = 0; Key < SW_KEYS; Key++)
+        {
+            uint8_t Bounce;
+
+            Bounce = SW_Learn[Key] & SW_LEARN_BOUNCE;
+            if (Bounce != Learned[Key])
+            {
+                Learned[Key] = Bounce;
+                if (Bounce != Sim_EE[EE_DEBOUNCE + 1 + Key])
+                {
+                    EE_Save(EE_RECORD_DEBOUNCE);
+                }
+            }
+        }
+    }
+    else if ((Layout == LAYOUT_PANEL) && (App.MotorDrive == MOTOR_STOP))
+    {
+        uint8_t Now[EE_PANEL_SIZE - 2];
+        uint8_t Index;
+
+        Now[0] = App.Panel.PortB;
+        Now[1] = App.Panel.PortC;
+        Now[2] = (uint8_t)(App.Volume >> 8);
+        Now[3] = (uint8_t)App.Volume;
+        if (memcmp(Now, Panel, sizeof(Panel)) != 0)
+        {
+            /* the CRC changes with the data */
+            for (Index = 0; Index < sizeof(Panel); Index++)
+            {
+                Panel_Write(EE_PANEL + 1 + Index, Now[Index]);
+            }
+            Panel_Write(EE_PANEL + EE_PANEL_SIZE - 1, Sim_EE[EE_PANEL + EE_PANEL_SIZE - 1] + 1);
+            memcpy(Panel, Now, sizeof(Panel));
+        }
+    }
+}
+
+static void Run(uint32_t Microseconds)
+{
+    uint32_t End;
+
+    End = Sim_Time + Microseconds;
+    while (Sim_Time < End)
+    {
+        Sim_AdvanceWith(End, Step);
+    }
+}
+
+static uint32_t Random(uint32_t Low, uint32_t High)
+{
+    return Low + (uint32_t)rand() % (High - Low + 1);
+}
+
+/* a press that bounces for Bounce ticks, and a shorter bounce on release */
+static void Press(SelectSwitch_t Key, uint32_t Bounce)
+{
+    uint32_t Tick;
+
+    Sim_Press(Key);
+    for (Tick = 1; Tick < Bounce; Tick++)
+    {
+        Run(1000);
+        if (rand() & 1)
+        {
+            Sim_Press(Key);
+        }
+        else
+        {
+            Sim_Release();
+        }
+    }
+    Run(1000);
+    Sim_Press(Key);
+    Run(Random(80000, 300000));
+    Sim_Release();
+    Run(1000);
+    Sim_Press(Key);
+    Run(1000);
+    Sim_Release();
+    Run(Random(100000, 1000000));
+}
+
+/*
+ * Power on after a night off: the relays open, the shaft still and
+ * the time back at 0, so a run never passes the 71 minutes Sim_Time
+ * holds.
+ */
+static void Power_On(void)
+{
+    uint8_t Index;
+
+    for (Index = 0; Index < SIM_RELAYS; Index++)
+    {
+        Sim_Relay[Index].Since = Sim_Relay[Index].Touch = 0;
+        Sim_Relay[Index].Coil = Sim_Relay[Index].Closed = 0;
+        Sim_Relay[Index].Click = Sim_Relay[Index].Moved = 0;
+    }
+    Sim_Pot.Speed = 0;
+    Sim_Pot.Driven = Sim_Pot.Stopped = 0;
+    Sim_Time = 0;
+    Sim_EdgeHead = Sim_EdgeTail = 0;
+    Sim_Release();
+    Sim_PowerOn(1);
+    memcpy(Learned, SW_Learn, sizeof(Learned));
+    Run(1000000);
+}
+
+/* a day of use, the switches bouncing for their age */
+static void Day(void)
+{
+    uint32_t Shortest;
+    int Half;
+    int Count;
+
+    Shortest = 4 + (uint32_t)(4 * Age / TARGET_YEARS);
+    for (Half = 0; Half < 2; Half++)
+    {
+        Power_On();
+        for (Count = 0; Count < USE_PRESSES / 2; Count++)
+        {
+            Press((SelectSwitch_t)Random(SW_1, SW_REC), Random(Shortest, Shortest + 2));
+        }
+        for (Count = 0; Count < USE_VOLUME / 2; Count++)
+        {
+            Motor_Request((rand() & 1) ? MOTOR_UP : MOTOR_DOWN);
+            Run(Random(200000, 2000000));
+            Motor_Request(MOTOR_STOP);
+            Run(Random(500000, 5000000));
+        }
+    }
+}
+
+/* the cell written most, and its writes */
+static uint8_t Hottest(uint32_t *Count)
+{
+    uint8_t Address;
+    uint8_t Hot;
+
+    for (Hot = 0, Address = 0; Address < SIM_EE_SIZE; Address++)
+    {
+        if (Writes[Address] > Writes[Hot])
+        {
+            Hot = Address;
+        }
+    }
+    *Count = Writes[Hot];
+    return Hot;
+}
+
+/* start with erased data EEPROM, and count from the first power on */
+static void Start(Layout_t Which)
+{
+    Layout = Which;
+    memset(Sim_EE, 0xFF, sizeof(Sim_EE));
+    memset(Panel, 0xFF, sizeof(Panel));
+    Power_On();
+    memset(Sim_EEWrites, 0, sizeof(Sim_EEWrites));
+    memset(Writes, 0, sizeof(Writes));
+}
+
+/* add the writes since the last call */
+static void Count_Writes(void)
+{
+    uint8_t Address;
+
+    for (Address = 0; Address < SIM_EE_SIZE; Address++)
+    {
+        Writes[Address] += Sim_EEWrites[Address];
+    }
+    memset(Sim_EEWrites, 0, sizeof(Sim_EEWrites));
+}
+
+/* years until the hottest cell wears out */
+static double Life(Layout_t Which)
+{
+    uint32_t Count;
+    uint8_t Hot;
+    double Daily;
+    double Years;
+    int Days;
+
+    srand(100);
+    Start(Which);
+    for (Days = 0; Days < SAMPLE_DAYS; Days++)
+    {
+        Age = (double)TARGET_YEARS * Days / SAMPLE_DAYS;
+        Day();
+        Count_Writes();
+    }
+    Hot = Hottest(&Count);
+    Daily = (double)Count / SAMPLE_DAYS;
+    Years = Daily ? ENDURANCE / Daily / 365 : 1e9;
+    printf("wear_test: %-12s hottest cell 0x%02X, %.2f writes a day, worn out in %.0f years%s\n",
+           Layout_Name[Which], Hot, Daily, Years, (Years < TARGET_YEARS) ? ", FLAGGED" : "");
+    return Years;
+}
+
+/*
+ * Writes of the hottest cell in Presses presses of random keys, with
+ * a power on every PRESSES_A_DAY presses
+ */
+static uint32_t Press_Wear(Layout_t Which, long Presses)
+{
+    uint32_t Count;
+    uint8_t Hot;
+    long Index;
+
+    srand(1);
+    Start(Which);
+    for (Index = 0; Index < Presses; Index++)
+    {
+        Press((SelectSwitch_t)Random(SW_1, SW_REC), Random(4, 6));
+        if ((Index % PRESSES_A_DAY) == PRESSES_A_DAY - 1)
+        {
+            Count_Writes();
+            Power_On();
+        }
+    }
+    Count_Writes();
+    Hot = Hottest(&Count);
+    printf("wear_test: %-12s %ld presses, hottest cell 0x%02X written %lu times\n", Layout_Name[Which],
+           Presses, Hot, (unsigned long)Count);
+    return Count;
+}
+
+int main(int argc, char *argv[])
+{
+    long Presses;
+    uint32_t Firmware;
+    uint32_t Every;
+
+    Presses = (argc > 1) ? atol(argv[1]) : PRESSES;
+    /* the relays all drop at each power off, a thump the amplifier makes too */
+    Sim_RelayQuiet = 1;
+
+    printf("wear_test: %d presses and %d volume moves a day, %d days sampled over %d years\n",
+           USE_PRESSES, USE_VOLUME, SAMPLE_DAYS, TARGET_YEARS);
+    Sim_Check(Life(LAYOUT_FIRMWARE) >= TARGET_YEARS, "firmware layout wears out within the target life");
+    Life(LAYOUT_EVERY_CHANGE);
+    Sim_Check(Life(LAYOUT_PANEL) < TARGET_YEARS, "panel record not flagged");
+
+    Firmware = Press_Wear(LAYOUT_FIRMWARE, Presses);
+    Every = Press_Wear(LAYOUT_EVERY_CHANGE, Presses);
+    Sim_Check(Firmware < Every, "SW_SAVE_DELTA does not save writes");
+    return 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * File:   xc.h
+ *
+ * Target: host (gcc or clang), for the simulator in this directory
+ *
+ * Description:
+ *      Stand in for the XC8 <xc.h> of the PIC16F870 so main.c can be
+ *      compiled and run on the host. The special function registers
+ *      are plain variables, with the bit fields and the whole byte of
+ *      a register sharing storage as they do on the part.
+ *
+ *      The data EEPROM registers are reached through functions in
+ *      sim.h so a write can take time to finish, a read can load the
+ *      cell, and a read while a write is in progress can be counted.
+ *
+ *      PORTA is reached through a function too, so the bits TRISA
+ *      makes inputs read the switch lines as the test drives them,
+ *      whatever was written to the latch.
+ *
+ *      CLRWDT() calls into sim.h as well, to clear the simulated
+ *      watchdog and to let time pass while the code waits for a
+ *      data EEPROM write to finish.
+ *
+ *      __persistent variables, __bit variables and the registers are
+ *      placed in their own sections so the Makefile can tell them
+ *      apart from the rest of RAM, see sim_ram.h and the ram target.
+ *      A __bit takes a byte on the host.
+ */
+#ifndef SIM_XC_H
+#define SIM_XC_H
+
+#include <stdint.h>
+
+typedef uint32_t uint24_t;
+typedef int32_t int24_t;
+
+#define _16F870
+#define __interrupt(...)
+#define __persistent __attribute__((section("sim_persistent")))
+#define __section(Name)
+#define __bit _Bool __attribute__((section("sim_bit")))
+#define NOP()
+#define di()
+#define ei()
+
+#define SIM_SFR(Name) \
+    volatile unsigned char Name __attribute__((section("sim_sfr")))
+#define SIM_SFR_BITS(Name, ...) \
+    volatile union { struct { unsigned char __VA_ARGS__; }; unsigned char Byte; } Name##bits \
+    __attribute__((section("sim_sfr")))
+
+SIM_SFR(TMR0);
+SIM_SFR(TMR1L);
+SIM_SFR(TMR1H);
+SIM_SFR(TMR2);
+SIM_SFR(PR2);
+SIM_SFR(T2CON);
+SIM_SFR(PIE2);
+SIM_SFR(PIR2);
+SIM_SFR(TRISB);
+SIM_SFR(TRISC);
+SIM_SFR(ADCON1);
+SIM_SFR(PORTB);
+SIM_SFR(PORTC);
+SIM_SFR(EECON2);
+
+SIM_SFR_BITS(TRISA, TRISA0:1, TRISA1:1, TRISA2:1, TRISA3:1, TRISA4:1, TRISA5:1, :2);
+SIM_SFR_BITS(INTCON, RBIF:1, INTF:1, TMR0IF:1, RBIE:1, INTE:1, TMR0IE:1, PEIE:1, GIE:1);
+SIM_SFR_BITS(PIR1, TMR1IF:1, TMR2IF:1, CCP1IF:1, SSPIF:1, TXIF:1, RCIF:1, ADIF:1, PSPIF:1);
+SIM_SFR_BITS(PIE1, TMR1IE:1, TMR2IE:1, CCP1IE:1, SSPIE:1, TXIE:1, RCIE:1, ADIE:1, PSPIE:1);
+SIM_SFR_BITS(OPTION_REG, PS:3, PSA:1, T0SE:1, T0CS:1, INTEDG:1, nRBPU:1);
+SIM_SFR_BITS(PCON, nBOR:1, nPOR:1, :6);
+SIM_SFR_BITS(T1CON, TMR1ON:1, TMR1CS:1, nT1SYNC:1, T1OSCEN:1, T1CKPS:2, :2);
+
+#define TRISA TRISAbits.Byte
+#define INTCON INTCONbits.Byte
+#define PIR1 PIR1bits.Byte
+#define PIE1 PIE1bits.Byte
+#define OPTION_REG OPTION_REGbits.Byte
+#define PCON PCONbits.Byte
+#define T1CON T1CONbits.Byte
+
+typedef union
+{
+    struct
+    {
+        unsigned char RD:1, WR:1, WREN:1, WRERR:1, :3, EEPGD:1;
+    };
+    unsigned char Byte;
+} Sim_EECON1_t;
+
+typedef union
+{
+    struct
+    {
+        unsigned char RA0:1, RA1:1, RA2:1, RA3:1, RA4:1, RA5:1, :2;
+    };
+    unsigned char Byte;
+} Sim_PORTA_t;
+
+volatile Sim_PORTA_t Sim_PORTA_Reg __attribute__((section("sim_sfr")));
+
+volatile Sim_PORTA_t *Sim_PortA(void);
+volatile Sim_EECON1_t *Sim_EECON1(void);
+volatile unsigned char *Sim_EEADR(void);
+volatile unsigned char *Sim_EEDATA(void);
+void Sim_ClearWatchdog(void);
+
+#define PORTAbits (*Sim_PortA())
+#define PORTA (Sim_PortA()->Byte)
+#define EECON1bits (*Sim_EECON1())
+#define EECON1 (Sim_EECON1()->Byte)
+#define EEADR (*Sim_EEADR())
+#define EEDATA (*Sim_EEDATA())
+#define CLRWDT() Sim_ClearWatchdog()
+
+#endif /* SIM_XC_H */